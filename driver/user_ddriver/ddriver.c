@@ -104,6 +104,28 @@ int check_valid(size_t size) {
     return 0;
 }
 
+int check_valid_iov(struct ddriver_iovec *iov, int iovcnt) {
+    int i;
+    if (iov == NULL || iovcnt <= 0) {
+        user_alert("empty io vector");
+        return -EINVAL;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        if (!IS_ADDR_ALIGN(iov[i].offset) || iov[i].size == 0 
+            || iov[i].size % CONFIG_BLOCK_SZ != 0) {
+            user_alert("iov[%d] offset %ld size %ld should align to %d", 
+                       i, iov[i].offset, iov[i].size, CONFIG_BLOCK_SZ);
+            return -EINVAL;
+        }
+        if (iov[i].offset + iov[i].size > CONFIG_DISK_SZ) {
+            user_alert("iov[%d] offset %ld size %ld out of device", 
+                       i, iov[i].offset, iov[i].size);
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
 int emulate_rotate(int fd, off_t start, off_t end) {
     int bytes_per_track = disk.layout_size / disk.track_num;
     int lat_per_track = disk.seek_lat;
@@ -236,6 +258,79 @@ int ddriver_read(int fd, char *buf, size_t size){
     INC_READCNT(disk);
     return CONFIG_BLOCK_SZ;
 }
+/**
+ * @brief 向量化IO的公共部分：整个向量只算一次设备请求（一次RW_DELAY），
+ * 段与段不连续时按磁头移动距离计入寻道
+ * 
+ * @param fd 
+ * @param iov 
+ * @param iovcnt 
+ * @param is_write 
+ * @return int 传输的总字节数，否则为负的错误码
+ */
+static int ddriver_rw_iov(int fd, struct ddriver_iovec *iov, int iovcnt, int is_write) {
+    int   res = check_valid_iov(iov, iovcnt);
+    int   i;
+    int   total = 0;
+    off_t cur;
+    ssize_t done;
+
+    if (res < 0)
+        return res;
+
+    if (is_write)
+        RW_DELAY(disk, write);
+    else
+        RW_DELAY(disk, read);
+
+    cur = lseek(fd, 0, SEEK_CUR);
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].offset != cur) {
+            INC_SEEKCNT(disk);
+            emulate_rotate(fd, cur, iov[i].offset);
+        }
+        if (is_write)
+            done = pwrite(fd, iov[i].buf, iov[i].size, iov[i].offset);
+        else
+            done = pread(fd, iov[i].buf, iov[i].size, iov[i].offset);
+        if (done != (ssize_t)iov[i].size) {
+            user_panic("iov[%d] %s error: %s", i, is_write ? "write" : "read", 
+                       strerror(errno));
+            return -EIO;
+        }
+        cur    = iov[i].offset + iov[i].size;
+        total += iov[i].size;
+    }
+    lseek(fd, cur, SEEK_SET);                         /* 磁头停在最后一段之后 */
+
+    if (is_write)
+        INC_WRITECNT(disk);
+    else
+        INC_READCNT(disk);
+    return total;
+}
+/**
+ * @brief 向量化磁盘写入，一次请求写入多个（可不连续的）块区间
+ * 
+ * @param fd 
+ * @param iov 每段的offset和size都需要对齐到IO单位
+ * @param iovcnt 
+ * @return int 写入的总字节数
+ */
+int ddriver_writev(int fd, struct ddriver_iovec *iov, int iovcnt) {
+    return ddriver_rw_iov(fd, iov, iovcnt, 1);
+}
+/**
+ * @brief 向量化磁盘读出，一次请求读出多个（可不连续的）块区间
+ * 
+ * @param fd 
+ * @param iov 每段的offset和size都需要对齐到IO单位
+ * @param iovcnt 
+ * @return int 读出的总字节数
+ */
+int ddriver_readv(int fd, struct ddriver_iovec *iov, int iovcnt) {
+    return ddriver_rw_iov(fd, iov, iovcnt, 0);
+}
 /**
  * @brief 
  * 
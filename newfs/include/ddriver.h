@@ -42,6 +42,26 @@ int ddriver_write(int fd, char *buf, size_t size);
  */
 int ddriver_read(int fd, char *buf, size_t size);
 
+/**
+ * @brief 向量化写入，多个（可不连续的）块区间只算一次设备请求
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要写入的区间，每段的offset和size都要对齐到单次设备IO单位
+ * @param iovcnt 区间个数
+ * @return int 写入的总字节数，否则失败
+ */
+int ddriver_writev(int fd, struct ddriver_iovec *iov, int iovcnt);
+
+/**
+ * @brief 向量化读出，多个（可不连续的）块区间只算一次设备请求
+ * 
+ * @param fd ddriver设备handler
+ * @param iov 要读出的区间，每段的offset和size都要对齐到单次设备IO单位
+ * @param iovcnt 区间个数
+ * @return int 读出的总字节数，否则失败
+ */
+int ddriver_readv(int fd, struct ddriver_iovec *iov, int iovcnt);
+
 /**
  * @brief ddriver IO控制
  * 
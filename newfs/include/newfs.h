@@ -8,7 +8,11 @@
 #include "fcntl.h"
 #include "string.h"
 #include "fuse.h"
+#include "fuse_lowlevel.h"
 #include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include "ddriver.h"
 #include "errno.h"
 #include "types.h"
@@ -27,6 +31,7 @@ void *newfs_init(struct fuse_conn_info *);
 void newfs_destroy(void *);
 int newfs_mkdir(const char *, mode_t);
 int newfs_getattr(const char *, struct stat *);
+int newfs_getattr_nolock(const char *, struct stat *);
 int newfs_readdir(const char *, void *, fuse_fill_dir_t, off_t,
                   struct fuse_file_info *);
 int newfs_mknod(const char *, mode_t, dev_t);
@@ -43,25 +48,215 @@ int newfs_truncate(const char *, off_t);
 
 int newfs_open(const char *, struct fuse_file_info *);
 int newfs_opendir(const char *, struct fuse_file_info *);
+int newfs_release(const char *, struct fuse_file_info *);
+void newfs_op_begin(int kind);
+void newfs_op_end(int kind);
+void newfs_dentry_stat(struct newfs_dentry *dentry, const struct newfs_attr *attr, struct stat *newfs_stat);
+int newfs_do_create(struct newfs_dentry *parent, const char *fname, NEW_FILE_TYPE ftype,
+                    struct newfs_dentry **out);
+int newfs_do_remove(struct newfs_dentry *dentry);
+int newfs_do_rename(struct newfs_dentry *from_dentry, struct newfs_dentry *to_parent, const char *fname);
+int newfs_do_readdir(struct newfs_inode *inode, void *buf, fuse_fill_dir_t filler, off_t offset);
+int newfs_do_write(struct newfs_inode *inode, struct newfs_fh *fh, const char *buf, size_t size, off_t offset);
+int newfs_do_read(struct newfs_inode *inode, struct newfs_fh *fh, char *buf, size_t size, off_t offset);
+int newfs_do_truncate(struct newfs_inode *inode, off_t offset);
+int newfs_do_utimens(struct newfs_inode *inode, const struct timespec tv[2]);
+/******************************************************************************
+ * SECTION: newfs_fh.c
+ *******************************************************************************/
+struct newfs_fh *newfs_fh_open(struct newfs_inode *inode);
+void newfs_fh_release(struct newfs_fh *fh);
+int newfs_fh_readahead(struct newfs_fh *fh, off_t offset, size_t size);
+void newfs_fh_cursor_get(struct newfs_fh *fh, struct newfs_extent_cursor *cursor);
+void newfs_fh_cursor_put(struct newfs_fh *fh, struct newfs_extent_cursor *cursor);
+/******************************************************************************
+ * SECTION: newfs_ll.c
+ *******************************************************************************/
+int newfs_ll_main(struct fuse_args *args);
 
 /******************************************************************************
  * SECTION: newfs_utils.c
  *******************************************************************************/
 char *newfs_get_fname(const char *path);
-int newfs_calc_lvl(const char *path);
+int newfs_dev_readv(struct ddriver_iovec *iov, int iovcnt);
+int newfs_dev_writev(struct ddriver_iovec *iov, int iovcnt);
 int newfs_driver_read(int offset, uint8_t *out_content, int size);
 int newfs_driver_write(int offset, uint8_t *in_content, int size);
+int newfs_driver_read_direct(int offset, uint8_t *out_content, int size);
+int newfs_driver_write_direct(int offset, uint8_t *in_content, int size);
 int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry);
+int newfs_drop_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry);
+int newfs_drop_inode(struct newfs_inode *inode);
 struct newfs_dentry *newfs_lookup(const char *path, int *is_find, int *is_root);
+struct newfs_dentry *newfs_lookup_lazy(const char *path, int *is_find, int *is_root);
+int newfs_lookup_nolock(const char *path, struct newfs_dentry **dentry, struct newfs_attr *attr, int *is_root);
+void newfs_inode_attr(struct newfs_inode *inode, struct newfs_attr *attr);
+int newfs_read_attrs(struct newfs_dentry **dentrys, int cnt);
 struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry);
 int newfs_alloc_data();
+int newfs_alloc_data_near(int goal);
+void newfs_free_inode(int ino);
+void newfs_free_data(int blk);
+int newfs_resize_file(struct newfs_inode *inode, int size);
+void newfs_mark_inode_dirty(struct newfs_inode *inode);
+void newfs_update_time(struct newfs_inode *inode, int flags);
+int newfs_atime_stale(struct newfs_inode *inode);
+void newfs_mark_blks_dirty(struct newfs_inode *inode, int lo, int hi);
 int newfs_sync_inode(struct newfs_inode *inode);
+int newfs_flush();
+int newfs_sync_super();
 struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino);
+struct newfs_inode *newfs_load_inode(struct newfs_dentry *dentry);
 int newfs_mount(struct custom_options options);
 int newfs_umount();
-struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir);
+/******************************************************************************
+ * SECTION: newfs_bitmap.c
+ *******************************************************************************/
+int newfs_bitmap_init(struct newfs_bitmap *bm, uint8_t *map, int nbits);
+void newfs_bitmap_destroy(struct newfs_bitmap *bm);
+int newfs_bitmap_alloc(struct newfs_bitmap *bm);
+int newfs_bitmap_alloc_near(struct newfs_bitmap *bm, int goal);
+void newfs_bitmap_free(struct newfs_bitmap *bm, int bit);
+int newfs_bitmap_test(struct newfs_bitmap *bm, int bit);
+int newfs_bitmap_sync(struct newfs_bitmap *bm, int offset);
+/******************************************************************************
+ * SECTION: newfs_dir.c
+ *******************************************************************************/
+int newfs_dir_index_insert(struct newfs_inode *inode, struct newfs_dentry *dentry);
+void newfs_dir_index_remove(struct newfs_inode *inode, struct newfs_dentry *dentry);
+struct newfs_dentry *newfs_dir_index_find(struct newfs_inode *inode, const char *name, int len);
+unsigned int newfs_dir_read_begin(struct newfs_inode *inode);
+int newfs_dir_read_retry(struct newfs_inode *inode, unsigned int seq);
+struct newfs_dentry *newfs_dir_index_find_nolock(struct newfs_inode *inode, const char *name, int len, unsigned int seq);
+void newfs_dir_index_destroy(struct newfs_inode *inode);
+struct newfs_dentry *newfs_dir_seek(struct newfs_inode *inode, long off);
+void newfs_dir_tell(struct newfs_inode *inode, struct newfs_dentry *dentry, long off);
+/******************************************************************************
+ * SECTION: newfs_writeback.c
+ *******************************************************************************/
+long newfs_now_ms();
+int newfs_wb_start(struct custom_options options);
+void newfs_wb_stop();
+void newfs_wb_throttle();
+void newfs_wb_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_file.c
+ *******************************************************************************/
+void newfs_file_init(int max_blks);
+void newfs_file_destroy();
+int newfs_file_resident(struct newfs_inode *inode, int lo, int hi);
+int newfs_file_load(struct newfs_inode *inode, int lo, int hi, int fill, struct newfs_extent_cursor *cursor);
+int newfs_file_read(struct newfs_inode *inode, char *buf, int size, int offset,
+                    struct newfs_extent_cursor *cursor);
+int newfs_file_write(struct newfs_inode *inode, const char *buf, int size, int offset,
+                     struct newfs_extent_cursor *cursor);
+int newfs_file_zero(struct newfs_inode *inode, int old_size, int size);
+void newfs_file_truncate(struct newfs_inode *inode, int nblks);
+int newfs_file_sync(struct newfs_inode *inode, int lo, int hi);
+void newfs_file_evict(struct newfs_inode *inode);
+void newfs_file_release(struct newfs_inode *inode);
+void newfs_file_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_icache.c
+ *******************************************************************************/
+void newfs_icache_init(int max_objs);
+void newfs_icache_add(struct newfs_inode *inode);
+void newfs_icache_remove(struct newfs_inode *inode);
+struct newfs_inode *newfs_icache_find(int ino);
+void newfs_icache_touch(struct newfs_inode *inode);
+int newfs_icache_over_limit();
+void newfs_icache_shrink();
+void newfs_icache_sync_atime();
+void newfs_icache_drop_orphans();
+void newfs_icache_destroy();
+void newfs_icache_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_slab.c
+ *******************************************************************************/
+void newfs_slab_init();
+void newfs_slab_destroy();
+struct newfs_dentry *newfs_dentry_alloc();
+void newfs_dentry_free(struct newfs_dentry *dentry);
+struct newfs_inode *newfs_inode_alloc();
+void newfs_inode_free(struct newfs_inode *inode);
+struct newfs_dentry *new_dentry(char *fname, NEW_FILE_TYPE ftype);
+long newfs_slab_in_use();
+void newfs_slab_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_itable.c
+ *******************************************************************************/
+int newfs_itable_init(int ino_blks);
+void newfs_itable_destroy();
+int newfs_itable_prefetch(int lo, int hi);
+int newfs_itable_get(int ino, struct newfs_inode_d *inode_d);
+void newfs_itable_put(int ino, struct newfs_inode_d *inode_d);
+int newfs_itable_warmup();
+void newfs_itable_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_journal.c
+ *******************************************************************************/
+int newfs_journal_init(int offset, int blks, int format);
+void newfs_journal_destroy();
+int newfs_journal_enabled();
+void newfs_journal_lock();
+void newfs_journal_unlock();
+int newfs_journal_write(int offset, uint8_t *in_content, int size);
+void newfs_journal_overlay(int offset, uint8_t *out_content, int size);
+void newfs_journal_revoke(int blkno);
+int newfs_journal_commit();
+int newfs_journal_checkpoint();
+void newfs_journal_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_pcache.c
+ *******************************************************************************/
+void newfs_pcache_init();
+void newfs_pcache_destroy();
+struct newfs_dentry *newfs_pcache_find(const char *path, int len);
+void newfs_pcache_insert(const char *path, int len, struct newfs_dentry *dentry);
+void newfs_pcache_invalidate(const char *path, int subtree);
+void newfs_pcache_invalidate_children(struct newfs_dentry *parent);
+void newfs_pcache_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_epoch.c
+ *******************************************************************************/
+int newfs_epoch_enter();
+void newfs_epoch_exit(int e);
+void newfs_epoch_defer(void (*fn)(void *), void *obj);
+void newfs_epoch_reclaim(int force);
+void newfs_epoch_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_extent.c
+ *******************************************************************************/
+void newfs_extent_init(struct newfs_inode *inode);
+void newfs_extent_destroy(struct newfs_inode *inode);
+int newfs_extent_load(struct newfs_inode *inode, struct newfs_inode_d *inode_d);
+int newfs_extent_sync(struct newfs_inode *inode, struct newfs_inode_d *inode_d);
+int newfs_bmap(struct newfs_inode *inode, int lblk);
+int newfs_extent_grow(struct newfs_inode *inode, int nblks);
+void newfs_extent_truncate(struct newfs_inode *inode, int nblks);
+int newfs_extent_rw(struct newfs_inode *inode, int lblk, int nblks, uint8_t **bufs, int is_write,
+                    struct newfs_extent_cursor *cursor);
+int newfs_extent_read_meta(struct newfs_inode *inode, int lblk, int nblks, uint8_t *buf);
+/******************************************************************************
+ * SECTION: newfs_bounce.c
+ *******************************************************************************/
+void newfs_bounce_direct();
+uint8_t *newfs_bounce_get(int size);
+void newfs_bounce_dump_stats();
+/******************************************************************************
+ * SECTION: newfs_cache.c
+ *******************************************************************************/
+int newfs_cache_init(int nbufs);
+void newfs_cache_destroy();
+int newfs_cache_enabled();
+int newfs_cache_read(int offset, uint8_t *out_content, int size);
+int newfs_cache_write(int offset, uint8_t *in_content, int size);
+int newfs_cache_flush();
+void newfs_cache_invalidate(int offset, int size);
+void newfs_cache_dump_stats();
 /******************************************************************************
  * SECTION: newfs_debug.c
  *******************************************************************************/
 void newfs_dump_map();
+void newfs_dump_stats();
 #endif /* _newfs_H_ */
\ No newline at end of file
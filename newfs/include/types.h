@@ -5,12 +5,14 @@
 /******************************************************************************
  * SECTION: Macro
  *******************************************************************************/
-#define NEWFS_MAGIC_NUM 880818 // 卸载时的magic数
+#define NEWFS_MAGIC_NUM 880821 // 卸载时的magic数，磁盘格式变化时递增
 #define NEWFS_ERROR_NONE 0
 #define NEWFS_SUPER_OFS 0     // 超级快的offset
 #define NEWFS_ERROR_IO EIO    /* Error Input/Output */
-#define NEWFS_DATA_PER_FILE 6 // 数据最多占6块
 #define NEWFS_ROOT_INO 0      // 根节点ino
+#define NEWFS_INODE_PER_BLK 16 // 每个逻辑块放16个inode
+#define NEWFS_INODE_SZ 64      // 每个inode在磁盘上占64字节
+#define NEWFS_EXTENTS_INLINE 3 // inode内直接存放的extent数，其余放在溢出extent块
 #define NEWFS_ERROR_NOSPACE ENOSPC
 #define UINT8_BITS 8
 #define NEWFS_ERROR_EXISTS EEXIST
@@ -18,20 +20,70 @@
 #define NEWFS_ERROR_NOTFOUND ENOENT
 #define NEWFS_ERROR_SEEK ESPIPE
 #define NEWFS_ERROR_ISDIR EISDIR
+#define NEWFS_ERROR_INVAL EINVAL
+#define NEWFS_ERROR_NOTEMPTY ENOTEMPTY
+#define NEWFS_ERROR_NOTDIR ENOTDIR
+#define NEWFS_ERROR_AGAIN EAGAIN     /* 不加锁的查找遇到并发修改，需要加锁重来 */
+#define NEWFS_ERROR_NAMETOOLONG ENAMETOOLONG
+#define NEWFS_ERROR_FBIG EFBIG
+#define NEWFS_CACHE_BLKS_DEFAULT 256 // 块缓存默认块数
+#define NEWFS_CACHE_BATCH 64         // 一次缓存读写最多处理的块数
+#define NEWFS_BUF_VALID 0x1          // 缓存块中的数据有效
+#define NEWFS_BUF_DIRTY 0x2          // 缓存块被修改，尚未写回
+#define NEWFS_DHASH_INIT 8           // 目录哈希表的初始桶数
+#define NEWFS_INODE_DIRTY 0x1        // inode记录（大小、extent等）被修改，尚未写回
+#define NEWFS_INODE_ATIME 0x2        // 只有访问时间被修改，不挂脏链表，随下次写回inode记录或换出时落盘
+#define NEWFS_PCACHE_SLOTS 1024      // 路径缓存的槽数，2的幂
+#define NEWFS_PCACHE_PATH_LEN 128    // 槽中路径的容量，更长的路径不缓存
+#define NEWFS_FLUSH_INTERVAL_DEFAULT 5000 // 回写线程默认每5秒醒来一次，单位ms
+#define NEWFS_DIRTY_EXPIRE_DEFAULT 30000  // 脏了超过30秒的inode被回写，单位ms
+#define NEWFS_DIRTY_BG_KB_DEFAULT 256     // 脏数据超过256KB时立即唤醒回写线程
+#define NEWFS_DIRTY_LIMIT_KB_DEFAULT 1024 // 脏数据超过1MB时写者等待回写
+#define NEWFS_ATTR_TTL_MS 1000       // readdir顺带读出的属性的有效期，单位ms
+#define NEWFS_RDPLUS_BATCH 64        // readdir一批读入属性的目录项数
+#define NEWFS_JOURNAL_BLKS 256       // 日志区块数，格式化时确定
+#define NEWFS_JOURNAL_MAGIC 0x6a726e6c
+#define NEWFS_JOURNAL_HASH 1024      // 日志缓冲的哈希桶数，2的幂
+#define NEWFS_JOURNAL_DESC 1         // 描述块
+#define NEWFS_JOURNAL_COMMIT 2       // 提交块
+#define NEWFS_JBUF_RUNNING 0x1       // 在当前事务中被修改，尚未提交
+#define NEWFS_JBUF_LOGGED 0x2        // 已提交到日志，尚未写回原位
+#define NEWFS_SLAB_CHUNK_OBJS 64     // slab每次向系统要的对象数
+#define NEWFS_FILE_BLKS_DEFAULT 1024 // 常驻内存的文件数据块默认上限
+#define NEWFS_ICACHE_OBJS_DEFAULT 8192 // 内存中inode和dentry总数的默认上限
+#define NEWFS_EPOCH_STRIPES 16       // 读者计数分散到的cache line数，2的幂
+#define NEWFS_EPOCH_BATCH 64         // 攒够这么多待释放对象再等读者退出
+#define NEWFS_IHASH_SIZE 4096        // ino到内存inode的哈希桶数，2的幂
+#define NEWFS_ENTRY_TIMEOUT_DEFAULT 1.0 // 内核缓存目录项的时间，单位秒
+#define NEWFS_ATTR_TIMEOUT_DEFAULT 1.0  // 内核缓存属性的时间，单位秒
+#define NEWFS_TIME_ATIME 0x1         // newfs_update_time：更新访问时间
+#define NEWFS_TIME_MTIME 0x2         // 更新内容修改时间
+#define NEWFS_TIME_CTIME 0x4         // 更新状态改变时间
+#define NEWFS_ATIME_MAX_AGE (24 * 3600) // 访问时间落后超过一天时读也要更新，单位秒
+#define NEWFS_OP_READ       0        // 只读：共享持有tree_lock
+#define NEWFS_OP_MODIFY     1        // 修改已有文件：再共享持有commit_lock
+#define NEWFS_OP_NAMESPACE  2        // 创建、删除、改名：独占持有tree_lock
+#define NEWFS_RA_MIN_BLKS 4          // 检测到顺序读后第一次预读的块数
+#define NEWFS_RA_MAX_BLKS 64         // 预读窗口上限，每次缺块时翻倍
 /******************************************************************************
  * SECTION: Macro Function
  *******************************************************************************/
 #define NEWFS_DRIVER() (newfs_super.fd)
 #define NEWFS_IO_SZ() (newfs_super.sz_io)
 #define NEWFS_DISK_SZ() (newfs_super.sz_disk)
-#define NEWFS_ROUND_DOWN(value, round) (value % round == 0 ? value : (value / round) * round)   // 向下取整
-#define NEWFS_ROUND_UP(value, round) (value % round == 0 ? value : (value / round + 1) * round) // 向上取整
-#define NEWFS_BLKS_SZ(blk) (newfs_super.blks_size * blk)
+#define NEWFS_ROUND_DOWN(value, round) ((value) % (round) == 0 ? (value) : ((value) / (round)) * (round))   // 向下取整
+#define NEWFS_ROUND_UP(value, round) ((value) % (round) == 0 ? (value) : ((value) / (round) + 1) * (round)) // 向上取整
+#define NEWFS_BLKS_SZ(blk) (newfs_super.blks_size * (blk))
+#define NEWFS_MAX_FILE_SZ() ((off_t)NEWFS_BLKS_SZ(newfs_super.data_blks)) // 文件最大占满整个数据区，总能用int表示
 #define NEWFS_IS_DIR(pinode) (pinode->ftype == NEWFS_DIR)
 #define NEWFS_IS_REG(pinode) (pinode->ftype == NEWFS_REG_FILE)
+#define NEWFS_LL_NODEID(ino) ((fuse_ino_t)(ino) + 1) // 低层接口的节点号，FUSE的根是1，newfs的根是0
+#define NEWFS_LL_INO(nodeid) ((int)((nodeid) - 1))
 #define NEWFS_ASSIGN_FNAME(psfs_dentry, _fname) memcpy(psfs_dentry->name, _fname, strlen(_fname))
 #define NEWFS_DATA_OFS(data_blk) (newfs_super.data_offset + NEWFS_BLKS_SZ(data_blk))
-#define NEWFS_INO_OFS(ino) (newfs_super.ino_offset + NEWFS_BLKS_SZ(ino / 20) + 50 * (ino % 20))
+#define NEWFS_INO_OFS(ino) (newfs_super.ino_offset + NEWFS_BLKS_SZ((ino) / NEWFS_INODE_PER_BLK) + NEWFS_INODE_SZ * ((ino) % NEWFS_INODE_PER_BLK))
+#define NEWFS_DENTRY_REC_LEN(name_len) NEWFS_ROUND_UP(sizeof(struct newfs_dentry_d) + (name_len), 4) // 目录项记录按4字节对齐
+#define NEWFS_EXTENTS_PER_BLK() ((NEWFS_BLKS_SZ(1) - sizeof(struct newfs_extent_blk_d)) / sizeof(struct newfs_extent))
 
 typedef enum newfs_file_type
 {
@@ -41,6 +93,31 @@ typedef enum newfs_file_type
 
 struct custom_options {
 	const char*        device;
+	int                cache_blks; // 块缓存的块数，0表示不使用缓存
+	int                flush_interval; // 回写线程的唤醒周期(ms)，0表示不启动回写线程
+	int                dirty_expire;   // inode脏了多久后被回写(ms)
+	int                dirty_bg_kb;    // 脏数据达到该值时立即唤醒回写线程
+	int                dirty_limit_kb; // 脏数据达到该值时写者等待回写，0表示不限制
+	int                inode_warmup;   // 挂载时顺序读入整个inode表
+	int                file_cache_blks; // 常驻内存的文件数据块上限，0表示不限制
+	int                inode_cache;     // 内存中inode和dentry总数的上限，0表示不限制
+	int                lowlevel;        // 使用FUSE低层接口，按节点号而不是路径访问
+	double             entry_timeout;   // 目录项在内核中的有效期(s)
+	double             attr_timeout;    // 属性在内核中的有效期(s)
+	int                kernel_cache;    // 打开文件时保留内核页缓存中已有的数据
+};
+
+struct newfs_bitmap {
+    uint64_t *words;   // 位图本体，指向ino_map/data_map
+    uint64_t *summary; // 第w位为1表示words[w]已满
+    int nbits;         // 可分配的位数
+    int nwords;
+    int nsummary;
+    int hint;          // next-fit的起始字
+    int used;          // 已占用的位数
+    int dirty_lo;      // 被修改过的字范围[dirty_lo, dirty_hi)，空表示没有
+    int dirty_hi;
+    pthread_mutex_t lock;  // 分配、释放和写回互斥
 };
 
 struct newfs_super {
@@ -67,6 +144,10 @@ struct newfs_super {
     int data_offset;
     int data_blks;
 
+    // 日志区
+    int journal_offset;
+    int journal_blks;
+
     // 根目录索引 
     struct newfs_dentry *root_dentry;// 根目录 dentry 方便快速访问
 
@@ -78,6 +159,18 @@ struct newfs_super {
     int is_mounted;
     uint8_t *ino_map;
     uint8_t *data_map;
+    struct newfs_bitmap ino_bm;  // ino_map的分配器
+    struct newfs_bitmap data_bm; // data_map的分配器
+    struct newfs_inode *dirty_inodes; // 有修改尚未写回的inode
+    long dirty_bytes;                 // 脏inode记录和脏块的总字节数
+
+    // 锁的顺序：tree_lock -> commit_lock -> inode->lock -> load_lock -> 各模块的锁 -> dev_lock
+    pthread_rwlock_t tree_lock;   // 目录树：创建、删除、改名和换出inode独占，其余操作共享
+    pthread_rwlock_t commit_lock; // 修改已有文件的操作共享，回写提交事务时独占
+    pthread_mutex_t load_lock;    // 把inode读入内存并挂到dentry上，同一inode只读入一份
+    pthread_mutex_t dirty_lock;   // 脏inode链表和dirty_bytes
+    pthread_mutex_t dev_lock;     // 设备请求队列，ddriver不能并发访问
+    unsigned int rename_seq;      // 目录改名期间为奇数，不加锁的查找据此发现路径被移走
 };
 
 struct newfs_super_d
@@ -109,6 +202,36 @@ struct newfs_super_d
 
     // 支持的限制 
     int ino_max; // 最大支持inode数
+
+    // 日志区，旧镜像上为0，表示不使用日志
+    int journal_offset;
+    int journal_blks;
+};
+
+struct newfs_extent {
+    int start; // 起始数据块号
+    int len;   // 连续的块数
+};
+
+// 上次读写落在的extent，顺序读写下次直接从这里找，不用从第一个extent数起
+struct newfs_extent_cursor {
+    uint32_t gen; // 与inode->ext_gen不同时作废
+    int idx;      // extent下标
+    int lblk;     // 这个extent的逻辑起点
+};
+
+// getattr需要的属性，inode不在内存时留在dentry上
+struct newfs_attr {
+    int size;
+    uint32_t atime; // 最后访问时间(s)
+    uint32_t mtime; // 最后修改内容的时间(s)
+    uint32_t ctime; // 最后修改属性的时间(s)
+};
+
+struct newfs_extent_blk_d {
+    int next;                       // 下一个溢出extent块，-1表示没有
+    int cnt;                        // 本块存放的extent数
+    struct newfs_extent extents[];  // 占满块内剩余空间
 };
 
 struct newfs_inode {
@@ -118,15 +241,57 @@ struct newfs_inode {
     int size;            // 文件已占用空间
     int link;            // 链接数，默认为1
     NEW_FILE_TYPE ftype; // 文件类型
+    uint32_t atime;      // 最后访问时间(s)
+    uint32_t mtime;      // 最后修改内容的时间(s)
+    uint32_t ctime;      // 最后修改属性的时间(s)
 
-    // 数据块的索引 
-    int block_pointer[6]; // 数据块指针
+    // 数据块的索引，extent按逻辑块顺序排列，首尾相接覆盖[0, blks)
+    struct newfs_extent *extents; // 全部extent（含溢出块中的）
+    int ext_cnt;
+    int ext_cap;
+    int *ext_blks;                // 溢出extent块链
+    int ext_blk_cnt;
+    int blks;                     // 已映射的逻辑块数
+    uint32_t ext_gen;             // 截断时递增，使newfs_extent_cursor作废
 
     // 其他字段 
     int dir_cnt;                  // 如果是目录类型文件，下面有几个目录项
     struct newfs_dentry *dentry;  // 指向该inode的dentry
     struct newfs_dentry *dentrys; // 所有目录项
-    uint8_t *data;
+    struct newfs_dentry **dhash;  // 目录项按名字哈希，桶数为2的幂
+    int dhash_size;
+    struct newfs_dir_blk *dblks;  // 每个目录块中存放的目录项，下标为逻辑块号
+    int dblk_cap;
+    long dir_cookie;              // 最近分配的目录项cookie
+    struct newfs_dentry *rd_next; // readdir上次停下的目录项，从rd_off继续时直接用
+    long rd_off;
+
+    // 文件数据按块缓存，第一次读写时才读入
+    uint8_t **fblks;               // fblks[i]为第i块的内容，NULL表示不在内存中
+    int fblk_cap;
+    int fblk_cnt;                  // 在内存中的块数
+    struct newfs_inode *flru_prev; // 有数据块在内存中的文件组成的LRU链
+    struct newfs_inode *flru_next;
+    struct newfs_inode *ilru_prev; // 内存中所有inode组成的LRU链
+    struct newfs_inode *ilru_next;
+
+    // 脏数据跟踪
+    int flags;                         // NEWFS_INODE_DIRTY、NEWFS_INODE_ATIME
+    int dirty_lo;                      // 被修改过的逻辑块范围[dirty_lo, dirty_hi)
+    int dirty_hi;
+    struct newfs_inode *dirty_next;    // 脏inode链表
+    struct newfs_inode **dirty_pprev;  // 不在链表中时为NULL
+    long dirty_bytes;                  // 计入newfs_super.dirty_bytes的字节数
+    long dirtied_at;                   // 挂上脏链表的时刻(ms)
+    int referenced;                    // 最近被访问过，换出时再给一次机会
+    struct newfs_inode *ihnext;        // ino哈希表的桶链
+    long nlookup;                      // 低层接口下内核持有的引用数，非0时不能换出
+    uint32_t generation;               // 读入或新建时分配，ino被重新使用时内核据此区分
+    long nopen;                        // 打开的句柄数，非0时不能换出
+    int orphan;                        // 打开期间被删除，最后一个句柄关闭时释放
+    unsigned int dseq;                 // 目录哈希表修改期间为奇数，不加锁的查找据此重试
+
+    pthread_rwlock_t lock; // 文件数据、大小和目录的readdir位置：读和回写共享，修改独占
 };
 
 struct newfs_inode_d
@@ -138,41 +303,287 @@ struct newfs_inode_d
     int link;            // 链接数，默认为1
     NEW_FILE_TYPE ftype; // 文件类型（目录类型、普通文件类型）
 
-    // 数据块的索引 
-    int block_pointer[6]; // 数据块指针（可固定分配）
-
     // 其他字段 
     int dir_cnt; // 如果是目录类型文件，下面有几个目录项
+
+    // 数据块的索引 
+    int ext_cnt;                                      // extent总数
+    int ext_blk;                                      // 第一个溢出extent块，-1表示没有
+    struct newfs_extent extents[NEWFS_EXTENTS_INLINE]; // 前几个extent
+
+    // 时间戳放在原来的空余字节中，旧镜像上为0
+    uint32_t atime;
+    uint32_t mtime;
+    uint32_t ctime;
 };
 
 struct newfs_dentry {
-    char     name[MAX_NAME_LEN];
+    char     name[MAX_NAME_LEN + 1]; // 以'\0'结尾，名字最长MAX_NAME_LEN字节
     uint32_t ino;
     /* TODO: Define yourself */
     NEW_FILE_TYPE ftype;
     struct newfs_inode *inode;    // 指向inode
     struct newfs_dentry *parent;  // 父亲inode的dentry
     struct newfs_dentry *brother; // 兄弟dentry
+    uint32_t hash;                // 名字的哈希值
+    int name_len;                 // 名字的长度
+    int blk;                      // 存放在父目录的第几个逻辑块
+    struct newfs_dentry *bnext;   // 同一目录块中的下一个目录项
+    long cookie;                  // readdir偏移，目录内递增，目录项搬到别的块时保持不变
+    struct newfs_attr attr;       // readdir读出的属性，inode不在内存时供getattr使用
+    long attr_expire;             // attr的过期时刻(ms)，0表示没有
+    struct newfs_dentry *hnext;   // 目录哈希表的桶链
 };
 
 struct newfs_dentry_d
 {
-    char name[MAX_NAME_LEN];
     uint32_t ino;
-    /* TODO: Define yourself */
-    NEW_FILE_TYPE ftype;
+    uint16_t rec_len; // 记录长度，含名字和对齐填充，块内最后一条延伸到块尾
+    uint8_t name_len; // 0表示空记录
+    uint8_t ftype;
+    char name[];      // 不以'\0'结尾
+};
+
+struct newfs_dir_blk {
+    struct newfs_dentry *head; // 块中的目录项，用bnext串起
+    int used;                  // 已占用的字节数，按记录对齐后的长度计
+};
+
+struct newfs_pcache_slot {
+    unsigned int seq;            // 槽修改期间为奇数，查找不加锁
+    uint32_t hash;               // 完整路径的哈希值
+    int len;                     // 路径长度，0表示空槽
+    char path[NEWFS_PCACHE_PATH_LEN];
+    struct newfs_dentry *dentry;
+};
+
+struct newfs_pcache_stats {
+    long hits;          // 命中次数
+    long misses;        // 未命中次数
+    long invalidations; // 因创建、删除、重命名被作废的槽数
+};
+
+struct newfs_wb_stats {
+    long cycles;          // 回写次数
+    long inodes_written;  // 写回的inode数
+    long bytes_written;   // 写回的脏字节数
+    long throttled;       // 写者因超过上限而等待的次数
+    long throttled_ms;    // 写者等待的总时间
+};
+
+struct newfs_writeback {
+    pthread_t thread;
+    pthread_mutex_t lock;   // 配合两个条件变量，不与文件系统的锁嵌套
+    pthread_cond_t wake;    // 唤醒回写线程
+    pthread_cond_t drained; // 一轮回写结束，等待的写者重新检查
+    int running;
+    int stop;
+    struct newfs_wb_stats stats;
+};
+
+struct newfs_journal_sb_d {
+    uint32_t magic;
+    uint32_t seq; // 日志区第一个有效事务的序号，之前的事务都已写回原位
+};
+
+struct newfs_journal_desc_d {
+    uint32_t magic;
+    int type;     // NEWFS_JOURNAL_DESC
+    uint32_t seq;
+    int ndesc;    // 描述块数，tags放不下时占用后面连续的块
+    int nblks;    // 事务中的元数据块数，块映像紧跟在描述块之后
+    int nrevoke;  // 撤销的块数
+    int tags[];   // 前nblks个是块映像的块号，后nrevoke个是撤销的块号
+};
+
+struct newfs_journal_commit_d {
+    uint32_t magic;
+    int type;          // NEWFS_JOURNAL_COMMIT
+    uint32_t seq;
+    uint32_t checksum; // 描述块和块映像的校验和，检查提交是否完整
+};
+
+struct newfs_jbuf {
+    int blkno;                 // 磁盘上的逻辑块号
+    int flags;                 // NEWFS_JBUF_RUNNING / NEWFS_JBUF_LOGGED
+    uint8_t *data;             // 最新内容
+    uint8_t *frozen;           // 已提交的内容，已提交后又被修改时才有
+    struct newfs_jbuf *hnext;  // 哈希链
+    struct newfs_jbuf *next;   // 所有日志缓冲
+    struct newfs_jbuf **pprev;
+};
+
+struct newfs_journal_stats {
+    long commits;           // 提交的事务数
+    long blks_logged;       // 写入日志的块映像数
+    long checkpoints;       // 检查点次数
+    long blks_checkpointed; // 检查点写回原位的块数
+    long revokes;           // 撤销的块数
+    long overflows;         // 事务大于日志区、直接写回原位的次数
+    long replayed_txns;     // 挂载时重放的事务数
+    long replayed_blks;     // 挂载时重放的块数
+};
+
+struct newfs_journal {
+    int offset;                 // 日志区在磁盘上的偏移
+    int blks;                   // 日志区块数，0表示不使用日志
+    int head;                   // 下一个事务写在日志区的第几块
+    uint32_t seq;               // 下一个事务的序号
+    struct newfs_jbuf **htable; // 按块号哈希
+    struct newfs_jbuf *bufs;
+    int running;                // 当前事务的块数
+    int *revoked;               // 当前事务撤销的块号
+    int nrevoke;
+    int revoke_cap;
+    struct newfs_journal_stats stats;
+};
+
+struct newfs_itable_stats {
+    long hits;        // 记录所在的块已在缓存中
+    long misses;      // 需要读盘
+    long reads;       // 设备请求数
+    long blks_loaded; // 读入的inode块数
+};
+
+struct newfs_itable {
+    uint8_t **blks; // blks[i]为第i个inode块的内容，NULL表示还没读入
+    int nblks;
+    struct newfs_itable_stats stats;
+};
+
+struct newfs_file_stats {
+    long loaded;  // 从磁盘读入的块数
+    long reads;   // 读盘请求数
+    long zeroed;  // 整块覆盖写或新分配、不用读盘的块数
+    long evicted; // 换出的干净块数
+    int peak;     // 常驻块数的最大值
+};
+
+struct newfs_file_cache {
+    int max_blks;             // 常驻块数上限，0表示不限制
+    int blks;                 // 所有文件常驻的块数
+    struct newfs_inode *head; // LRU链，表头最久未用
+    struct newfs_inode *tail;
+    struct newfs_file_stats stats;
+};
+
+// 打开文件或目录的句柄，存放在fuse_file_info->fh中
+struct newfs_fh {
+    struct newfs_inode *inode;         // 打开期间计入nopen，不会被换出或释放
+    pthread_mutex_t lock;              // 同一句柄上的读写可能并发，保护下面的状态
+    off_t next_off;                    // 上次读结束的位置，从这里接着读视为顺序读
+    int ra_blks;                       // 预读窗口(块)，随机读时为0
+    struct newfs_extent_cursor cursor; // 上次读写落在的extent
+};
+
+struct newfs_icache_stats {
+    long added;            // 读入或新建的inode数
+    long evicted_inodes;   // 换出的inode数
+    long evicted_dentries; // 随目录换出的dentry数
+};
+
+struct newfs_icache {
+    int max_objs;             // inode和dentry总数的上限，0表示不限制
+    int inodes;               // 内存中的inode数
+    struct newfs_inode *head; // LRU链，表头最久未用
+    struct newfs_inode *tail;
+    struct newfs_inode *ihash[NEWFS_IHASH_SIZE]; // 按ino找内存中的inode
+    uint32_t generation;      // 最近分配的inode代数
+    struct newfs_icache_stats stats;
+};
+
+struct newfs_slab_chunk {
+    struct newfs_slab_chunk *next; // 同一slab的所有内存块
+    uint8_t objs[];                // NEWFS_SLAB_CHUNK_OBJS个对象
+};
+
+struct newfs_slab_stats {
+    long chunks; // 已分配的内存块数
+    long objs;   // 内存块中的对象总数
+    long in_use; // 正在使用的对象数
+    long peak;   // in_use的最大值
+    long allocs;
+    long frees;
+};
+
+struct newfs_slab {
+    const char *name;
+    int obj_size;                    // 按指针大小对齐后的对象大小
+    void *free;                      // 空闲对象链表，链接指针存在对象头部
+    struct newfs_slab_chunk *chunks;
+    struct newfs_slab_stats stats;
+};
+
+struct newfs_epoch_stripe {
+    long active[2];              // 分别进入两个epoch的读者数
+    char pad[64 - 2 * sizeof(long)];
+};
+
+struct newfs_epoch_retire {
+    void (*fn)(void *);          // 读者全部退出后调用
+    void *obj;
+};
+
+struct newfs_epoch {
+    struct newfs_epoch_stripe stripes[NEWFS_EPOCH_STRIPES];
+    unsigned int cur;             // 新进入的读者计入stripes[].active[cur & 1]
+    struct newfs_epoch_retire *retired; // 已从目录树摘下、等待释放的对象
+    int retired_cnt;
+    int retired_cap;
+    long reclaimed;
+    long syncs;
+};
+
+struct newfs_bounce {
+    uint8_t *buf; // 按IO单元对齐
+    int size;
+};
+
+struct newfs_bounce_stats {
+    long direct;   // 对齐请求直接读写调用者缓冲区的次数
+    long bounced;  // 经过中转缓冲区的次数
+    long allocs;   // 中转缓冲区分配或扩大的次数
+    long releases; // 线程退出时释放的中转缓冲区数
+};
+
+struct newfs_buf {
+    int blkno;                  // 缓存的逻辑块号，-1表示空闲
+    int flags;                  // NEWFS_BUF_VALID / NEWFS_BUF_DIRTY
+    uint8_t *data;              // 一个逻辑块大小的数据
+    struct newfs_buf *hnext;    // 哈希链
+    struct newfs_buf *lru_prev; // LRU链，表头方向为最近使用
+    struct newfs_buf *lru_next;
+};
+
+struct newfs_cache_stats {
+    long hits;          // 命中的块数
+    long misses;        // 未命中的块数
+    long evictions;     // 被换出的块数
+    long writebacks;    // 写回磁盘的脏块数
+    long fills_skipped; // 整块覆盖写、免去读盘的块数
+};
+
+struct newfs_cache {
+    int nbufs;                 // 缓存块数
+    int hsize;                 // 哈希桶数，2的幂
+    uint8_t *mem;              // 所有缓存块的数据区
+    struct newfs_buf *bufs;
+    struct newfs_buf **htable; // 按块号哈希
+    struct newfs_buf lru;      // LRU哨兵
+    struct newfs_cache_stats stats;
 };
 
-static inline struct newfs_dentry *new_dentry(char *fname, NEW_FILE_TYPE ftype)
+/**
+ * @brief FNV-1a字符串哈希
+ */
+static inline uint32_t newfs_name_hash(const char *name, int len)
 {
-    struct newfs_dentry *dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry));
-    memset(dentry, 0, sizeof(struct newfs_dentry));
-    NEWFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype = ftype;
-    dentry->ino = -1;
-    dentry->inode = NULL;
-    dentry->parent = NULL;
-    dentry->brother = NULL;
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
 }
 
 #endif /* _TYPES_H_ */
\ No newline at end of file
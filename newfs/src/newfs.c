@@ -12,32 +12,132 @@
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--cache_blks=%d", cache_blks),
+	OPTION("--flush_interval=%d", flush_interval),
+	OPTION("--dirty_expire=%d", dirty_expire),
+	OPTION("--dirty_bg_kb=%d", dirty_bg_kb),
+	OPTION("--dirty_limit_kb=%d", dirty_limit_kb),
+	OPTION("--inode_warmup", inode_warmup),
+	OPTION("--file_cache_blks=%d", file_cache_blks),
+	OPTION("--inode_cache=%d", inode_cache),
+	OPTION("--lowlevel", lowlevel),
+	OPTION("--entry_timeout=%lf", entry_timeout),
+	OPTION("--attr_timeout=%lf", attr_timeout),
+	OPTION("--kernel_cache", kernel_cache),
 	FUSE_OPT_END
 };
 
 struct custom_options options;			 /* 全局选项 */
 struct newfs_super newfs_super; 
 /******************************************************************************
+* SECTION: 加锁的FUSE操作
+*******************************************************************************/
+/* FUSE默认多线程调用。改变目录树的操作独占tree_lock，其余操作共享它，
+ * 查找、读、取属性可以同时进行；修改已有文件的操作再共享commit_lock，回写
+ * 提交事务时独占它。同一个文件的读写由inode->lock在操作内部排队，不同文件
+ * 的读写互不等待。操作之间互相调用时（如rmdir调用unlink）使用不加锁的版本。
+ * 操作结束、不再持有inode指针后，inode超过上限时独占tree_lock换出。
+ * getattr先不加锁地查一遍，只在遇到并发修改或需要读盘时才走加锁的版本；
+ * 从目录树摘下的dentry、inode攒够一批后在操作结束时等这些读者退出再释放 */
+void newfs_op_begin(int kind)
+{
+	if (kind != NEWFS_OP_READ)
+	{
+		newfs_wb_throttle(); // 可能等待回写，不能持有任何锁
+	}
+	if (kind == NEWFS_OP_NAMESPACE)
+	{
+		pthread_rwlock_wrlock(&newfs_super.tree_lock);
+	}
+	else
+	{
+		pthread_rwlock_rdlock(&newfs_super.tree_lock);
+	}
+	if (kind == NEWFS_OP_MODIFY)
+	{
+		pthread_rwlock_rdlock(&newfs_super.commit_lock);
+	}
+}
+void newfs_op_end(int kind)
+{
+	if (kind == NEWFS_OP_MODIFY)
+	{
+		pthread_rwlock_unlock(&newfs_super.commit_lock);
+	}
+	pthread_rwlock_unlock(&newfs_super.tree_lock);
+	if (newfs_icache_over_limit())
+	{
+		pthread_rwlock_wrlock(&newfs_super.tree_lock);
+		newfs_icache_shrink();
+		pthread_rwlock_unlock(&newfs_super.tree_lock);
+		newfs_epoch_reclaim(0);
+	}
+	else if (kind == NEWFS_OP_NAMESPACE)
+	{
+		newfs_epoch_reclaim(0);
+	}
+}
+#define NEWFS_LOCKED_OP(name, kind, proto, args)	\
+	static int name##_locked proto {		\
+		int ret;							\
+		newfs_op_begin(kind);				\
+		ret = name args;					\
+		newfs_op_end(kind);					\
+		return ret;							\
+	}
+
+NEWFS_LOCKED_OP(newfs_mkdir, NEWFS_OP_NAMESPACE, (const char* path, mode_t mode), (path, mode))
+NEWFS_LOCKED_OP(newfs_readdir, NEWFS_OP_READ, (const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+								struct fuse_file_info* fi), (path, buf, filler, offset, fi))
+NEWFS_LOCKED_OP(newfs_mknod, NEWFS_OP_NAMESPACE, (const char* path, mode_t mode, dev_t dev), (path, mode, dev))
+NEWFS_LOCKED_OP(newfs_write, NEWFS_OP_MODIFY, (const char* path, const char* buf, size_t size, off_t offset,
+							  struct fuse_file_info* fi), (path, buf, size, offset, fi))
+NEWFS_LOCKED_OP(newfs_read, NEWFS_OP_READ, (const char* path, char* buf, size_t size, off_t offset,
+							 struct fuse_file_info* fi), (path, buf, size, offset, fi))
+NEWFS_LOCKED_OP(newfs_utimens, NEWFS_OP_MODIFY, (const char* path, const struct timespec tv[2]), (path, tv))
+NEWFS_LOCKED_OP(newfs_truncate, NEWFS_OP_MODIFY, (const char* path, off_t offset), (path, offset))
+NEWFS_LOCKED_OP(newfs_unlink, NEWFS_OP_NAMESPACE, (const char* path), (path))
+NEWFS_LOCKED_OP(newfs_rmdir, NEWFS_OP_NAMESPACE, (const char* path), (path))
+NEWFS_LOCKED_OP(newfs_rename, NEWFS_OP_NAMESPACE, (const char* from, const char* to), (from, to))
+NEWFS_LOCKED_OP(newfs_open, NEWFS_OP_READ, (const char* path, struct fuse_file_info* fi), (path, fi))
+NEWFS_LOCKED_OP(newfs_opendir, NEWFS_OP_READ, (const char* path, struct fuse_file_info* fi), (path, fi))
+NEWFS_LOCKED_OP(newfs_access, NEWFS_OP_READ, (const char* path, int type), (path, type))
+static int newfs_getattr_locked(const char* path, struct stat* st)
+{
+	int ret = newfs_getattr_nolock(path, st);
+
+	if (ret != -NEWFS_ERROR_AGAIN)
+	{
+		return ret;
+	}
+	newfs_op_begin(NEWFS_OP_READ);
+	ret = newfs_getattr(path, st);
+	newfs_op_end(NEWFS_OP_READ);
+	return ret;
+}
+/******************************************************************************
 * SECTION: FUSE操作定义
 *******************************************************************************/
 static struct fuse_operations operations = {
 	.init = newfs_init,						 /* mount文件系统 */		
 	.destroy = newfs_destroy,				 /* umount文件系统 */
-	.mkdir = newfs_mkdir,					 /* 建目录，mkdir */
-	.getattr = newfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
-	.readdir = newfs_readdir,				 /* 填充dentrys */
-	.mknod = newfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
-	.utimens = newfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
-	.unlink = NULL,							  		 /* 删除文件 */
-	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
-	.rename = NULL,							  		 /* 重命名，mv */
-
-	.open = NULL,							
-	.opendir = NULL,
-	.access = NULL
+	.mkdir = newfs_mkdir_locked,			 /* 建目录，mkdir */
+	.getattr = newfs_getattr_locked,		 /* 获取文件属性，类似stat，必须完成 */
+	.readdir = newfs_readdir_locked,		 /* 填充dentrys */
+	.mknod = newfs_mknod_locked,			 /* 创建文件，touch相关 */
+	.write = newfs_write_locked,			 /* 写入文件 */
+	.read = newfs_read_locked,				 /* 读文件 */
+	.utimens = newfs_utimens_locked,		 /* 修改时间，touch相关 */
+	.truncate = newfs_truncate_locked,		 /* 改变文件大小 */
+	.unlink = newfs_unlink_locked,			 /* 删除文件 */
+	.rmdir	= newfs_rmdir_locked,			 /* 删除目录， rm -r */
+	.rename = newfs_rename_locked,			 /* 重命名，mv */
+
+	.open = newfs_open_locked,							
+	.opendir = newfs_opendir_locked,
+	.release = newfs_release,				 /* 关闭文件，释放句柄 */
+	.releasedir = newfs_release,
+	.access = newfs_access_locked
 };
 /******************************************************************************
 * SECTION: 必做函数实现
@@ -85,31 +185,83 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	/* TODO: 解析路径，创建目录 */
 	(void)mode;
     int is_find, is_root;
-    char *fname;
-    struct newfs_dentry *last_dentry = newfs_lookup(path, &is_find, &is_root);
-    struct newfs_dentry *dentry;
-    struct newfs_inode *inode;
+    struct newfs_dentry *last_dentry;
+    int ret;
+
+    last_dentry = newfs_lookup(path, &is_find, &is_root);
+    if (last_dentry == NULL)
+    {
+        return -NEWFS_ERROR_IO;
+    }
 	// 如果路径已存在，则返回错误
     if (is_find)
     {
         return -NEWFS_ERROR_EXISTS;
     }
-	// 如果最后一个目录项对应的Inode是文件而不是目录，则返回错误
-    if (NEWFS_IS_REG(last_dentry->inode))
+	// 从路径中获取目录名，创建新的目录项和Inode
+    ret = newfs_do_create(last_dentry, newfs_get_fname(path), NEWFS_DIR, NULL);
+    if (ret == NEWFS_ERROR_NONE)
     {
-        return -NEWFS_ERROR_UNSUPPORTED;
+        newfs_pcache_invalidate(path, 0);
     }
-	// 从路径中获取目录名
-    fname = newfs_get_fname(path);
-	// 创建新的目录项和Inode
-    dentry = new_dentry(fname, NEWFS_DIR);
-    dentry->parent = last_dentry;
-    inode = newfs_alloc_inode(dentry);
-    newfs_alloc_dentry(last_dentry->inode, dentry);
+    return ret;
+}
 
-    return NEWFS_ERROR_NONE;
+/**
+ * @brief 目录项的属性，inode在内存中时以inode为准，否则用readdir读出的属性
+ * 
+ * @param dentry 
+ * @param attr 
+ */
+static void newfs_dentry_attr(struct newfs_dentry *dentry, struct newfs_attr *attr)
+{
+	struct newfs_inode *inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+
+	if (inode != NULL)
+	{
+		newfs_inode_attr(inode, attr);
+	}
+	else
+	{
+		*attr = dentry->attr;
+	}
 }
+/**
+ * @brief 按目录项填充属性
+ * 
+ * @param dentry 
+ * @param attr 由调用者取出，不加锁的getattr在确认目录没变之前取
+ * @param newfs_stat 
+ */
+void newfs_dentry_stat(struct newfs_dentry *dentry, const struct newfs_attr *attr, struct stat *newfs_stat)
+{
+	memset(newfs_stat, 0, sizeof(struct stat));
+	if (dentry->ftype == NEWFS_DIR)
+	{
+		newfs_stat->st_mode = __S_IFDIR | NEWFS_DEFAULT_PERM;// 目录类型，大小为目录项数乘以目录项大小
+	}
+	else
+	{
+		newfs_stat->st_mode = __S_IFREG | NEWFS_DEFAULT_PERM;// 文件类型
+	}
+	newfs_stat->st_size = attr->size;
+	newfs_stat->st_ino = dentry->ino;
+	newfs_stat->st_nlink = 1;// 链接数
+	newfs_stat->st_uid = getuid();// 用户ID
+	newfs_stat->st_gid = getgid();// 组ID
+	newfs_stat->st_atime = attr->atime;// 最后访问时间
+	newfs_stat->st_mtime = attr->mtime;// 最后修改时间
+	newfs_stat->st_ctime = attr->ctime;// 最后状态改变时间
+	newfs_stat->st_blksize = NEWFS_IO_SZ();// 块大小
 
+	// 如果是根目录，更新特殊属性
+    if (dentry == newfs_super.root_dentry)
+    {
+        newfs_stat->st_size = newfs_super.sz_usage;// 根目录大小
+        newfs_stat->st_blocks = NEWFS_DISK_SZ() / NEWFS_IO_SZ();// 文件系统块数
+        newfs_stat->st_nlink = 2; /* !特殊，根目录link数为2 */
+    }
+}
 /**
  * @brief 获取文件或目录的属性，该函数非常重要
  * 
@@ -119,43 +271,61 @@ int newfs_mkdir(const char* path, mode_t mode) {
  */
 int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	/* TODO: 解析路径，获取Inode，填充newfs_stat，可参考/fs/simplefs/sfs.c的sfs_getattr()函数实现 */
+	struct newfs_attr attr;
 	int is_find, is_root;
 
-	 // 通过路径解析，查找目录项（dentry），并判断是否为根目录
-    struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
-    if (is_find == 0)
-    {
-        return -NEWFS_ERROR_NOTFOUND;// 如果未找到目录项，返回未找到错误码
-    }
-
-	// 根据目录项的inode类型填充文件或目录的属性
-    if (NEWFS_IS_DIR(dentry->inode))
+	 // 通过路径解析，查找目录项（dentry），并判断是否为根目录；只要属性，先不读inode
+    struct newfs_dentry *dentry = newfs_lookup_lazy(path, &is_find, &is_root);
+    if (dentry == NULL)
     {
-        newfs_stat->st_mode = __S_IFDIR | NEWFS_DEFAULT_PERM;// 目录类型
-        newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);// 目录大小
+        return -NEWFS_ERROR_IO;
     }
-    else if (NEWFS_IS_REG(dentry->inode))
+    if (is_find == 0)
     {
-        newfs_stat->st_mode = __S_IFREG | NEWFS_DEFAULT_PERM;// 文件类型
-        newfs_stat->st_size = dentry->inode->size;// 文件大小
+        return -NEWFS_ERROR_NOTFOUND;// 如果未找到目录项，返回未找到错误码
     }
 
-    newfs_stat->st_nlink = 1;// 链接数
-    newfs_stat->st_uid = getuid();// 用户ID
-    newfs_stat->st_gid = getgid();// 组ID
-    newfs_stat->st_atime = time(NULL);// 最后访问时间
-    newfs_stat->st_mtime = time(NULL);// 最后修改时间
-    newfs_stat->st_blksize = NEWFS_IO_SZ();// 块大小
-
-	// 如果是根目录，更新特殊属性
-    if (is_root)
+	// readdir刚读出的属性没过期就直接用。inode读入内存后所有修改都发生在inode上，
+	// 而inode不在内存时磁盘上的记录就是最新的，所以缓存的属性不会比磁盘旧
+    // 不拿inode的锁，文件正在写时取到的大小是写之前或之后的
+    if (__atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE) == NULL && dentry->attr_expire <= newfs_now_ms() &&
+        newfs_load_inode(dentry) == NULL)
     {
-        newfs_stat->st_size = newfs_super.sz_usage;// 根目录大小
-        newfs_stat->st_blocks = NEWFS_DISK_SZ() / NEWFS_IO_SZ();// 文件系统块数
-        newfs_stat->st_nlink = 2; /* !特殊，根目录link数为2 */
+        return -NEWFS_ERROR_IO;
     }
+    newfs_dentry_attr(dentry, &attr);
+    newfs_dentry_stat(dentry, &attr, newfs_stat);
     return NEWFS_ERROR_NONE;// 返回成功状态码
 }
+/**
+ * @brief 不加锁地获取属性，读者多时不再争tree_lock
+ * 
+ * @param path 相对于挂载点的路径
+ * @param newfs_stat 返回状态
+ * @return int 0成功；遇到并发修改或需要读盘时返回-NEWFS_ERROR_AGAIN，由调用者加锁重来
+ */
+int newfs_getattr_nolock(const char* path, struct stat * newfs_stat) {
+	struct newfs_dentry *dentry;
+	struct newfs_attr attr;
+	int is_root, ret;
+	// 找到的dentry在退出epoch之前不会被释放
+	int epoch = newfs_epoch_enter();
+
+	ret = newfs_lookup_nolock(path, &dentry, &attr, &is_root);
+	if (ret == NEWFS_ERROR_NONE)
+	{
+		if (dentry == NULL)
+		{
+			ret = -NEWFS_ERROR_NOTFOUND;
+		}
+		else
+		{
+			newfs_dentry_stat(dentry, &attr, newfs_stat);
+		}
+	}
+	newfs_epoch_exit(epoch);
+	return ret;
+}
 
 /**
  * @brief 遍历目录项，填充至buf，并交给FUSE输出
@@ -169,9 +339,9 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
  * buf: name会被复制到buf中
  * name: dentry名字
  * stbuf: 文件状态，可忽略
- * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
+ * off: 下一次offset从哪里开始，这里是刚填入的目录项的cookie
  * 
- * @param offset 第几个目录项？
+ * @param offset 上次最后一个目录项的cookie，0表示从头开始
  * @param fi 可忽略
  * @return int 0成功，否则失败
  */
@@ -179,23 +349,22 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
 			    		 struct fuse_file_info * fi) {
     /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/sfs.c的sfs_readdir()函数实现 */
     int is_find, is_root;
-    int cur_dir = offset;
+    struct newfs_dentry *dentry;
 
+    // opendir时已经找到了inode
+    if (fi != NULL && fi->fh != 0)
+    {
+        return newfs_do_readdir(((struct newfs_fh *)(uintptr_t)fi->fh)->inode, buf, filler, offset);
+    }
     // 通过路径解析，查找目录项（dentry），并判断是否为根目录
-    struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
-    struct newfs_dentry *sub_dentry;
-    struct newfs_inode *inode;
+    dentry = newfs_lookup(path, &is_find, &is_root);
+    if (dentry == NULL)
+    {
+        return -NEWFS_ERROR_IO;
+    }
     if (is_find)
     {
-        // 获取目录的inode和当前目录项
-        inode = dentry->inode;
-        sub_dentry = newfs_get_dentry(inode, cur_dir);
-        if (sub_dentry)
-        {
-            // 利用filler函数将目录项信息填充到输出缓冲区
-            filler(buf, sub_dentry->name, NULL, ++offset);
-        }
-        return NEWFS_ERROR_NONE;
+        return newfs_do_readdir(dentry->inode, buf, filler, offset);
     }
     return -NEWFS_ERROR_NOTFOUND;
 }
@@ -211,47 +380,47 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
 int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	/* TODO: 解析路径，并创建相应的文件 */
 	int is_find, is_root;
+    struct newfs_dentry *last_dentry;
+    int ret;
 
-    struct newfs_dentry *last_dentry = newfs_lookup(path, &is_find, &is_root);
-    struct newfs_dentry *dentry;
-    struct newfs_inode *inode;
-    char *fname;
+    last_dentry = newfs_lookup(path, &is_find, &is_root);
 
-    if (is_find == 1)
+    if (last_dentry == NULL)
     {
-        return -NEWFS_ERROR_EXISTS;
+        return -NEWFS_ERROR_IO;
     }
-
-    fname = newfs_get_fname(path);
-
-    if (S_ISDIR(mode))
+    if (is_find == 1)
     {
-        dentry = new_dentry(fname, NEWFS_DIR);
+        return -NEWFS_ERROR_EXISTS;
     }
-    else
+    ret = newfs_do_create(last_dentry, newfs_get_fname(path), S_ISDIR(mode) ? NEWFS_DIR : NEWFS_REG_FILE, NULL);
+    if (ret == NEWFS_ERROR_NONE)
     {
-        dentry = new_dentry(fname, NEWFS_REG_FILE);
+        newfs_pcache_invalidate(path, 0);
     }
-    // 设置新目录项的父目录
-    dentry->parent = last_dentry;
-    // 分配新的inode并将其关联到目录项上
-    inode = newfs_alloc_inode(dentry);
-    // 在最后一个目录项对应的inode中分配新的目录项
-    newfs_alloc_dentry(last_dentry->inode, dentry);
-
-    return NEWFS_ERROR_NONE;
+    return ret;
 }
 
 /**
- * @brief 修改时间，为了不让touch报错 
+ * @brief 修改访问时间和修改时间
  * 
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv tv[0]为访问时间，tv[1]为修改时间
  * @return int 0成功，否则失败
  */
 int newfs_utimens(const char* path, const struct timespec tv[2]) {
-	(void)path;
-	return 0;
+	int is_find, is_root;
+	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	return newfs_do_utimens(dentry->inode, tv);
 }
 /******************************************************************************
 * SECTION: 选做函数实现
@@ -268,8 +437,25 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
  */
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;
+	int is_find, is_root;
+	struct newfs_dentry *dentry;
+	struct newfs_fh *fh;
+
+	if (fi != NULL && fi->fh != 0)
+	{
+		fh = (struct newfs_fh *)(uintptr_t)fi->fh;
+		return newfs_do_write(fh->inode, fh, buf, size, offset);
+	}
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	return newfs_do_write(dentry->inode, NULL, buf, size, offset);
 }
 
 /**
@@ -284,8 +470,26 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
  */
 int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;			   
+	int is_find, is_root;
+	struct newfs_dentry *dentry;
+	struct newfs_fh *fh;
+
+	// open时已经找到了inode，不用再解析路径
+	if (fi != NULL && fi->fh != 0)
+	{
+		fh = (struct newfs_fh *)(uintptr_t)fi->fh;
+		return newfs_do_read(fh->inode, fh, buf, size, offset);
+	}
+	dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	return newfs_do_read(dentry->inode, NULL, buf, size, offset);
 }
 
 /**
@@ -295,8 +499,25 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
  * @return int 0成功，否则失败
  */
 int newfs_unlink(const char* path) {
-	/* 选做 */
-	return 0;
+	int is_find, is_root;
+	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (is_root)
+	{
+		return -NEWFS_ERROR_INVAL;
+	}
+
+	// 先作废路径缓存，之后dentry就被释放了
+	newfs_pcache_invalidate(path, NEWFS_IS_DIR(dentry->inode));
+	return newfs_do_remove(dentry);
 }
 
 /**
@@ -312,8 +533,26 @@ int newfs_unlink(const char* path) {
  * @return int 0成功，否则失败
  */
 int newfs_rmdir(const char* path) {
-	/* 选做 */
-	return 0;
+	int is_find, is_root;
+	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (!NEWFS_IS_DIR(dentry->inode))
+	{
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	if (dentry->inode->dir_cnt > 0)
+	{
+		return -NEWFS_ERROR_NOTEMPTY;
+	}
+	return newfs_unlink(path);
 }
 
 /**
@@ -324,33 +563,95 @@ int newfs_rmdir(const char* path) {
  * @return int 0成功，否则失败
  */
 int newfs_rename(const char* from, const char* to) {
-	/* 选做 */
-	return 0;
+	int is_find, is_root;
+	struct newfs_dentry *from_dentry = newfs_lookup(from, &is_find, &is_root);
+	struct newfs_dentry *to_dentry;
+
+	if (from_dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (strcmp(from, to) == 0)
+	{
+		return NEWFS_ERROR_NONE;
+	}
+
+	// 目标不存在时找到的是它所在的目录
+	to_dentry = newfs_lookup(to, &is_find, &is_root);
+	if (to_dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find && is_root)
+	{
+		return -NEWFS_ERROR_INVAL;
+	}
+	newfs_pcache_invalidate(from, NEWFS_IS_DIR(from_dentry->inode));
+	newfs_pcache_invalidate(to, 1);
+	return newfs_do_rename(from_dentry, is_find ? to_dentry->parent : to_dentry, newfs_get_fname(to));
 }
 
 /**
- * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
- * 保存在fh中
+ * @brief 打开文件，找到inode后新建句柄保存在fi->fh中，之后的读写直接用它
  * 
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则失败
  */
 int newfs_open(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	int is_find, is_root;
+	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_fh *fh;
+
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	fh = newfs_fh_open(dentry->inode);
+	if (fh == NULL)
+	{
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	fi->fh = (uint64_t)(uintptr_t)fh;
+	// 所有修改都经过这里，内核页缓存中的数据不会过期，再次打开时不必丢掉
+	fi->keep_cache = options.kernel_cache;
+	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 打开目录文件
+ * @brief 打开目录文件，同newfs_open
  * 
  * @param path 相对于挂载点的路径
  * @param fi 文件信息
  * @return int 0成功，否则失败
  */
 int newfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	return newfs_open(path, fi);
+}
+
+/**
+ * @brief 关闭文件或目录，释放句柄。自己加锁，不经过NEWFS_LOCKED_OP
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	(void)path;
+	if (fi->fh != 0)
+	{
+		newfs_fh_release((struct newfs_fh *)(uintptr_t)fi->fh);
+		fi->fh = 0;
+	}
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -361,8 +662,18 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则失败
  */
 int newfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+	int is_find, is_root;
+	struct newfs_dentry *dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == 0)
+	{
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	return newfs_do_truncate(dentry->inode, offset);
 }
 
 
@@ -383,19 +694,492 @@ int newfs_access(const char* path, int type) {
 	return 0;
 }	
 /******************************************************************************
+* SECTION: 按dentry和inode的操作，路径接口和低层接口共用
+*******************************************************************************/
+/**
+ * @brief 在目录下新建文件或目录
+ * 
+ * @param parent 所在目录的dentry，inode已读入
+ * @param fname 新文件名
+ * @param ftype 
+ * @param out 不为NULL时输出新建的dentry
+ * @return int 0成功，否则失败
+ */
+int newfs_do_create(struct newfs_dentry *parent, const char *fname, NEW_FILE_TYPE ftype,
+					struct newfs_dentry **out) {
+	struct newfs_inode *dir = parent->inode;
+	struct newfs_dentry *dentry;
+	struct newfs_inode *inode;
+	int len = strlen(fname);
+
+	// 如果最后一个目录项对应的Inode是文件而不是目录，则返回错误
+	if (!NEWFS_IS_DIR(dir))
+	{
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	if (len > MAX_NAME_LEN)
+	{
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
+	if (newfs_dir_index_find(dir, fname, len) != NULL)
+	{
+		return -NEWFS_ERROR_EXISTS;
+	}
+
+	dentry = new_dentry((char *)fname, ftype);
+	if (dentry == NULL)
+	{
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	// 设置新目录项的父目录，分配新的inode并将其关联到目录项上
+	dentry->parent = parent;
+	inode = newfs_alloc_inode(dentry);
+	if (inode == NULL)
+	{
+		newfs_dentry_free(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	// 在父目录的inode中分配新的目录项
+	if (newfs_alloc_dentry(dir, dentry) < 0)
+	{
+		newfs_free_inode(inode->ino);
+		newfs_icache_remove(inode);
+		newfs_inode_free(inode);
+		newfs_dentry_free(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	if (out != NULL)
+	{
+		*out = dentry;
+	}
+	return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 删除dentry及其inode，目录则连同下面的文件一起删除。inode还有打开
+ * 的句柄或内核的引用时推迟到newfs_fh_release或forget释放
+ * 
+ * @param dentry inode已读入
+ * @return int 0成功，否则失败
+ */
+int newfs_do_remove(struct newfs_dentry *dentry) {
+	struct newfs_inode *inode = dentry->inode;
+
+	if (dentry == newfs_super.root_dentry)
+	{
+		return -NEWFS_ERROR_INVAL;
+	}
+	newfs_drop_dentry(dentry->parent->inode, dentry);
+	// 还有打开的句柄或内核的引用时只从目录中摘下，inode、ino和数据块留到两者
+	// 都归0时释放，ino不会在内核忘掉旧节点号之前分给新文件
+	if (__atomic_load_n(&inode->nopen, __ATOMIC_RELAXED) > 0 ||
+	    __atomic_load_n(&inode->nlookup, __ATOMIC_RELAXED) > 0)
+	{
+		dentry->parent = NULL;
+		inode->orphan = 1;
+		return NEWFS_ERROR_NONE;
+	}
+	newfs_drop_inode(inode);
+	newfs_dentry_free(dentry);
+	return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 目录改名开始时rename_seq变为奇数，结束时回到偶数
+ */
+static void newfs_rename_seq_bump()
+{
+	__atomic_add_fetch(&newfs_super.rename_seq, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+/**
+ * @brief 把from_dentry移到to_parent下，改名为fname。目标已存在时先删除，
+ * 与rename(2)的覆盖语义一致
+ * 
+ * @param from_dentry inode已读入
+ * @param to_parent 目标所在目录的dentry，inode已读入
+ * @param fname 
+ * @return int 0成功，否则失败。目录覆盖文件返回-ENOTDIR，文件覆盖目录返回-EISDIR
+ */
+int newfs_do_rename(struct newfs_dentry *from_dentry, struct newfs_dentry *to_parent, const char *fname) {
+	struct newfs_inode *from_inode = from_dentry->inode;
+	struct newfs_dentry *to_dentry;
+	struct newfs_dentry *dentry_cursor;
+	int len = strlen(fname);
+	int ret;
+
+	if (from_dentry == newfs_super.root_dentry)
+	{
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (!NEWFS_IS_DIR(to_parent->inode))
+	{
+		return -NEWFS_ERROR_NOTDIR;
+	}
+	if (len > MAX_NAME_LEN)
+	{
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
+	// 目录不能移到自己下面
+	for (dentry_cursor = to_parent; dentry_cursor != NULL; dentry_cursor = dentry_cursor->parent)
+	{
+		if (dentry_cursor == from_dentry)
+		{
+			return -NEWFS_ERROR_INVAL;
+		}
+	}
+
+	to_dentry = newfs_dir_index_find(to_parent->inode, fname, len);
+	if (to_dentry == from_dentry)
+	{
+		return NEWFS_ERROR_NONE;
+	}
+	if (to_dentry != NULL)
+	{
+		if (newfs_load_inode(to_dentry) == NULL)
+		{
+			return -NEWFS_ERROR_IO;
+		}
+		// 目录只能覆盖目录，文件只能覆盖文件
+		if (NEWFS_IS_DIR(from_inode) && !NEWFS_IS_DIR(to_dentry->inode))
+		{
+			return -NEWFS_ERROR_NOTDIR;
+		}
+		if (!NEWFS_IS_DIR(from_inode) && NEWFS_IS_DIR(to_dentry->inode))
+		{
+			return -NEWFS_ERROR_ISDIR;
+		}
+		if (NEWFS_IS_DIR(to_dentry->inode) && to_dentry->inode->dir_cnt > 0)
+		{
+			return -NEWFS_ERROR_NOTEMPTY;
+		}
+		ret = newfs_do_remove(to_dentry);
+		if (ret != NEWFS_ERROR_NONE)
+		{
+			return ret;
+		}
+	}
+
+	// 目录改名时整棵子树换了路径，不加锁的查找可能已经走进了子树，据此重试
+	if (NEWFS_IS_DIR(from_inode))
+	{
+		newfs_rename_seq_bump();
+	}
+	// 新建一个dentry指向原inode，挂到目标目录下
+	to_dentry = new_dentry((char *)fname, from_inode->ftype);
+	if (to_dentry == NULL)
+	{
+		if (NEWFS_IS_DIR(from_inode))
+		{
+			newfs_rename_seq_bump();
+		}
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	to_dentry->parent = to_parent;
+	to_dentry->ino = from_inode->ino;
+	to_dentry->inode = from_inode;
+	if (newfs_alloc_dentry(to_parent->inode, to_dentry) < 0)
+	{
+		newfs_dentry_free(to_dentry);
+		if (NEWFS_IS_DIR(from_inode))
+		{
+			newfs_rename_seq_bump();
+		}
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	from_inode->dentry = to_dentry;
+	for (dentry_cursor = from_inode->dentrys; dentry_cursor != NULL; dentry_cursor = dentry_cursor->brother)
+	{
+		dentry_cursor->parent = to_dentry;
+	}
+
+	newfs_drop_dentry(from_dentry->parent->inode, from_dentry);
+	newfs_dentry_free(from_dentry);
+	if (NEWFS_IS_DIR(from_inode))
+	{
+		newfs_rename_seq_bump();
+	}
+	return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 遍历目录项，填充至buf
+ * 
+ * @param inode 目录inode
+ * @param buf 交给filler
+ * @param filler 返回非0表示buf已满
+ * @param offset 上次最后一个目录项的cookie，0表示从头开始
+ * @return int 0成功，否则失败
+ */
+int newfs_do_readdir(struct newfs_inode *inode, void *buf, fuse_fill_dir_t filler, off_t offset) {
+    struct newfs_dentry *sub_dentry;
+    struct newfs_dentry *batch[NEWFS_RDPLUS_BATCH];
+    struct newfs_dentry *load[NEWFS_RDPLUS_BATCH];
+    struct stat sub_stat;
+    struct newfs_attr sub_attr;
+    long now = newfs_now_ms();
+    int cnt, nload, i;
+
+    if (!NEWFS_IS_DIR(inode))
+    {
+        return -NEWFS_ERROR_NOTDIR;
+    }
+    // 停下的位置和目录项上的属性都会被修改，同一目录的readdir排队进行
+    pthread_rwlock_wrlock(&inode->lock);
+    // 一次调用填入剩下的所有目录项，filler返回非0表示buf已满，记下停下的位置
+    sub_dentry = newfs_dir_seek(inode, offset);
+    while (sub_dentry != NULL)
+    {
+        // 一批目录项中还没读入内存的，inode记录按块一起读出属性，随后的getattr直接用
+        for (cnt = 0, nload = 0; sub_dentry != NULL && cnt < NEWFS_RDPLUS_BATCH; sub_dentry = sub_dentry->brother)
+        {
+            batch[cnt++] = sub_dentry;
+            if (sub_dentry->inode == NULL && sub_dentry->attr_expire <= now)
+            {
+                load[nload++] = sub_dentry;
+            }
+        }
+        if (nload > 0 && newfs_read_attrs(load, nload) != NEWFS_ERROR_NONE)
+        {
+            pthread_rwlock_unlock(&inode->lock);
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; i < cnt; i++)
+        {
+            newfs_dentry_attr(batch[i], &sub_attr);
+            newfs_dentry_stat(batch[i], &sub_attr, &sub_stat);
+            if (filler(buf, batch[i]->name, &sub_stat, batch[i]->cookie) != 0)
+            {
+                newfs_dir_tell(inode, batch[i], offset);
+                pthread_rwlock_unlock(&inode->lock);
+                return NEWFS_ERROR_NONE;
+            }
+            offset = batch[i]->cookie;
+        }
+    }
+    // 读到末尾，清掉停下的位置，目录可以被换出
+    newfs_dir_tell(inode, NULL, 0);
+    pthread_rwlock_unlock(&inode->lock);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 写入文件
+ * 
+ * @param inode 
+ * @param fh 打开的句柄，可以为NULL
+ * @param buf 写入的内容
+ * @param size 写入的字节数
+ * @param offset 相对文件的偏移
+ * @return int 写入大小，写完超过文件大小上限时返回-EFBIG
+ */
+int newfs_do_write(struct newfs_inode *inode, struct newfs_fh *fh, const char *buf, size_t size, off_t offset) {
+	struct newfs_extent_cursor cursor = {0};
+	int ret = size;
+
+	if (NEWFS_IS_DIR(inode))
+	{
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (offset < 0)
+	{
+		return -NEWFS_ERROR_INVAL;
+	}
+	// 之后的偏移和大小按int传下去，超出上限的在这里拒绝，不能截断成错误的位置
+	if ((off_t)size > NEWFS_MAX_FILE_SZ() || offset > NEWFS_MAX_FILE_SZ() - (off_t)size)
+	{
+		return -NEWFS_ERROR_FBIG;
+	}
+
+	if (fh != NULL)
+	{
+		newfs_fh_cursor_get(fh, &cursor);
+	}
+	pthread_rwlock_wrlock(&inode->lock);
+	// 超出当前大小时先按extent追加数据块，跳过的部分由newfs_resize_file补零
+	if (offset + size > inode->size &&
+		newfs_resize_file(inode, offset + size) != NEWFS_ERROR_NONE)
+	{
+		ret = -NEWFS_ERROR_NOSPACE;
+	}
+	else if (newfs_file_write(inode, buf, size, offset, &cursor) != NEWFS_ERROR_NONE)
+	{
+		ret = -NEWFS_ERROR_IO;
+	}
+	// 时间戳以秒计，同一秒内的写只在第一次弄脏inode
+	else if (inode->mtime != (uint32_t)time(NULL) || inode->ctime != inode->mtime)
+	{
+		newfs_update_time(inode, NEWFS_TIME_MTIME | NEWFS_TIME_CTIME);
+	}
+	pthread_rwlock_unlock(&inode->lock);
+	if (fh != NULL)
+	{
+		newfs_fh_cursor_put(fh, &cursor);
+	}
+
+	return ret;
+}
+/**
+ * @brief 读取文件
+ * 
+ * @param inode 
+ * @param fh 打开的句柄，可以为NULL。顺序读时缺块会顺带预读后面的块
+ * @param buf 读取的内容
+ * @param size 读取的字节数
+ * @param offset 相对文件的偏移
+ * @return int 读取大小
+ */
+int newfs_do_read(struct newfs_inode *inode, struct newfs_fh *fh, char *buf, size_t size, off_t offset) {
+	struct newfs_extent_cursor cursor = {0};
+	int ra = 0, hi, ra_hi;
+	int ret;
+
+	if (NEWFS_IS_DIR(inode))
+	{
+		return -NEWFS_ERROR_ISDIR;
+	}
+
+	if (fh != NULL)
+	{
+		ra = newfs_fh_readahead(fh, offset, size);
+		newfs_fh_cursor_get(fh, &cursor);
+	}
+	// 要读的块都在内存中时共享持有inode的锁，同一文件的读可以同时进行；
+	// 否则要读盘填块缓冲，换成独占
+	pthread_rwlock_rdlock(&inode->lock);
+	if (inode->size >= offset &&
+		!newfs_file_resident(inode, offset / NEWFS_BLKS_SZ(1),
+							 NEWFS_ROUND_UP(offset + size < inode->size ? offset + size : inode->size,
+											NEWFS_BLKS_SZ(1)) / NEWFS_BLKS_SZ(1)))
+	{
+		pthread_rwlock_unlock(&inode->lock);
+		pthread_rwlock_wrlock(&inode->lock);
+		// 顺序读缺块时把后面ra块一起读入，整段一次请求，之后的读直接命中
+		hi = NEWFS_ROUND_UP(offset + size < inode->size ? offset + size : inode->size,
+							NEWFS_BLKS_SZ(1)) / NEWFS_BLKS_SZ(1);
+		ra_hi = NEWFS_ROUND_UP(inode->size, NEWFS_BLKS_SZ(1)) / NEWFS_BLKS_SZ(1);
+		ra_hi = hi + ra < ra_hi ? hi + ra : ra_hi;
+		if (inode->size >= offset && ra_hi > hi)
+		{
+			newfs_file_load(inode, offset / NEWFS_BLKS_SZ(1), ra_hi, 1, &cursor);
+		}
+	}
+	if (inode->size <= offset) // 读到文件末尾之后
+	{
+		ret = 0;
+	}
+	else
+	{
+		if (offset + size > inode->size)
+		{
+			size = inode->size - offset;
+		}
+		ret = newfs_file_read(inode, buf, size, offset, &cursor) != NEWFS_ERROR_NONE ? -NEWFS_ERROR_IO : (int)size;
+	}
+	pthread_rwlock_unlock(&inode->lock);
+	// 访问时间很少需要更新，需要时再独占inode的锁
+	if (ret >= 0 && newfs_atime_stale(inode))
+	{
+		pthread_rwlock_wrlock(&inode->lock);
+		if (newfs_atime_stale(inode))
+		{
+			newfs_update_time(inode, NEWFS_TIME_ATIME);
+		}
+		pthread_rwlock_unlock(&inode->lock);
+	}
+	if (fh != NULL)
+	{
+		newfs_fh_cursor_put(fh, &cursor);
+	}
+
+	return ret;
+}
+/**
+ * @brief 改变文件大小
+ * 
+ * @param inode 
+ * @param offset 改变后文件大小
+ * @return int 0成功，否则失败
+ */
+int newfs_do_truncate(struct newfs_inode *inode, off_t offset) {
+	int ret;
+
+	if (NEWFS_IS_DIR(inode))
+	{
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (offset < 0)
+	{
+		return -NEWFS_ERROR_INVAL;
+	}
+	if (offset > NEWFS_MAX_FILE_SZ())
+	{
+		return -NEWFS_ERROR_FBIG;
+	}
+
+	pthread_rwlock_wrlock(&inode->lock);
+	ret = newfs_resize_file(inode, offset);
+	if (ret == NEWFS_ERROR_NONE)
+	{
+		newfs_update_time(inode, NEWFS_TIME_MTIME | NEWFS_TIME_CTIME);
+	}
+	pthread_rwlock_unlock(&inode->lock);
+	return ret;
+}
+/**
+ * @brief 修改访问时间和修改时间，UTIME_NOW取当前时间，UTIME_OMIT不修改
+ * 
+ * @param inode 
+ * @param tv tv[0]为访问时间，tv[1]为修改时间
+ * @return int 0成功，否则失败
+ */
+int newfs_do_utimens(struct newfs_inode *inode, const struct timespec tv[2]) {
+	uint32_t now = (uint32_t)time(NULL);
+
+	pthread_rwlock_wrlock(&inode->lock);
+	if (tv[0].tv_nsec != UTIME_OMIT)
+	{
+		inode->atime = tv[0].tv_nsec == UTIME_NOW ? now : (uint32_t)tv[0].tv_sec;
+	}
+	if (tv[1].tv_nsec != UTIME_OMIT)
+	{
+		inode->mtime = tv[1].tv_nsec == UTIME_NOW ? now : (uint32_t)tv[1].tv_sec;
+	}
+	newfs_update_time(inode, NEWFS_TIME_CTIME);
+	pthread_rwlock_unlock(&inode->lock);
+	return NEWFS_ERROR_NONE;
+}
+/******************************************************************************
 * SECTION: FUSE入口
 *******************************************************************************/
 int main(int argc, char **argv)
 {
     int ret;
+	char timeout_opt[64];
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
 
 	options.device = strdup("~/ddriver");
+	options.cache_blks = NEWFS_CACHE_BLKS_DEFAULT;
+	options.flush_interval = NEWFS_FLUSH_INTERVAL_DEFAULT;
+	options.dirty_expire = NEWFS_DIRTY_EXPIRE_DEFAULT;
+	options.dirty_bg_kb = NEWFS_DIRTY_BG_KB_DEFAULT;
+	options.dirty_limit_kb = NEWFS_DIRTY_LIMIT_KB_DEFAULT;
+	options.file_cache_blks = NEWFS_FILE_BLKS_DEFAULT;
+	options.inode_cache = NEWFS_ICACHE_OBJS_DEFAULT;
+	options.entry_timeout = NEWFS_ENTRY_TIMEOUT_DEFAULT;
+	options.attr_timeout = NEWFS_ATTR_TIMEOUT_DEFAULT;
 
 	if (fuse_opt_parse(&args, &options, option_spec, NULL) == -1)
 		return -1;
 	
-	ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	// --lowlevel时按节点号访问，否则按路径访问
+	if (options.lowlevel)
+		ret = newfs_ll_main(&args);
+	else
+	{
+		// 路径接口下内核缓存属性和目录项的时间由FUSE库的挂载选项决定
+		snprintf(timeout_opt, sizeof(timeout_opt), "-oattr_timeout=%g,entry_timeout=%g",
+				 options.attr_timeout, options.entry_timeout);
+		if (fuse_opt_add_arg(&args, timeout_opt) == -1)
+			return -1;
+		ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	}
 	fuse_opt_free_args(&args);
 	return ret;
 }
@@ -0,0 +1,302 @@
+#include "newfs.h"
+
+/*
+ * 两级位图：第一层就是磁盘上的ino_map/data_map，按64位字访问（x86小端下，
+ * 第i位仍然落在第i/8字节的第i%8位，与逐字节访问的布局一致）；第二层summary
+ * 的第w位表示第w个字已满。分配时先在summary里找未满的字，再在字内找空闲位，
+ * 都是一次ctz，整个位图最多扫描 nbits / 4096 个summary字。
+ *
+ * 不同文件的写可以同时分配块，分配、释放和写回在bm->lock下进行；查询只读
+ * 一个字，不加锁。
+ */
+#define NEWFS_WORD_BITS 64
+#define NEWFS_WORD_FULL (~(uint64_t)0)
+
+/**
+ * @brief 第w个字中真正属于位图的位（最后一个字可能只用了一部分）
+ *
+ * @param bm
+ * @param w
+ * @return uint64_t
+ */
+static inline uint64_t newfs_bitmap_valid(struct newfs_bitmap *bm, int w)
+{
+    int rest = bm->nbits - w * NEWFS_WORD_BITS;
+    if (rest >= NEWFS_WORD_BITS)
+    {
+        return NEWFS_WORD_FULL;
+    }
+    return ((uint64_t)1 << rest) - 1;
+}
+
+static inline int newfs_bitmap_word_full(struct newfs_bitmap *bm, int w)
+{
+    return (bm->words[w] | ~newfs_bitmap_valid(bm, w)) == NEWFS_WORD_FULL;
+}
+
+static inline void newfs_bitmap_update_summary(struct newfs_bitmap *bm, int w)
+{
+    if (newfs_bitmap_word_full(bm, w))
+    {
+        bm->summary[w / NEWFS_WORD_BITS] |= (uint64_t)1 << (w % NEWFS_WORD_BITS);
+    }
+    else
+    {
+        bm->summary[w / NEWFS_WORD_BITS] &= ~((uint64_t)1 << (w % NEWFS_WORD_BITS));
+    }
+}
+/**
+ * @brief 记录第w个字被修改，写回时只写被修改过的范围
+ */
+static inline void newfs_bitmap_touch(struct newfs_bitmap *bm, int w)
+{
+    if (bm->dirty_lo >= bm->dirty_hi)
+    {
+        bm->dirty_lo = w;
+        bm->dirty_hi = w + 1;
+        return;
+    }
+    if (w < bm->dirty_lo)
+    {
+        bm->dirty_lo = w;
+    }
+    if (w + 1 > bm->dirty_hi)
+    {
+        bm->dirty_hi = w + 1;
+    }
+}
+/**
+ * @brief 在位图上建立summary层
+ *
+ * @param bm
+ * @param map 位图内存，长度需是8字节的整数倍且不小于nbits位
+ * @param nbits 可分配的位数
+ * @return int
+ */
+int newfs_bitmap_init(struct newfs_bitmap *bm, uint8_t *map, int nbits)
+{
+    int w;
+
+    bm->words = (uint64_t *)map;
+    bm->nbits = nbits;
+    bm->nwords = (nbits + NEWFS_WORD_BITS - 1) / NEWFS_WORD_BITS;
+    bm->nsummary = (bm->nwords + NEWFS_WORD_BITS - 1) / NEWFS_WORD_BITS;
+    bm->summary = (uint64_t *)calloc(bm->nsummary > 0 ? bm->nsummary : 1, sizeof(uint64_t));
+    bm->hint = 0;
+    bm->used = 0;
+    bm->dirty_lo = 0;
+    bm->dirty_hi = 0;
+    if (bm->summary == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    pthread_mutex_init(&bm->lock, NULL);
+    for (w = 0; w < bm->nwords; w++)
+    {
+        bm->used += __builtin_popcountll(bm->words[w] & newfs_bitmap_valid(bm, w));
+        newfs_bitmap_update_summary(bm, w);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 释放summary层，位图本体由调用者管理
+ *
+ * @param bm
+ */
+void newfs_bitmap_destroy(struct newfs_bitmap *bm)
+{
+    if (bm->summary != NULL)
+    {
+        pthread_mutex_destroy(&bm->lock);
+    }
+    free(bm->summary);
+    bm->summary = NULL;
+}
+/**
+ * @brief 在summary的第s个字里，从第from个字开始找一个未满的字
+ *
+ * @return int 字下标，没有返回-1
+ */
+static inline int newfs_bitmap_scan_summary(struct newfs_bitmap *bm, int s, int from)
+{
+    uint64_t free_words = ~bm->summary[s];
+    int base = s * NEWFS_WORD_BITS;
+
+    if (from > base)
+    {
+        free_words &= NEWFS_WORD_FULL << (from - base);
+    }
+    if (bm->nwords - base < NEWFS_WORD_BITS)
+    {
+        free_words &= ((uint64_t)1 << (bm->nwords - base)) - 1;
+    }
+    if (free_words == 0)
+    {
+        return -1;
+    }
+    return base + __builtin_ctzll(free_words);
+}
+/**
+ * @brief 占用第w个字里最低的空闲位
+ *
+ * @return int 位下标
+ */
+static inline int newfs_bitmap_take(struct newfs_bitmap *bm, int w)
+{
+    uint64_t free_bits = ~bm->words[w] & newfs_bitmap_valid(bm, w);
+    int bit = __builtin_ctzll(free_bits);
+
+    bm->words[w] |= (uint64_t)1 << bit;
+    bm->used++;
+    newfs_bitmap_update_summary(bm, w);
+    newfs_bitmap_touch(bm, w);
+    bm->hint = w; // next-fit：下次从这里继续找
+    return w * NEWFS_WORD_BITS + bit;
+}
+/**
+ * @brief 从第start个字开始找空闲位，到末尾后回绕
+ *
+ * @param bm
+ * @param start
+ * @return int 位下标，满了返回-1
+ */
+static int newfs_bitmap_alloc_from(struct newfs_bitmap *bm, int start)
+{
+    int s, w;
+
+    if (bm->used >= bm->nbits)
+    {
+        return -1;
+    }
+    for (s = start / NEWFS_WORD_BITS; s < bm->nsummary; s++)
+    {
+        w = newfs_bitmap_scan_summary(bm, s, start);
+        if (w >= 0)
+        {
+            return newfs_bitmap_take(bm, w);
+        }
+    }
+    for (s = 0; s <= start / NEWFS_WORD_BITS && s < bm->nsummary; s++)
+    {
+        w = newfs_bitmap_scan_summary(bm, s, 0);
+        if (w >= 0)
+        {
+            return newfs_bitmap_take(bm, w);
+        }
+    }
+    return -1;
+}
+/**
+ * @brief 分配一位，从上次分配的位置开始next-fit，到末尾后回绕
+ *
+ * @param bm
+ * @return int 位下标，满了返回-1
+ */
+int newfs_bitmap_alloc(struct newfs_bitmap *bm)
+{
+    int bit;
+
+    pthread_mutex_lock(&bm->lock);
+    bit = newfs_bitmap_alloc_from(bm, bm->hint < bm->nwords ? bm->hint : 0);
+    pthread_mutex_unlock(&bm->lock);
+    return bit;
+}
+/**
+ * @brief 优先分配goal这一位，被占用时从goal所在的字开始找，让文件的块尽量连续
+ *
+ * @param bm
+ * @param goal
+ * @return int 位下标，满了返回-1
+ */
+int newfs_bitmap_alloc_near(struct newfs_bitmap *bm, int goal)
+{
+    int w = goal / NEWFS_WORD_BITS;
+    int bit;
+
+    if (goal < 0 || goal >= bm->nbits)
+    {
+        return newfs_bitmap_alloc(bm);
+    }
+    pthread_mutex_lock(&bm->lock);
+    if (!newfs_bitmap_test(bm, goal))
+    {
+        bm->words[w] |= (uint64_t)1 << (goal % NEWFS_WORD_BITS);
+        bm->used++;
+        newfs_bitmap_update_summary(bm, w);
+        newfs_bitmap_touch(bm, w);
+        bm->hint = w;
+        bit = goal;
+    }
+    else
+    {
+        bit = newfs_bitmap_alloc_from(bm, w);
+    }
+    pthread_mutex_unlock(&bm->lock);
+    return bit;
+}
+/**
+ * @brief 释放一位，O(1)
+ *
+ * @param bm
+ * @param bit
+ */
+void newfs_bitmap_free(struct newfs_bitmap *bm, int bit)
+{
+    int w = bit / NEWFS_WORD_BITS;
+    uint64_t mask = (uint64_t)1 << (bit % NEWFS_WORD_BITS);
+
+    if (bit < 0 || bit >= bm->nbits)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bm->lock);
+    if (bm->words[w] & mask)
+    {
+        bm->words[w] &= ~mask;
+        bm->used--;
+        newfs_bitmap_touch(bm, w);
+        bm->summary[w / NEWFS_WORD_BITS] &= ~((uint64_t)1 << (w % NEWFS_WORD_BITS));
+    }
+    pthread_mutex_unlock(&bm->lock);
+}
+/**
+ * @brief 查询一位是否被占用
+ *
+ * @param bm
+ * @param bit
+ * @return int
+ */
+int newfs_bitmap_test(struct newfs_bitmap *bm, int bit)
+{
+    return (bm->words[bit / NEWFS_WORD_BITS] >> (bit % NEWFS_WORD_BITS)) & 1;
+}
+/**
+ * @brief 只把被修改过的字写回磁盘
+ *
+ * @param bm
+ * @param offset 位图在磁盘上的偏移
+ * @return int
+ */
+int newfs_bitmap_sync(struct newfs_bitmap *bm, int offset)
+{
+    int lo, hi, ret = NEWFS_ERROR_NONE;
+
+    pthread_mutex_lock(&bm->lock);
+    lo = bm->dirty_lo;
+    hi = bm->dirty_hi;
+    if (lo < hi)
+    {
+        if (newfs_driver_write(offset + lo * sizeof(uint64_t), (uint8_t *)(bm->words + lo),
+                               (hi - lo) * sizeof(uint64_t)) != NEWFS_ERROR_NONE)
+        {
+            ret = -NEWFS_ERROR_IO;
+        }
+        else
+        {
+            bm->dirty_lo = 0;
+            bm->dirty_hi = 0;
+        }
+    }
+    pthread_mutex_unlock(&bm->lock);
+    return ret;
+}
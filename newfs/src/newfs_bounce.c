@@ -0,0 +1,94 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * 驱动读写的中转缓冲区。偏移和长度都按IO单元对齐的请求直接读写调用者的
+ * 缓冲区，不经过这里；不对齐的请求才需要把首尾补齐到IO单元，借用本线程的
+ * 中转缓冲区。每个线程一块，按IO单元对齐，只在不够大时扩大，线程退出时
+ * 释放，热路径上不再malloc。多个线程会同时读写，统计用原子加。
+ */
+static pthread_key_t newfs_bounce_key;
+static pthread_once_t newfs_bounce_once = PTHREAD_ONCE_INIT;
+static struct newfs_bounce_stats newfs_bounce_stats;
+
+#define NEWFS_BOUNCE_INC(field) __atomic_fetch_add(&newfs_bounce_stats.field, 1, __ATOMIC_RELAXED)
+
+/**
+ * @brief 线程退出时释放它的中转缓冲区
+ *
+ * @param arg
+ */
+static void newfs_bounce_release(void *arg)
+{
+    struct newfs_bounce *bounce = (struct newfs_bounce *)arg;
+
+    free(bounce->buf);
+    free(bounce);
+    NEWFS_BOUNCE_INC(releases);
+}
+static void newfs_bounce_key_init()
+{
+    pthread_key_create(&newfs_bounce_key, newfs_bounce_release);
+}
+/**
+ * @brief 记一次对齐请求，直接读写调用者的缓冲区
+ */
+void newfs_bounce_direct()
+{
+    NEWFS_BOUNCE_INC(direct);
+}
+/**
+ * @brief 取本线程至少size字节、按IO单元对齐的中转缓冲区，内容不保留。
+ * 同一线程在下一次调用前一直可用
+ *
+ * @param size
+ * @return uint8_t* 内存不足返回NULL
+ */
+uint8_t *newfs_bounce_get(int size)
+{
+    struct newfs_bounce *bounce;
+    void *buf;
+    int cap;
+
+    pthread_once(&newfs_bounce_once, newfs_bounce_key_init);
+    bounce = (struct newfs_bounce *)pthread_getspecific(newfs_bounce_key);
+    if (bounce == NULL)
+    {
+        bounce = (struct newfs_bounce *)calloc(1, sizeof(struct newfs_bounce));
+        if (bounce == NULL || pthread_setspecific(newfs_bounce_key, bounce) != 0)
+        {
+            free(bounce);
+            return NULL;
+        }
+    }
+    NEWFS_BOUNCE_INC(bounced);
+    if (bounce->size >= size)
+    {
+        return bounce->buf;
+    }
+    // 成倍扩大，偶尔一次大请求之后不再反复分配
+    for (cap = bounce->size > 0 ? bounce->size : NEWFS_BLKS_SZ(1); cap < size; cap *= 2)
+        ;
+    if (posix_memalign(&buf, NEWFS_IO_SZ(), cap) != 0)
+    {
+        return NULL;
+    }
+    free(bounce->buf);
+    bounce->buf = (uint8_t *)buf;
+    bounce->size = cap;
+    NEWFS_BOUNCE_INC(allocs);
+    return bounce->buf;
+}
+/**
+ * @brief 打印中转缓冲区的统计
+ */
+void newfs_bounce_dump_stats()
+{
+    long total = newfs_bounce_stats.direct + newfs_bounce_stats.bounced;
+
+    NEWFS_DBG("[bounce] direct %ld, bounced %ld, direct rate %.2f%%, buffer allocs %ld, releases %ld\n",
+              newfs_bounce_stats.direct, newfs_bounce_stats.bounced,
+              total == 0 ? 0.0 : 100.0 * newfs_bounce_stats.direct / total,
+              newfs_bounce_stats.allocs, newfs_bounce_stats.releases);
+}
@@ -0,0 +1,475 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+static struct newfs_cache newfs_cache; // 块缓存，位于newfs_utils与ddriver之间
+// 保护缓存块、哈希表和LRU链，未命中时持有它等设备请求完成
+static pthread_mutex_t newfs_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define NEWFS_BUF_HASH(blkno) ((uint32_t)(blkno) & (newfs_cache.hsize - 1))
+#define NEWFS_BUF_OFS(blkno) (NEWFS_BLKS_SZ(blkno))
+
+/**
+ * @brief 从LRU链上摘下缓存块
+ *
+ * @param buf
+ */
+static void newfs_lru_remove(struct newfs_buf *buf)
+{
+    buf->lru_prev->lru_next = buf->lru_next;
+    buf->lru_next->lru_prev = buf->lru_prev;
+}
+/**
+ * @brief 缓存块放到LRU链头（最近使用）
+ *
+ * @param buf
+ */
+static void newfs_lru_push(struct newfs_buf *buf)
+{
+    buf->lru_next = newfs_cache.lru.lru_next;
+    buf->lru_prev = &newfs_cache.lru;
+    newfs_cache.lru.lru_next->lru_prev = buf;
+    newfs_cache.lru.lru_next = buf;
+}
+/**
+ * @brief 缓存块放到LRU链尾，最先被换出
+ *
+ * @param buf
+ */
+static void newfs_lru_push_tail(struct newfs_buf *buf)
+{
+    buf->lru_prev = newfs_cache.lru.lru_prev;
+    buf->lru_next = &newfs_cache.lru;
+    newfs_cache.lru.lru_prev->lru_next = buf;
+    newfs_cache.lru.lru_prev = buf;
+}
+
+static void newfs_hash_remove(struct newfs_buf *buf)
+{
+    struct newfs_buf **pp = &newfs_cache.htable[NEWFS_BUF_HASH(buf->blkno)];
+    while (*pp != NULL && *pp != buf)
+    {
+        pp = &(*pp)->hnext;
+    }
+    if (*pp == buf)
+    {
+        *pp = buf->hnext;
+    }
+    buf->hnext = NULL;
+}
+
+static void newfs_hash_insert(struct newfs_buf *buf)
+{
+    int bucket = NEWFS_BUF_HASH(buf->blkno);
+    buf->hnext = newfs_cache.htable[bucket];
+    newfs_cache.htable[bucket] = buf;
+}
+
+static struct newfs_buf *newfs_cache_find(int blkno)
+{
+    struct newfs_buf *buf = newfs_cache.htable[NEWFS_BUF_HASH(blkno)];
+    while (buf != NULL && buf->blkno != blkno)
+    {
+        buf = buf->hnext;
+    }
+    return buf;
+}
+/**
+ * @brief 将一组脏块按块号顺序写回，只发一次设备请求
+ *
+ * @param bufs 已按块号升序排列
+ * @param cnt
+ * @return int
+ */
+static int newfs_cache_writeback(struct newfs_buf **bufs, int cnt)
+{
+    struct ddriver_iovec *iov;
+    int i;
+
+    if (cnt == 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    iov = (struct ddriver_iovec *)malloc(sizeof(struct ddriver_iovec) * cnt);
+    for (i = 0; i < cnt; i++)
+    {
+        iov[i].offset = NEWFS_BUF_OFS(bufs[i]->blkno);
+        iov[i].buf = (char *)bufs[i]->data;
+        iov[i].size = NEWFS_BLKS_SZ(1);
+    }
+    if (newfs_dev_writev(iov, cnt) < 0)
+    {
+        free(iov);
+        return -NEWFS_ERROR_IO;
+    }
+    for (i = 0; i < cnt; i++)
+    {
+        bufs[i]->flags &= ~NEWFS_BUF_DIRTY;
+    }
+    newfs_cache.stats.writebacks += cnt;
+    free(iov);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 为blkno取得一个缓存块：优先使用空闲块，否则换出LRU链尾，脏块先写回
+ *
+ * @param blkno
+ * @return struct newfs_buf*
+ */
+static struct newfs_buf *newfs_cache_grab(int blkno)
+{
+    struct newfs_buf *buf = newfs_cache.lru.lru_prev;
+
+    if (buf->blkno >= 0)
+    {
+        if ((buf->flags & NEWFS_BUF_DIRTY) && newfs_cache_writeback(&buf, 1) != NEWFS_ERROR_NONE)
+        {
+            return NULL;
+        }
+        newfs_hash_remove(buf);
+        newfs_cache.stats.evictions++;
+    }
+    newfs_lru_remove(buf);
+    buf->blkno = blkno;
+    buf->flags = 0;
+    newfs_hash_insert(buf);
+    newfs_lru_push(buf);
+    return buf;
+}
+/**
+ * @brief 本批中刚分配、还没读入的块不能留在缓存里，否则下次会被当作命中
+ *
+ * @param bufs
+ * @param blk_cnt 没取到的位置为NULL
+ */
+static void newfs_cache_discard(struct newfs_buf **bufs, int blk_cnt)
+{
+    int i;
+
+    for (i = 0; i < blk_cnt; i++)
+    {
+        if (bufs[i] != NULL && !(bufs[i]->flags & NEWFS_BUF_VALID))
+        {
+            newfs_hash_remove(bufs[i]);
+            bufs[i]->blkno = -1;
+            newfs_lru_remove(bufs[i]);
+            newfs_lru_push_tail(bufs[i]);
+        }
+    }
+}
+/**
+ * @brief 取得[blk_start, blk_start + blk_cnt)的缓存块，未命中的块合并为一次设备请求读入
+ *
+ * @param blk_start
+ * @param blk_cnt 不超过NEWFS_CACHE_BATCH，且不超过缓存块数的一半，保证本批的块不会互相换出
+ * @param fill_mask 第i位为1表示第i块未命中时需要从磁盘读入；会被整块覆盖的块置0，直接分配不读
+ * @param bufs 输出
+ * @return int
+ */
+static int newfs_cache_get(int blk_start, int blk_cnt, uint64_t fill_mask, struct newfs_buf **bufs)
+{
+    struct ddriver_iovec iov[NEWFS_CACHE_BATCH];
+    struct newfs_buf *buf;
+    int iovcnt = 0;
+    int i;
+
+    for (i = 0; i < blk_cnt; i++)
+    {
+        buf = newfs_cache_find(blk_start + i);
+        if (buf != NULL)
+        {
+            newfs_lru_remove(buf);
+            newfs_lru_push(buf);
+            newfs_cache.stats.hits++;
+        }
+        bufs[i] = buf;
+    }
+
+    for (i = 0; i < blk_cnt; i++)
+    {
+        if (bufs[i] != NULL)
+        {
+            continue;
+        }
+        buf = newfs_cache_grab(blk_start + i);
+        if (buf == NULL)
+        {
+            newfs_cache_discard(bufs, blk_cnt);
+            return -NEWFS_ERROR_IO;
+        }
+        bufs[i] = buf;
+        newfs_cache.stats.misses++;
+        if (!(fill_mask & ((uint64_t)1 << i)))
+        {
+            newfs_cache.stats.fills_skipped++;
+            continue;
+        }
+        iov[iovcnt].offset = NEWFS_BUF_OFS(buf->blkno);
+        iov[iovcnt].buf = (char *)buf->data;
+        iov[iovcnt].size = NEWFS_BLKS_SZ(1);
+        iovcnt++;
+    }
+
+    if (iovcnt > 0 && newfs_dev_readv(iov, iovcnt) < 0)
+    {
+        newfs_cache_discard(bufs, blk_cnt);
+        return -NEWFS_ERROR_IO;
+    }
+    for (i = 0; i < blk_cnt; i++)
+    {
+        bufs[i]->flags |= NEWFS_BUF_VALID;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 本批最多处理的块数
+ *
+ * @return int
+ */
+static int newfs_cache_batch()
+{
+    int batch = newfs_cache.nbufs / 2;
+    if (batch > NEWFS_CACHE_BATCH)
+    {
+        batch = NEWFS_CACHE_BATCH;
+    }
+    return batch > 0 ? batch : 1;
+}
+/**
+ * @brief 初始化块缓存
+ *
+ * @param nbufs 缓存块数，0表示不使用缓存
+ * @return int
+ */
+int newfs_cache_init(int nbufs)
+{
+    int i;
+
+    memset(&newfs_cache, 0, sizeof(struct newfs_cache));
+    newfs_cache.lru.lru_next = &newfs_cache.lru;
+    newfs_cache.lru.lru_prev = &newfs_cache.lru;
+    if (nbufs <= 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    if (nbufs < 2)
+    {
+        nbufs = 2;
+    }
+
+    newfs_cache.nbufs = nbufs;
+    newfs_cache.hsize = 1;
+    while (newfs_cache.hsize < nbufs)
+    {
+        newfs_cache.hsize <<= 1;
+    }
+    newfs_cache.mem = (uint8_t *)malloc(NEWFS_BLKS_SZ(nbufs));
+    newfs_cache.bufs = (struct newfs_buf *)calloc(nbufs, sizeof(struct newfs_buf));
+    newfs_cache.htable = (struct newfs_buf **)calloc(newfs_cache.hsize, sizeof(struct newfs_buf *));
+    if (newfs_cache.mem == NULL || newfs_cache.bufs == NULL || newfs_cache.htable == NULL)
+    {
+        newfs_cache_destroy();
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < nbufs; i++)
+    {
+        newfs_cache.bufs[i].blkno = -1;
+        newfs_cache.bufs[i].data = newfs_cache.mem + NEWFS_BLKS_SZ(i);
+        newfs_lru_push_tail(&newfs_cache.bufs[i]);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 释放块缓存，调用前应先newfs_cache_flush
+ */
+void newfs_cache_destroy()
+{
+    free(newfs_cache.mem);
+    free(newfs_cache.bufs);
+    free(newfs_cache.htable);
+    memset(&newfs_cache, 0, sizeof(struct newfs_cache));
+}
+/**
+ * @brief 是否启用了块缓存
+ *
+ * @return int
+ */
+int newfs_cache_enabled()
+{
+    return newfs_cache.nbufs > 0;
+}
+/**
+ * @brief 经过块缓存读，未命中的块从磁盘读入
+ *
+ * @param offset 磁盘偏移，不要求对齐
+ * @param out_content
+ * @param size
+ * @return int
+ */
+int newfs_cache_read(int offset, uint8_t *out_content, int size)
+{
+    struct newfs_buf *bufs[NEWFS_CACHE_BATCH];
+    int blk_start = offset / NEWFS_BLKS_SZ(1);
+    int blk_end = (offset + size + NEWFS_BLKS_SZ(1) - 1) / NEWFS_BLKS_SZ(1);
+    int batch = newfs_cache_batch();
+    int blk_cnt, bias, len, i;
+
+    pthread_mutex_lock(&newfs_cache_lock);
+    while (blk_start < blk_end)
+    {
+        blk_cnt = blk_end - blk_start < batch ? blk_end - blk_start : batch;
+        if (newfs_cache_get(blk_start, blk_cnt, ~(uint64_t)0, bufs) != NEWFS_ERROR_NONE)
+        {
+            pthread_mutex_unlock(&newfs_cache_lock);
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; i < blk_cnt; i++)
+        {
+            bias = offset - NEWFS_BUF_OFS(bufs[i]->blkno);
+            len = NEWFS_BLKS_SZ(1) - bias < size ? NEWFS_BLKS_SZ(1) - bias : size;
+            memcpy(out_content, bufs[i]->data + bias, len);
+            out_content += len;
+            offset += len;
+            size -= len;
+        }
+        blk_start += blk_cnt;
+    }
+    pthread_mutex_unlock(&newfs_cache_lock);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 经过块缓存写，只修改缓存并标脏，由newfs_cache_flush或换出时写回
+ *
+ * @param offset 磁盘偏移，不要求对齐
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_cache_write(int offset, uint8_t *in_content, int size)
+{
+    struct newfs_buf *bufs[NEWFS_CACHE_BATCH];
+    int blk_start = offset / NEWFS_BLKS_SZ(1);
+    int blk_end = (offset + size + NEWFS_BLKS_SZ(1) - 1) / NEWFS_BLKS_SZ(1);
+    int head_partial = offset % NEWFS_BLKS_SZ(1) != 0;          // 首块只写一部分
+    int tail_partial = (offset + size) % NEWFS_BLKS_SZ(1) != 0; // 尾块只写一部分
+    int batch = newfs_cache_batch();
+    int blk_cnt, bias, len, i;
+    uint64_t fill_mask;
+
+    pthread_mutex_lock(&newfs_cache_lock);
+    while (blk_start < blk_end)
+    {
+        blk_cnt = blk_end - blk_start < batch ? blk_end - blk_start : batch;
+        // 只有部分覆盖的首尾块需要先读，整块覆盖的直接写
+        fill_mask = 0;
+        if (head_partial && blk_start == offset / NEWFS_BLKS_SZ(1))
+        {
+            fill_mask |= 1;
+        }
+        if (tail_partial && blk_start + blk_cnt == blk_end)
+        {
+            fill_mask |= (uint64_t)1 << (blk_cnt - 1);
+        }
+        if (newfs_cache_get(blk_start, blk_cnt, fill_mask, bufs) != NEWFS_ERROR_NONE)
+        {
+            pthread_mutex_unlock(&newfs_cache_lock);
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; i < blk_cnt; i++)
+        {
+            bias = offset - NEWFS_BUF_OFS(bufs[i]->blkno);
+            len = NEWFS_BLKS_SZ(1) - bias < size ? NEWFS_BLKS_SZ(1) - bias : size;
+            memcpy(bufs[i]->data + bias, in_content, len);
+            bufs[i]->flags |= NEWFS_BUF_DIRTY;
+            in_content += len;
+            offset += len;
+            size -= len;
+        }
+        blk_start += blk_cnt;
+    }
+    pthread_mutex_unlock(&newfs_cache_lock);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 丢弃[offset, offset + size)所在的缓存块，包括未写回的修改。
+ * 块被释放后可能作为文件数据绕过缓存直接写盘，不能让旧内容再被写回
+ *
+ * @param offset 磁盘偏移
+ * @param size
+ */
+void newfs_cache_invalidate(int offset, int size)
+{
+    int blk_start = offset / NEWFS_BLKS_SZ(1);
+    int blk_end = (offset + size + NEWFS_BLKS_SZ(1) - 1) / NEWFS_BLKS_SZ(1);
+    struct newfs_buf *buf;
+
+    if (!newfs_cache_enabled())
+    {
+        return;
+    }
+    pthread_mutex_lock(&newfs_cache_lock);
+    for (; blk_start < blk_end; blk_start++)
+    {
+        buf = newfs_cache_find(blk_start);
+        if (buf == NULL)
+        {
+            continue;
+        }
+        newfs_hash_remove(buf);
+        buf->blkno = -1;
+        buf->flags = 0;
+        newfs_lru_remove(buf);
+        newfs_lru_push_tail(buf);
+    }
+    pthread_mutex_unlock(&newfs_cache_lock);
+}
+static int newfs_buf_cmp(const void *a, const void *b)
+{
+    return (*(struct newfs_buf **)a)->blkno - (*(struct newfs_buf **)b)->blkno;
+}
+/**
+ * @brief 将所有脏块按块号顺序写回磁盘
+ *
+ * @return int
+ */
+int newfs_cache_flush()
+{
+    struct newfs_buf **dirty;
+    int cnt = 0, i, ret;
+
+    if (!newfs_cache_enabled())
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    dirty = (struct newfs_buf **)malloc(sizeof(struct newfs_buf *) * newfs_cache.nbufs);
+    pthread_mutex_lock(&newfs_cache_lock);
+    for (i = 0; i < newfs_cache.nbufs; i++)
+    {
+        if (newfs_cache.bufs[i].blkno >= 0 && (newfs_cache.bufs[i].flags & NEWFS_BUF_DIRTY))
+        {
+            dirty[cnt++] = &newfs_cache.bufs[i];
+        }
+    }
+    qsort(dirty, cnt, sizeof(struct newfs_buf *), newfs_buf_cmp);
+    ret = newfs_cache_writeback(dirty, cnt);
+    pthread_mutex_unlock(&newfs_cache_lock);
+    free(dirty);
+    return ret;
+}
+/**
+ * @brief 打印块缓存的命中统计
+ */
+void newfs_cache_dump_stats()
+{
+    struct newfs_cache_stats *stats = &newfs_cache.stats;
+    long total = stats->hits + stats->misses;
+
+    if (!newfs_cache_enabled())
+    {
+        return;
+    }
+    NEWFS_DBG("[cache] blks %d, hits %ld, misses %ld, hit rate %.2f%%, evictions %ld, writebacks %ld, fills skipped %ld\n",
+              newfs_cache.nbufs, stats->hits, stats->misses,
+              total == 0 ? 0.0 : 100.0 * stats->hits / total,
+              stats->evictions, stats->writebacks, stats->fills_skipped);
+}
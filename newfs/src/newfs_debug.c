@@ -0,0 +1,24 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/**
+ * @brief 打印设备读写计数以及各级缓存的统计
+ */
+void newfs_dump_stats()
+{
+    struct ddriver_state state;
+
+    ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_STATE, &state);
+    NEWFS_DBG("[ddriver] read %d, write %d, seek %d\n", state.read_cnt, state.write_cnt, state.seek_cnt);
+    newfs_cache_dump_stats();
+    newfs_bounce_dump_stats();
+    newfs_pcache_dump_stats();
+    newfs_itable_dump_stats();
+    newfs_slab_dump_stats();
+    newfs_file_dump_stats();
+    newfs_icache_dump_stats();
+    newfs_epoch_dump_stats();
+    newfs_wb_dump_stats();
+    newfs_journal_dump_stats();
+}
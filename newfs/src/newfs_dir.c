@@ -0,0 +1,284 @@
+#include "newfs.h"
+
+/*
+ * 每个已读入内存的目录inode按名字维护一张链式哈希表，桶数为2的幂，目录项数
+ * 超过桶数时翻倍。brother链表保留原有的顺序，readdir仍按链表遍历。
+ *
+ * 目录项加入目录时分到一个递增的cookie，新目录项插在brother链表头部，所以
+ * 链表按cookie递减排列。readdir把目录项的cookie作为下一次的偏移，从偏移
+ * off继续就是从第一个cookie小于off的目录项继续；删除目录项时把目录项搬到
+ * 别的块不会影响cookie，遍历过程中存在的目录项不会被跳过或重复。
+ *
+ * getattr不加锁地查哈希表。修改哈希表的只有持有tree_lock写锁的操作，修改
+ * 前后各把dseq加一，读者在查找前后比较dseq，不一致或为奇数时重试。旧的桶
+ * 数组和摘下的目录项都延迟到读者退出后释放，读者在修改途中看到的指针总是
+ * 可以访问的。
+ */
+
+/**
+ * @brief 把目录项挂到哈希表的桶上
+ *
+ * @param dhash
+ * @param size
+ * @param dentry
+ */
+static inline void newfs_dir_hash_link(struct newfs_dentry **dhash, int size, struct newfs_dentry *dentry)
+{
+    int bucket = dentry->hash & (size - 1);
+    dentry->hnext = dhash[bucket];
+    __atomic_store_n(&dhash[bucket], dentry, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 开始修改目录的哈希表，dseq变为奇数
+ *
+ * @param inode
+ */
+static inline void newfs_dir_write_begin(struct newfs_inode *inode)
+{
+    __atomic_store_n(&inode->dseq, inode->dseq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+/**
+ * @brief 修改结束，dseq回到偶数
+ *
+ * @param inode
+ */
+static inline void newfs_dir_write_end(struct newfs_inode *inode)
+{
+    __atomic_store_n(&inode->dseq, inode->dseq + 1, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 桶数翻倍并重新散列
+ *
+ * @param inode
+ * @param size 新的桶数
+ * @return int
+ */
+static int newfs_dir_index_resize(struct newfs_inode *inode, int size)
+{
+    struct newfs_dentry **dhash = (struct newfs_dentry **)calloc(size, sizeof(struct newfs_dentry *));
+    struct newfs_dentry **old;
+    struct newfs_dentry *dentry, *next;
+    int i;
+
+    if (dhash == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < inode->dhash_size; i++)
+    {
+        for (dentry = inode->dhash[i]; dentry != NULL; dentry = next)
+        {
+            next = dentry->hnext;
+            newfs_dir_hash_link(dhash, size, dentry);
+        }
+    }
+    // 读者先取桶数再取数组，先换数组，读者不会拿旧数组按新桶数访问。旧数组
+    // 换下来之后才能交给延迟释放
+    old = inode->dhash;
+    __atomic_store_n(&inode->dhash, dhash, __ATOMIC_RELEASE);
+    __atomic_store_n(&inode->dhash_size, size, __ATOMIC_RELEASE);
+    newfs_epoch_defer(free, old);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将目录项加入目录的哈希表，调用前dir_cnt已包含该目录项
+ *
+ * @param inode 目录inode
+ * @param dentry
+ * @return int
+ */
+int newfs_dir_index_insert(struct newfs_inode *inode, struct newfs_dentry *dentry)
+{
+    int size = inode->dhash_size > 0 ? inode->dhash_size : NEWFS_DHASH_INIT;
+    int ret = NEWFS_ERROR_NONE;
+
+    while (size < inode->dir_cnt)
+    {
+        size <<= 1;
+    }
+    newfs_dir_write_begin(inode);
+    if (size != inode->dhash_size && newfs_dir_index_resize(inode, size) != NEWFS_ERROR_NONE)
+    {
+        ret = -NEWFS_ERROR_NOSPACE;
+    }
+    else
+    {
+        newfs_dir_hash_link(inode->dhash, inode->dhash_size, dentry);
+        dentry->cookie = ++inode->dir_cookie;
+    }
+    newfs_dir_write_end(inode);
+    return ret;
+}
+/**
+ * @brief 将目录项从目录的哈希表中摘下
+ *
+ * @param inode 目录inode
+ * @param dentry
+ */
+void newfs_dir_index_remove(struct newfs_inode *inode, struct newfs_dentry *dentry)
+{
+    struct newfs_dentry **pp;
+
+    if (inode->rd_next == dentry)
+    {
+        inode->rd_next = NULL;
+    }
+    if (inode->dhash_size == 0)
+    {
+        return;
+    }
+    newfs_dir_write_begin(inode);
+    pp = &inode->dhash[dentry->hash & (inode->dhash_size - 1)];
+    while (*pp != NULL && *pp != dentry)
+    {
+        pp = &(*pp)->hnext;
+    }
+    if (*pp == dentry)
+    {
+        __atomic_store_n(pp, dentry->hnext, __ATOMIC_RELEASE);
+    }
+    // 正在这个目录项上的读者不能走回链中，dseq变了会重试
+    dentry->hnext = NULL;
+    newfs_dir_write_end(inode);
+}
+/**
+ * @brief 在目录中按名字查找目录项
+ *
+ * @param inode 目录inode
+ * @param name 不要求以'\0'结尾
+ * @param len
+ * @return struct newfs_dentry* 没找到返回NULL
+ */
+struct newfs_dentry *newfs_dir_index_find(struct newfs_inode *inode, const char *name, int len)
+{
+    uint32_t hash = newfs_name_hash(name, len);
+    struct newfs_dentry *dentry;
+
+    if (inode->dhash_size == 0)
+    {
+        return NULL;
+    }
+    for (dentry = inode->dhash[hash & (inode->dhash_size - 1)]; dentry != NULL; dentry = dentry->hnext)
+    {
+        if (dentry->hash == hash && dentry->name_len == len && memcmp(dentry->name, name, len) == 0)
+        {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief 开始不加锁地读目录的哈希表
+ *
+ * @param inode 目录inode
+ * @return unsigned int 交给newfs_dir_read_retry，奇数表示正在修改，应直接重试
+ */
+unsigned int newfs_dir_read_begin(struct newfs_inode *inode)
+{
+    return __atomic_load_n(&inode->dseq, __ATOMIC_ACQUIRE);
+}
+/**
+ * @brief 从newfs_dir_read_begin以来哈希表是否被修改过
+ *
+ * @param inode 目录inode
+ * @param seq
+ * @return int 非0表示读到的结果不可信，需要重试
+ */
+int newfs_dir_read_retry(struct newfs_inode *inode, unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&inode->dseq, __ATOMIC_RELAXED) != seq;
+}
+/**
+ * @brief 同newfs_dir_index_find，但不加锁，调用者在epoch中。每走一步都检查
+ * dseq，哈希表被改动时链可能被接到别的桶上，及时停下，结果由调用者再用
+ * newfs_dir_read_retry确认
+ *
+ * @param inode 目录inode
+ * @param name 不要求以'\0'结尾
+ * @param len
+ * @param seq newfs_dir_read_begin的返回值
+ * @return struct newfs_dentry* 没找到或哈希表被修改返回NULL
+ */
+struct newfs_dentry *newfs_dir_index_find_nolock(struct newfs_inode *inode, const char *name, int len, unsigned int seq)
+{
+    uint32_t hash = newfs_name_hash(name, len);
+    int size = __atomic_load_n(&inode->dhash_size, __ATOMIC_ACQUIRE);
+    struct newfs_dentry **dhash = __atomic_load_n(&inode->dhash, __ATOMIC_ACQUIRE);
+    struct newfs_dentry *dentry;
+
+    if (size == 0 || dhash == NULL)
+    {
+        return NULL;
+    }
+    for (dentry = __atomic_load_n(&dhash[hash & (size - 1)], __ATOMIC_ACQUIRE); dentry != NULL;
+         dentry = __atomic_load_n(&dentry->hnext, __ATOMIC_ACQUIRE))
+    {
+        if (newfs_dir_read_retry(inode, seq))
+        {
+            return NULL;
+        }
+        if (dentry->hash == hash && dentry->name_len == len && memcmp(dentry->name, name, len) == 0)
+        {
+            return dentry;
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief 找到readdir从偏移off继续时的第一个目录项。接着上次停下的位置继续
+ * 时O(1)，否则沿链表找第一个cookie小于off的目录项
+ *
+ * @param inode 目录inode
+ * @param off 0表示从头开始
+ * @return struct newfs_dentry* 没有剩下的目录项返回NULL
+ */
+struct newfs_dentry *newfs_dir_seek(struct newfs_inode *inode, long off)
+{
+    struct newfs_dentry *dentry = inode->dentrys;
+
+    if (off == 0)
+    {
+        return dentry;
+    }
+    if (inode->rd_next != NULL && inode->rd_off == off)
+    {
+        return inode->rd_next;
+    }
+    while (dentry != NULL && dentry->cookie >= off)
+    {
+        dentry = dentry->brother;
+    }
+    return dentry;
+}
+/**
+ * @brief 记下readdir停下的位置，下次从off继续时由newfs_dir_seek直接取出
+ *
+ * @param inode 目录inode
+ * @param dentry 下一个要输出的目录项
+ * @param off
+ */
+void newfs_dir_tell(struct newfs_inode *inode, struct newfs_dentry *dentry, long off)
+{
+    inode->rd_next = dentry;
+    inode->rd_off = off;
+}
+/**
+ * @brief 释放目录的哈希表，目录项本身不释放
+ *
+ * @param inode
+ */
+void newfs_dir_index_destroy(struct newfs_inode *inode)
+{
+    struct newfs_dentry **dhash = inode->dhash;
+
+    // dseq停在奇数，还在这个目录里查找的读者都会重试
+    if ((inode->dseq & 1) == 0)
+    {
+        newfs_dir_write_begin(inode);
+    }
+    __atomic_store_n(&inode->dhash_size, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&inode->dhash, NULL, __ATOMIC_RELEASE);
+    newfs_epoch_defer(free, dhash);
+}
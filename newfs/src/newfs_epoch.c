@@ -0,0 +1,166 @@
+#include "newfs.h"
+
+/*
+ * 不加锁的读者与释放对象的写者之间的延迟释放。读者用newfs_epoch_enter和
+ * newfs_epoch_exit包住对目录树的访问，期间不持有任何锁；写者把dentry、inode
+ * 从目录树摘下后不直接释放，交给newfs_epoch_defer挂到待释放列表上。
+ *
+ * 读者进入时计入当前epoch（cur的最低位）的计数。回收时先取走待释放列表，再
+ * 翻转cur，等旧epoch的计数归零：此后还在的读者都是翻转之后进入的，看不到
+ * 翻转前已经摘下的对象，列表中的对象可以释放了。回收只在FUSE操作结束后、
+ * 不持有锁时进行，读者在epoch中不会等锁，等待总能结束。
+ *
+ * 读者计数按线程分散到NEWFS_EPOCH_STRIPES个cache line上，多核同时getattr时
+ * 不争同一个计数。
+ */
+static struct newfs_epoch newfs_epoch;
+// 待释放列表
+static pthread_mutex_t newfs_epoch_lock = PTHREAD_MUTEX_INITIALIZER;
+// 同一时刻只有一个回收者翻转epoch
+static pthread_mutex_t newfs_epoch_reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static int newfs_epoch_next_stripe;
+static __thread int newfs_epoch_stripe = -1;
+
+/**
+ * @brief 当前线程使用的读者计数，第一次进入时分配
+ *
+ * @return struct newfs_epoch_stripe*
+ */
+static inline struct newfs_epoch_stripe *newfs_epoch_my_stripe()
+{
+    if (newfs_epoch_stripe < 0)
+    {
+        newfs_epoch_stripe = __atomic_fetch_add(&newfs_epoch_next_stripe, 1, __ATOMIC_RELAXED) &
+                             (NEWFS_EPOCH_STRIPES - 1);
+    }
+    return &newfs_epoch.stripes[newfs_epoch_stripe];
+}
+/**
+ * @brief 进入读侧临界区，此后读到的dentry、inode在newfs_epoch_exit之前不会被释放
+ *
+ * @return int 交给newfs_epoch_exit
+ */
+int newfs_epoch_enter()
+{
+    struct newfs_epoch_stripe *stripe = newfs_epoch_my_stripe();
+    unsigned int e;
+
+    for (;;)
+    {
+        e = __atomic_load_n(&newfs_epoch.cur, __ATOMIC_SEQ_CST) & 1;
+        __atomic_fetch_add(&stripe->active[e], 1, __ATOMIC_SEQ_CST);
+        // 计数之前epoch已经翻转，回收者可能没看到这次计数，换到新的epoch
+        if ((__atomic_load_n(&newfs_epoch.cur, __ATOMIC_SEQ_CST) & 1) == e)
+        {
+            return e;
+        }
+        __atomic_fetch_sub(&stripe->active[e], 1, __ATOMIC_RELEASE);
+    }
+}
+/**
+ * @brief 退出读侧临界区
+ *
+ * @param e newfs_epoch_enter的返回值
+ */
+void newfs_epoch_exit(int e)
+{
+    __atomic_fetch_sub(&newfs_epoch_my_stripe()->active[e], 1, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 翻转epoch，等翻转前进入的读者全部退出。调用者持有newfs_epoch_reclaim_lock，
+ * 自己不在读侧临界区中
+ */
+static void newfs_epoch_flip()
+{
+    unsigned int old = __atomic_fetch_add(&newfs_epoch.cur, 1, __ATOMIC_SEQ_CST) & 1;
+    int i;
+
+    for (i = 0; i < NEWFS_EPOCH_STRIPES; i++)
+    {
+        while (__atomic_load_n(&newfs_epoch.stripes[i].active[old], __ATOMIC_ACQUIRE) != 0)
+        {
+            sched_yield();
+        }
+    }
+    newfs_epoch.syncs++;
+}
+/**
+ * @brief 对象已从目录树摘下，等当前的读者全部退出后调用fn(obj)释放。列表
+ * 扩不了时就地等读者退出再释放
+ *
+ * @param fn
+ * @param obj
+ */
+void newfs_epoch_defer(void (*fn)(void *), void *obj)
+{
+    struct newfs_epoch_retire *retired;
+    int cap;
+
+    if (obj == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&newfs_epoch_lock);
+    if (newfs_epoch.retired_cnt == newfs_epoch.retired_cap)
+    {
+        cap = newfs_epoch.retired_cap > 0 ? newfs_epoch.retired_cap * 2 : NEWFS_EPOCH_BATCH;
+        retired = (struct newfs_epoch_retire *)realloc(newfs_epoch.retired, sizeof(struct newfs_epoch_retire) * cap);
+        if (retired == NULL)
+        {
+            pthread_mutex_unlock(&newfs_epoch_lock);
+            pthread_mutex_lock(&newfs_epoch_reclaim_lock);
+            newfs_epoch_flip();
+            pthread_mutex_unlock(&newfs_epoch_reclaim_lock);
+            fn(obj);
+            return;
+        }
+        newfs_epoch.retired = retired;
+        newfs_epoch.retired_cap = cap;
+    }
+    newfs_epoch.retired[newfs_epoch.retired_cnt].fn = fn;
+    newfs_epoch.retired[newfs_epoch.retired_cnt].obj = obj;
+    newfs_epoch.retired_cnt++;
+    pthread_mutex_unlock(&newfs_epoch_lock);
+}
+/**
+ * @brief 释放待释放列表中的对象。调用者不持有文件系统的锁
+ *
+ * @param force 0表示攒够NEWFS_EPOCH_BATCH个才回收
+ */
+void newfs_epoch_reclaim(int force)
+{
+    struct newfs_epoch_retire *retired;
+    int cnt, i;
+
+    if (__atomic_load_n(&newfs_epoch.retired_cnt, __ATOMIC_RELAXED) < (force ? 1 : NEWFS_EPOCH_BATCH))
+    {
+        return;
+    }
+    pthread_mutex_lock(&newfs_epoch_reclaim_lock);
+    pthread_mutex_lock(&newfs_epoch_lock);
+    retired = newfs_epoch.retired;
+    cnt = newfs_epoch.retired_cnt;
+    newfs_epoch.retired = NULL;
+    newfs_epoch.retired_cnt = newfs_epoch.retired_cap = 0;
+    pthread_mutex_unlock(&newfs_epoch_lock);
+
+    if (cnt > 0)
+    {
+        newfs_epoch_flip();
+    }
+    pthread_mutex_unlock(&newfs_epoch_reclaim_lock);
+    for (i = 0; i < cnt; i++)
+    {
+        retired[i].fn(retired[i].obj);
+    }
+    free(retired);
+    __atomic_fetch_add(&newfs_epoch.reclaimed, cnt, __ATOMIC_RELAXED);
+}
+/**
+ * @brief 打印延迟释放的统计
+ */
+void newfs_epoch_dump_stats()
+{
+    NEWFS_DBG("[epoch] reclaimed %ld objs in %ld grace periods, %d pending\n",
+              newfs_epoch.reclaimed, newfs_epoch.syncs, newfs_epoch.retired_cnt);
+}
@@ -0,0 +1,459 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * 文件的块映射由若干extent组成，每个extent描述一段物理连续的数据块，按逻辑
+ * 顺序首尾相接，第i个extent的逻辑起点是前面所有extent长度之和。磁盘上inode
+ * 直接存放前NEWFS_EXTENTS_INLINE个，其余存放在溢出extent块组成的单链表中；
+ * 内存中把全部extent展开成一个数组。追加块时优先紧跟在最后一个extent之后
+ * 分配，连续写入的大文件通常只需要一两个extent。
+ */
+
+/**
+ * @brief 保证extent数组至少能放cnt个
+ *
+ * @param inode
+ * @param cnt
+ * @return int
+ */
+static int newfs_extent_reserve(struct newfs_inode *inode, int cnt)
+{
+    struct newfs_extent *extents;
+    int cap = inode->ext_cap > 0 ? inode->ext_cap : NEWFS_EXTENTS_INLINE;
+
+    if (cnt <= inode->ext_cap)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    while (cap < cnt)
+    {
+        cap *= 2;
+    }
+    extents = (struct newfs_extent *)realloc(inode->extents, sizeof(struct newfs_extent) * cap);
+    if (extents == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    inode->extents = extents;
+    inode->ext_cap = cap;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 初始化为空映射
+ *
+ * @param inode
+ */
+void newfs_extent_init(struct newfs_inode *inode)
+{
+    inode->extents = NULL;
+    inode->ext_cnt = 0;
+    inode->ext_cap = 0;
+    inode->ext_blks = NULL;
+    inode->ext_blk_cnt = 0;
+    inode->blks = 0;
+}
+/**
+ * @brief 释放映射占用的内存，不释放数据块
+ *
+ * @param inode
+ */
+void newfs_extent_destroy(struct newfs_inode *inode)
+{
+    free(inode->extents);
+    free(inode->ext_blks);
+    newfs_extent_init(inode);
+}
+/**
+ * @brief 从磁盘inode读入全部extent，溢出部分沿extent块链读入
+ *
+ * @param inode
+ * @param inode_d
+ * @return int
+ */
+int newfs_extent_load(struct newfs_inode *inode, struct newfs_inode_d *inode_d)
+{
+    struct newfs_extent_blk_d *blk_d;
+    int blk = inode_d->ext_blk;
+    int i;
+
+    newfs_extent_init(inode);
+    if (newfs_extent_reserve(inode, inode_d->ext_cnt) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < inode_d->ext_cnt && i < NEWFS_EXTENTS_INLINE; i++)
+    {
+        inode->extents[inode->ext_cnt++] = inode_d->extents[i];
+    }
+
+    blk_d = (struct newfs_extent_blk_d *)malloc(NEWFS_BLKS_SZ(1));
+    while (inode->ext_cnt < inode_d->ext_cnt && blk >= 0)
+    {
+        inode->ext_blks = (int *)realloc(inode->ext_blks, sizeof(int) * (inode->ext_blk_cnt + 1));
+        inode->ext_blks[inode->ext_blk_cnt++] = blk;
+        if (newfs_driver_read(NEWFS_DATA_OFS(blk), (uint8_t *)blk_d, NEWFS_BLKS_SZ(1)) != NEWFS_ERROR_NONE)
+        {
+            free(blk_d);
+            return -NEWFS_ERROR_IO;
+        }
+        for (i = 0; i < blk_d->cnt && inode->ext_cnt < inode_d->ext_cnt; i++)
+        {
+            inode->extents[inode->ext_cnt++] = blk_d->extents[i];
+        }
+        blk = blk_d->next;
+    }
+    free(blk_d);
+
+    for (i = 0; i < inode->ext_cnt; i++)
+    {
+        inode->blks += inode->extents[i].len;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将extent写入磁盘inode，溢出部分写入extent块链，按需增减链上的块
+ *
+ * @param inode
+ * @param inode_d
+ * @return int
+ */
+int newfs_extent_sync(struct newfs_inode *inode, struct newfs_inode_d *inode_d)
+{
+    struct newfs_extent_blk_d *blk_d;
+    int per_blk = NEWFS_EXTENTS_PER_BLK();
+    int rest = inode->ext_cnt - NEWFS_EXTENTS_INLINE;
+    int need = rest > 0 ? (rest + per_blk - 1) / per_blk : 0;
+    int i, cnt, blk;
+
+    memset(inode_d->extents, 0, sizeof(inode_d->extents));
+    for (i = 0; i < inode->ext_cnt && i < NEWFS_EXTENTS_INLINE; i++)
+    {
+        inode_d->extents[i] = inode->extents[i];
+    }
+    inode_d->ext_cnt = inode->ext_cnt;
+
+    if (need > inode->ext_blk_cnt)
+    {
+        inode->ext_blks = (int *)realloc(inode->ext_blks, sizeof(int) * need);
+    }
+    while (inode->ext_blk_cnt < need)
+    {
+        blk = newfs_alloc_data();
+        if (blk < 0)
+        {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        inode->ext_blks[inode->ext_blk_cnt++] = blk;
+    }
+    while (inode->ext_blk_cnt > need)
+    {
+        newfs_free_data(inode->ext_blks[--inode->ext_blk_cnt]);
+    }
+    inode_d->ext_blk = need > 0 ? inode->ext_blks[0] : -1;
+
+    blk_d = (struct newfs_extent_blk_d *)malloc(NEWFS_BLKS_SZ(1));
+    for (i = 0; i < need; i++)
+    {
+        cnt = rest < per_blk ? rest : per_blk;
+        memset(blk_d, 0, NEWFS_BLKS_SZ(1));
+        blk_d->next = i + 1 < need ? inode->ext_blks[i + 1] : -1;
+        blk_d->cnt = cnt;
+        memcpy(blk_d->extents, inode->extents + NEWFS_EXTENTS_INLINE + i * per_blk, sizeof(struct newfs_extent) * cnt);
+        if (newfs_driver_write(NEWFS_DATA_OFS(inode->ext_blks[i]), (uint8_t *)blk_d, NEWFS_BLKS_SZ(1)) != NEWFS_ERROR_NONE)
+        {
+            free(blk_d);
+            return -NEWFS_ERROR_IO;
+        }
+        rest -= cnt;
+    }
+    free(blk_d);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 逻辑块号到数据块号
+ *
+ * @param inode
+ * @param lblk
+ * @return int 数据块号，未映射返回-1
+ */
+int newfs_bmap(struct newfs_inode *inode, int lblk)
+{
+    int i;
+
+    if (lblk < 0 || lblk >= inode->blks)
+    {
+        return -1;
+    }
+    for (i = 0; i < inode->ext_cnt; i++)
+    {
+        if (lblk < inode->extents[i].len)
+        {
+            return inode->extents[i].start + lblk;
+        }
+        lblk -= inode->extents[i].len;
+    }
+    return -1;
+}
+/**
+ * @brief 在文件末尾追加映射到nblks个逻辑块，新块尽量接在最后一个extent之后
+ *
+ * @param inode
+ * @param nblks 追加后的逻辑块数
+ * @return int 空间不足时返回-NEWFS_ERROR_NOSPACE，已分配的块保留在映射中
+ */
+int newfs_extent_grow(struct newfs_inode *inode, int nblks)
+{
+    struct newfs_extent *last;
+    int blk;
+
+    while (inode->blks < nblks)
+    {
+        last = inode->ext_cnt > 0 ? &inode->extents[inode->ext_cnt - 1] : NULL;
+        blk = newfs_alloc_data_near(last != NULL ? last->start + last->len : 0);
+        if (blk < 0)
+        {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        if (last != NULL && blk == last->start + last->len)
+        {
+            last->len++;
+        }
+        else
+        {
+            if (newfs_extent_reserve(inode, inode->ext_cnt + 1) != NEWFS_ERROR_NONE)
+            {
+                newfs_free_data(blk);
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            inode->extents[inode->ext_cnt].start = blk;
+            inode->extents[inode->ext_cnt].len = 1;
+            inode->ext_cnt++;
+        }
+        inode->blks++;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 截断到nblks个逻辑块，释放其后的数据块
+ *
+ * @param inode
+ * @param nblks
+ */
+void newfs_extent_truncate(struct newfs_inode *inode, int nblks)
+{
+    struct newfs_extent *last;
+    int keep;
+
+    if (inode->blks > nblks)
+    {
+        inode->ext_gen++;
+    }
+    while (inode->blks > nblks)
+    {
+        last = &inode->extents[inode->ext_cnt - 1];
+        keep = last->len - (inode->blks - nblks);
+        if (keep < 0)
+        {
+            keep = 0;
+        }
+        for (int i = keep; i < last->len; i++)
+        {
+            newfs_free_data(last->start + i);
+        }
+        inode->blks -= last->len - keep;
+        last->len = keep;
+        if (keep == 0)
+        {
+            inode->ext_cnt--;
+        }
+    }
+}
+/**
+ * @brief 把逻辑块[lblk, lblk + nblks)按extent拆成iov段，每个extent内物理
+ * 连续的部分合并为一段
+ *
+ * @param inode
+ * @param lblk
+ * @param nblks 范围需已映射
+ * @param buf 大小为nblks个块
+ * @param iov 至少能放inode->ext_cnt段
+ * @return int 段数
+ */
+static int newfs_extent_iov(struct newfs_inode *inode, int lblk, int nblks, uint8_t *buf, struct ddriver_iovec *iov)
+{
+    int iovcnt = 0;
+    int i, skip, len;
+
+    for (i = 0; i < inode->ext_cnt && nblks > 0; i++)
+    {
+        if (lblk >= inode->extents[i].len)
+        {
+            lblk -= inode->extents[i].len;
+            continue;
+        }
+        skip = lblk;
+        len = inode->extents[i].len - skip < nblks ? inode->extents[i].len - skip : nblks;
+        iov[iovcnt].offset = NEWFS_DATA_OFS(inode->extents[i].start + skip);
+        iov[iovcnt].buf = (char *)buf;
+        iov[iovcnt].size = NEWFS_BLKS_SZ(len);
+        iovcnt++;
+        buf += NEWFS_BLKS_SZ(len);
+        nblks -= len;
+        lblk = 0;
+    }
+    return iovcnt;
+}
+/**
+ * @brief 找逻辑块lblk所在的extent。cursor有效且不在lblk之后时从它开始往后
+ * 数，否则从第一个extent数起；找到后cursor指向这个extent
+ *
+ * @param inode
+ * @param lblk
+ * @param cursor 可以为NULL
+ * @param base 输出这个extent的逻辑起点
+ * @return int extent下标，lblk未映射时为inode->ext_cnt
+ */
+static int newfs_extent_seek(struct newfs_inode *inode, int lblk, struct newfs_extent_cursor *cursor, int *base)
+{
+    int i = 0;
+
+    *base = 0;
+    if (cursor != NULL && cursor->gen == inode->ext_gen &&
+        cursor->idx < inode->ext_cnt && cursor->lblk <= lblk)
+    {
+        i = cursor->idx;
+        *base = cursor->lblk;
+    }
+    for (; i < inode->ext_cnt; i++)
+    {
+        if (lblk < *base + inode->extents[i].len)
+        {
+            break;
+        }
+        *base += inode->extents[i].len;
+    }
+    if (cursor != NULL && i < inode->ext_cnt)
+    {
+        cursor->gen = inode->ext_gen;
+        cursor->idx = i;
+        cursor->lblk = *base;
+    }
+    return i;
+}
+/**
+ * @brief 读写逻辑块[lblk, lblk + nblks)中有缓冲的块，每块一个iov段，
+ * 整个范围只发一次设备请求。文件数据不经过块缓存
+ *
+ * @param inode
+ * @param lblk
+ * @param nblks 范围需已映射
+ * @param bufs bufs[i]为第lblk + i块的缓冲，NULL的块跳过
+ * @param is_write
+ * @param cursor 顺序读写时记住落在的extent，可以为NULL
+ * @return int
+ */
+int newfs_extent_rw(struct newfs_inode *inode, int lblk, int nblks, uint8_t **bufs, int is_write,
+                    struct newfs_extent_cursor *cursor)
+{
+    struct ddriver_iovec *iov;
+    int iovcnt = 0;
+    int i, j, skip, len, ret, base;
+
+    if (nblks <= 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    iov = (struct ddriver_iovec *)malloc(sizeof(struct ddriver_iovec) * nblks);
+    i = newfs_extent_seek(inode, lblk, cursor, &base);
+    lblk -= base;
+    for (; i < inode->ext_cnt && nblks > 0; i++)
+    {
+        skip = lblk;
+        len = inode->extents[i].len - skip < nblks ? inode->extents[i].len - skip : nblks;
+        for (j = 0; j < len; j++, bufs++)
+        {
+            if (*bufs == NULL)
+            {
+                continue;
+            }
+            iov[iovcnt].offset = NEWFS_DATA_OFS(inode->extents[i].start + skip + j);
+            iov[iovcnt].buf = (char *)*bufs;
+            iov[iovcnt].size = NEWFS_BLKS_SZ(1);
+            iovcnt++;
+        }
+        nblks -= len;
+        lblk = 0;
+        if (nblks > 0)
+        {
+            base += inode->extents[i].len;
+        }
+        else if (cursor != NULL)
+        {
+            // 记住范围结束处的extent，顺序读写的下一次从这里开始
+            cursor->idx = i;
+            cursor->lblk = base;
+        }
+    }
+    if (iovcnt == 0)
+    {
+        ret = 0;
+    }
+    else if (is_write)
+    {
+        ret = newfs_dev_writev(iov, iovcnt);
+    }
+    else
+    {
+        ret = newfs_dev_readv(iov, iovcnt);
+    }
+    free(iov);
+    return ret < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 读目录这类元数据的逻辑块[lblk, lblk + nblks)到一段连续的缓冲，
+ * 整段只发一次请求，但要看到块缓存和日志中还没写回原位的内容：
+ * 启用块缓存时每个extent走一次newfs_driver_read，由缓存合并缺失的块；
+ * 否则直接readv，读完再叠加日志
+ *
+ * @param inode
+ * @param lblk
+ * @param nblks 范围需已映射
+ * @param buf 大小为nblks个块
+ * @return int
+ */
+int newfs_extent_read_meta(struct newfs_inode *inode, int lblk, int nblks, uint8_t *buf)
+{
+    struct ddriver_iovec *iov;
+    int iovcnt, i, ret = NEWFS_ERROR_NONE;
+
+    if (nblks <= 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    iov = (struct ddriver_iovec *)malloc(sizeof(struct ddriver_iovec) * inode->ext_cnt);
+    iovcnt = newfs_extent_iov(inode, lblk, nblks, buf, iov);
+    if (newfs_cache_enabled())
+    {
+        for (i = 0; i < iovcnt && ret == NEWFS_ERROR_NONE; i++)
+        {
+            ret = newfs_driver_read(iov[i].offset, (uint8_t *)iov[i].buf, iov[i].size);
+        }
+    }
+    else
+    {
+        // 读原位到叠加日志之间不能做检查点
+        newfs_journal_lock();
+        if (newfs_dev_readv(iov, iovcnt) < 0)
+        {
+            ret = -NEWFS_ERROR_IO;
+        }
+        for (i = 0; i < iovcnt && ret == NEWFS_ERROR_NONE; i++)
+        {
+            newfs_journal_overlay(iov[i].offset, (uint8_t *)iov[i].buf, iov[i].size);
+        }
+        newfs_journal_unlock();
+    }
+    free(iov);
+    return ret;
+}
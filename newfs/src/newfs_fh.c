@@ -0,0 +1,122 @@
+#include "newfs.h"
+
+extern struct custom_options options; // 全局选项
+
+/*
+ * 打开文件和目录的句柄，存放在fuse_file_info->fh中。open时找到inode，句柄
+ * 记下它并把inode->nopen加一，之后的read、write、readdir直接从句柄取inode，
+ * 不再解析路径。nopen非0的inode不会被换出；打开期间被删除的文件只从目录中
+ * 摘下，标记为orphan，到最后一个句柄关闭、内核也不再引用时才释放inode和
+ * 数据块。
+ *
+ * 句柄上还记着这次打开自己的访问状态：上次读到的位置，据此判断是不是顺序读、
+ * 预读多少；上次读写落在的extent，顺序读写查块映射时从这里往后找。
+ */
+
+/**
+ * @brief 为inode新建句柄。调用者至少共享持有tree_lock
+ *
+ * @param inode
+ * @return struct newfs_fh* 内存不足返回NULL
+ */
+struct newfs_fh *newfs_fh_open(struct newfs_inode *inode)
+{
+    struct newfs_fh *fh = (struct newfs_fh *)calloc(1, sizeof(struct newfs_fh));
+
+    if (fh == NULL)
+    {
+        return NULL;
+    }
+    fh->inode = inode;
+    pthread_mutex_init(&fh->lock, NULL);
+    __atomic_add_fetch(&inode->nopen, 1, __ATOMIC_RELAXED);
+    return fh;
+}
+/**
+ * @brief 关闭句柄，orphan的最后一个句柄关闭且内核不再引用时释放inode。
+ * 调用者不持有锁
+ *
+ * @param fh
+ */
+void newfs_fh_release(struct newfs_fh *fh)
+{
+    struct newfs_inode *inode = fh->inode;
+    struct newfs_dentry *dentry;
+    int orphan;
+
+    newfs_op_begin(NEWFS_OP_READ);
+    // orphan只在独占tree_lock时置上，置上之后句柄都走下面独占的路径
+    orphan = inode->orphan;
+    if (!orphan)
+    {
+        __atomic_sub_fetch(&inode->nopen, 1, __ATOMIC_RELAXED);
+    }
+    newfs_op_end(NEWFS_OP_READ);
+    if (orphan)
+    {
+        newfs_op_begin(NEWFS_OP_NAMESPACE);
+        if (__atomic_sub_fetch(&inode->nopen, 1, __ATOMIC_RELAXED) == 0 &&
+            __atomic_load_n(&inode->nlookup, __ATOMIC_RELAXED) == 0)
+        {
+            dentry = inode->dentry;
+            newfs_drop_inode(inode);
+            newfs_dentry_free(dentry);
+        }
+        newfs_op_end(NEWFS_OP_NAMESPACE);
+    }
+    pthread_mutex_destroy(&fh->lock);
+    free(fh);
+}
+/**
+ * @brief 记下这次读的范围，返回缺块时应多读入的块数。接着上次结束的位置读
+ * 时预读窗口翻倍，直到NEWFS_RA_MAX_BLKS；跳着读时不预读
+ *
+ * @param fh
+ * @param offset
+ * @param size
+ * @return int
+ */
+int newfs_fh_readahead(struct newfs_fh *fh, off_t offset, size_t size)
+{
+    int ra = 0;
+
+    pthread_mutex_lock(&fh->lock);
+    if (offset == fh->next_off)
+    {
+        ra = fh->ra_blks > 0 ? fh->ra_blks * 2 : NEWFS_RA_MIN_BLKS;
+        ra = ra < NEWFS_RA_MAX_BLKS ? ra : NEWFS_RA_MAX_BLKS;
+        // 预读的块不能把常驻块数的上限占满，否则刚读入就要换出
+        if (options.file_cache_blks > 0 && ra > options.file_cache_blks / 2)
+        {
+            ra = options.file_cache_blks / 2;
+        }
+    }
+    fh->ra_blks = ra;
+    fh->next_off = offset + (off_t)size;
+    pthread_mutex_unlock(&fh->lock);
+    return ra;
+}
+/**
+ * @brief 取出句柄上记着的extent位置
+ *
+ * @param fh
+ * @param cursor
+ */
+void newfs_fh_cursor_get(struct newfs_fh *fh, struct newfs_extent_cursor *cursor)
+{
+    pthread_mutex_lock(&fh->lock);
+    *cursor = fh->cursor;
+    pthread_mutex_unlock(&fh->lock);
+}
+/**
+ * @brief 读写结束后记下落在的extent
+ *
+ * @param fh
+ * @param cursor
+ */
+void newfs_fh_cursor_put(struct newfs_fh *fh, struct newfs_extent_cursor *cursor)
+{
+    pthread_mutex_lock(&fh->lock);
+    fh->cursor = *cursor;
+    pthread_mutex_unlock(&fh->lock);
+}
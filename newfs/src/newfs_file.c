@@ -0,0 +1,465 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * 文件数据按块缓存在inode->fblks中，第一次读写某块时才分配并读入，查找路径
+ * 和取属性不会碰文件数据。有数据块在内存中的文件按最近使用串成LRU链，常驻
+ * 的块数超过上限时从最久未用的文件开始换出干净的块；脏块落在inode的
+ * [dirty_lo, dirty_hi)中，写回之前不会被换出。
+ *
+ * 一个文件的块缓冲由它的inode->lock保护，LRU链、常驻块数和统计由
+ * newfs_fcache_lock保护。换出别的文件时只trywrlock它的inode，正在读写的文件
+ * 直接跳过，不会在持有newfs_fcache_lock时等待inode锁。
+ */
+static struct newfs_file_cache newfs_fcache;
+static pthread_mutex_t newfs_fcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 初始化文件数据缓存
+ *
+ * @param max_blks 常驻块数上限，0表示不限制
+ */
+void newfs_file_init(int max_blks)
+{
+    memset(&newfs_fcache, 0, sizeof(struct newfs_file_cache));
+    newfs_fcache.max_blks = max_blks;
+}
+/**
+ * @brief 将文件从LRU链上摘下
+ *
+ * @param inode
+ */
+static void newfs_file_lru_unlink(struct newfs_inode *inode)
+{
+    if (inode->flru_prev == NULL && newfs_fcache.head != inode)
+    {
+        return;
+    }
+    if (inode->flru_prev != NULL)
+    {
+        inode->flru_prev->flru_next = inode->flru_next;
+    }
+    else
+    {
+        newfs_fcache.head = inode->flru_next;
+    }
+    if (inode->flru_next != NULL)
+    {
+        inode->flru_next->flru_prev = inode->flru_prev;
+    }
+    else
+    {
+        newfs_fcache.tail = inode->flru_prev;
+    }
+    inode->flru_prev = inode->flru_next = NULL;
+}
+/**
+ * @brief 将文件移到LRU链尾（最近使用）
+ *
+ * @param inode
+ */
+static void newfs_file_lru_touch(struct newfs_inode *inode)
+{
+    if (newfs_fcache.tail == inode)
+    {
+        return;
+    }
+    newfs_file_lru_unlink(inode);
+    inode->flru_prev = newfs_fcache.tail;
+    if (newfs_fcache.tail != NULL)
+    {
+        newfs_fcache.tail->flru_next = inode;
+    }
+    else
+    {
+        newfs_fcache.head = inode;
+    }
+    newfs_fcache.tail = inode;
+}
+/**
+ * @brief 释放第i块的缓冲
+ *
+ * @param inode
+ * @param i
+ */
+static void newfs_file_drop_blk(struct newfs_inode *inode, int i)
+{
+    free(inode->fblks[i]);
+    inode->fblks[i] = NULL;
+    inode->fblk_cnt--;
+    newfs_fcache.blks--;
+}
+/**
+ * @brief 换出文件中所有干净的块，块全部换出后从LRU链上摘下。调用者持有
+ * newfs_fcache_lock和inode的写锁
+ *
+ * @param inode
+ */
+static void newfs_file_evict_clean(struct newfs_inode *inode)
+{
+    for (int i = 0; i < inode->fblk_cap && inode->fblk_cnt > 0; i++)
+    {
+        if (inode->fblks[i] != NULL && (i < inode->dirty_lo || i >= inode->dirty_hi))
+        {
+            newfs_file_drop_blk(inode, i);
+            newfs_fcache.stats.evicted++;
+        }
+    }
+    if (inode->fblk_cnt == 0)
+    {
+        newfs_file_lru_unlink(inode);
+    }
+}
+/**
+ * @brief 换出文件中所有干净的块，调用者持有inode的写锁
+ *
+ * @param inode
+ */
+void newfs_file_evict(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_fcache_lock);
+    newfs_file_evict_clean(inode);
+    pthread_mutex_unlock(&newfs_fcache_lock);
+}
+/**
+ * @brief 常驻块数超过上限时，从最久未用的文件开始换出干净的块。调用者持有
+ * newfs_fcache_lock
+ *
+ * @param keep 正在读写的文件，不换出
+ */
+static void newfs_file_shrink(struct newfs_inode *keep)
+{
+    struct newfs_inode *inode, *next;
+
+    for (inode = newfs_fcache.head;
+         inode != NULL && newfs_fcache.max_blks > 0 && newfs_fcache.blks > newfs_fcache.max_blks;
+         inode = next)
+    {
+        next = inode->flru_next;
+        if (inode != keep && pthread_rwlock_trywrlock(&inode->lock) == 0)
+        {
+            newfs_file_evict_clean(inode);
+            pthread_rwlock_unlock(&inode->lock);
+        }
+    }
+}
+/**
+ * @brief 保证fblks数组至少能放nblks块
+ *
+ * @param inode
+ * @param nblks
+ * @return int
+ */
+static int newfs_file_reserve(struct newfs_inode *inode, int nblks)
+{
+    uint8_t **fblks;
+    int cap = inode->fblk_cap > 0 ? inode->fblk_cap : 1;
+
+    if (nblks <= inode->fblk_cap)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    while (cap < nblks)
+    {
+        cap <<= 1;
+    }
+    fblks = (uint8_t **)realloc(inode->fblks, sizeof(uint8_t *) * cap);
+    if (fblks == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    memset(fblks + inode->fblk_cap, 0, sizeof(uint8_t *) * (cap - inode->fblk_cap));
+    inode->fblks = fblks;
+    inode->fblk_cap = cap;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 逻辑块[lo, hi)是否都已在内存中。持有inode的读锁即可调用
+ *
+ * @param inode
+ * @param lo
+ * @param hi
+ * @return int
+ */
+int newfs_file_resident(struct newfs_inode *inode, int lo, int hi)
+{
+    if (hi > inode->fblk_cap)
+    {
+        return 0;
+    }
+    for (int i = lo; i < hi; i++)
+    {
+        if (inode->fblks[i] == NULL)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+/**
+ * @brief 释放newfs_file_load中为缺失的块分配、还没挂到inode上的缓冲
+ *
+ * @param missing
+ * @param cnt
+ */
+static void newfs_file_free_missing(uint8_t **missing, int cnt)
+{
+    int i;
+
+    for (i = 0; i < cnt; i++)
+    {
+        free(missing[i]);
+    }
+    free(missing);
+}
+/**
+ * @brief 保证逻辑块[lo, hi)在内存中。缺失的块整段只发一次读请求。块都已在
+ * 内存中时只调整LRU，持有inode的读锁即可，否则需要写锁
+ *
+ * @param inode
+ * @param lo
+ * @param hi 范围需已映射
+ * @param fill 为0时缺失的块不读盘，直接补0，用于整块覆盖写和新分配的块
+ * @param cursor 读盘时交给newfs_extent_rw，可以为NULL
+ * @return int
+ */
+int newfs_file_load(struct newfs_inode *inode, int lo, int hi, int fill, struct newfs_extent_cursor *cursor)
+{
+    uint8_t **missing;
+    int i, cnt = 0;
+
+    if (lo >= hi)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_file_resident(inode, lo, hi))
+    {
+        pthread_mutex_lock(&newfs_fcache_lock);
+        newfs_file_lru_touch(inode);
+        pthread_mutex_unlock(&newfs_fcache_lock);
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_file_reserve(inode, hi) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    missing = (uint8_t **)calloc(hi - lo, sizeof(uint8_t *));
+    if (missing == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (i = lo; i < hi; i++)
+    {
+        if (inode->fblks[i] == NULL)
+        {
+            missing[i - lo] = (uint8_t *)calloc(1, NEWFS_BLKS_SZ(1));
+            if (missing[i - lo] == NULL)
+            {
+                newfs_file_free_missing(missing, hi - lo);
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            cnt++;
+        }
+    }
+    if (cnt > 0 && fill)
+    {
+        if (newfs_extent_rw(inode, lo, hi - lo, missing, 0, cursor) != NEWFS_ERROR_NONE)
+        {
+            newfs_file_free_missing(missing, hi - lo);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    for (i = lo; i < hi; i++)
+    {
+        if (missing[i - lo] != NULL)
+        {
+            inode->fblks[i] = missing[i - lo];
+        }
+    }
+    free(missing);
+    inode->fblk_cnt += cnt;
+    pthread_mutex_lock(&newfs_fcache_lock);
+    if (fill)
+    {
+        newfs_fcache.stats.reads++;
+        newfs_fcache.stats.loaded += cnt;
+    }
+    else
+    {
+        newfs_fcache.stats.zeroed += cnt;
+    }
+    newfs_fcache.blks += cnt;
+    if (newfs_fcache.blks > newfs_fcache.stats.peak)
+    {
+        newfs_fcache.stats.peak = newfs_fcache.blks;
+    }
+    newfs_file_lru_touch(inode);
+    newfs_file_shrink(inode);
+    pthread_mutex_unlock(&newfs_fcache_lock);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 从文件读，调用者保证[offset, offset + size)不超出文件大小
+ *
+ * @param inode
+ * @param buf
+ * @param size
+ * @param offset
+ * @return int
+ */
+int newfs_file_read(struct newfs_inode *inode, char *buf, int size, int offset,
+                    struct newfs_extent_cursor *cursor)
+{
+    int blk, bias, len;
+
+    if (newfs_file_load(inode, offset / NEWFS_BLKS_SZ(1),
+                        (offset + size + NEWFS_BLKS_SZ(1) - 1) / NEWFS_BLKS_SZ(1), 1, cursor) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    while (size > 0)
+    {
+        blk = offset / NEWFS_BLKS_SZ(1);
+        bias = offset % NEWFS_BLKS_SZ(1);
+        len = NEWFS_BLKS_SZ(1) - bias < size ? NEWFS_BLKS_SZ(1) - bias : size;
+        memcpy(buf, inode->fblks[blk] + bias, len);
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 写入文件，调用者先把文件扩到offset + size。只写一部分的首尾块
+ * 需要先读盘，整块覆盖的块直接分配
+ *
+ * @param inode
+ * @param buf
+ * @param size
+ * @param offset offset + size不超过NEWFS_MAX_FILE_SZ()，由调用者检查
+ * @return int
+ */
+int newfs_file_write(struct newfs_inode *inode, const char *buf, int size, int offset,
+                     struct newfs_extent_cursor *cursor)
+{
+    int lo = offset / NEWFS_BLKS_SZ(1);
+    int hi = (offset + size + NEWFS_BLKS_SZ(1) - 1) / NEWFS_BLKS_SZ(1);
+    int blk, bias, len;
+
+    if ((offset % NEWFS_BLKS_SZ(1) != 0 && newfs_file_load(inode, lo, lo + 1, 1, cursor) != NEWFS_ERROR_NONE) ||
+        ((offset + size) % NEWFS_BLKS_SZ(1) != 0 && newfs_file_load(inode, hi - 1, hi, 1, cursor) != NEWFS_ERROR_NONE) ||
+        newfs_file_load(inode, lo, hi, 0, NULL) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    while (size > 0)
+    {
+        blk = offset / NEWFS_BLKS_SZ(1);
+        bias = offset % NEWFS_BLKS_SZ(1);
+        len = NEWFS_BLKS_SZ(1) - bias < size ? NEWFS_BLKS_SZ(1) - bias : size;
+        memcpy(inode->fblks[blk] + bias, buf, len);
+        buf += len;
+        offset += len;
+        size -= len;
+    }
+    newfs_mark_blks_dirty(inode, lo, hi);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 把文件从old_size扩到size时，将新增的部分补0。原来最后一块的尾部
+ * 可能还留着截断前的内容，需要读入后清零；新分配的块直接补0，不读盘
+ *
+ * @param inode extent已扩到能容纳size
+ * @param old_size
+ * @param size
+ * @return int
+ */
+int newfs_file_zero(struct newfs_inode *inode, int old_size, int size)
+{
+    int old_blks = NEWFS_ROUND_UP(old_size, NEWFS_BLKS_SZ(1)) / NEWFS_BLKS_SZ(1);
+    int nblks = NEWFS_ROUND_UP(size, NEWFS_BLKS_SZ(1)) / NEWFS_BLKS_SZ(1);
+    int blk = old_size / NEWFS_BLKS_SZ(1);
+    int bias = old_size % NEWFS_BLKS_SZ(1);
+
+    if (bias != 0)
+    {
+        if (newfs_file_load(inode, blk, blk + 1, 1, NULL) != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
+        memset(inode->fblks[blk] + bias, 0, NEWFS_BLKS_SZ(1) - bias);
+    }
+    return newfs_file_load(inode, old_blks, nblks, 0, NULL);
+}
+/**
+ * @brief 文件截断到nblks块，释放之后的块缓冲
+ *
+ * @param inode
+ * @param nblks
+ */
+void newfs_file_truncate(struct newfs_inode *inode, int nblks)
+{
+    pthread_mutex_lock(&newfs_fcache_lock);
+    for (int i = nblks; i < inode->fblk_cap && inode->fblk_cnt > 0; i++)
+    {
+        if (inode->fblks[i] != NULL)
+        {
+            newfs_file_drop_blk(inode, i);
+        }
+    }
+    if (inode->fblk_cnt == 0)
+    {
+        newfs_file_lru_unlink(inode);
+    }
+    pthread_mutex_unlock(&newfs_fcache_lock);
+}
+/**
+ * @brief 写回逻辑块[lo, hi)，不在内存中的块是干净的，跳过
+ *
+ * @param inode
+ * @param lo
+ * @param hi
+ * @return int
+ */
+int newfs_file_sync(struct newfs_inode *inode, int lo, int hi)
+{
+    hi = hi < inode->fblk_cap ? hi : inode->fblk_cap;
+    if (lo >= hi)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    return newfs_extent_rw(inode, lo, hi - lo, inode->fblks + lo, 1, NULL);
+}
+/**
+ * @brief 释放文件的所有块缓冲
+ *
+ * @param inode
+ */
+void newfs_file_release(struct newfs_inode *inode)
+{
+    newfs_file_truncate(inode, 0);
+    free(inode->fblks);
+    inode->fblks = NULL;
+    inode->fblk_cap = 0;
+}
+/**
+ * @brief 卸载时释放所有还在内存中的文件数据
+ */
+void newfs_file_destroy()
+{
+    while (newfs_fcache.head != NULL)
+    {
+        newfs_file_release(newfs_fcache.head);
+    }
+}
+/**
+ * @brief 打印文件数据缓存的统计
+ */
+void newfs_file_dump_stats()
+{
+    NEWFS_DBG("[file] resident %d blks (peak %d, max %d), loaded %ld blks in %ld reads, zero-filled %ld, evicted %ld\n",
+              newfs_fcache.blks, newfs_fcache.stats.peak, newfs_fcache.max_blks,
+              newfs_fcache.stats.loaded, newfs_fcache.stats.reads,
+              newfs_fcache.stats.zeroed, newfs_fcache.stats.evicted);
+}
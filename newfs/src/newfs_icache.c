@@ -0,0 +1,351 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * 内存中的inode按最近使用串成LRU链。inode和dentry的总数超过上限时，从最久
+ * 未用的一端开始换出干净的inode：文件释放数据块缓冲，目录连同下面的dentry
+ * 一起释放。换出后父目录中的dentry保留，dentry->inode置NULL，之后查找时由
+ * newfs_lookup重新读入。
+ *
+ * 目录只有在下面没有已读入的inode时才能换出，所以总是先换出叶子，内存中的
+ * 目录树始终是从根开始的一棵连通子树。换出只在FUSE操作结束后、持有
+ * tree_lock写锁时进行，其他操作过程中拿到的inode指针不会失效；不加锁的
+ * getattr拿到的指针由延迟释放保证有效。
+ *
+ * 访问inode时只置referenced，不调整链表，getattr不需要拿锁。换出时从链头
+ * 扫描，referenced的inode清掉标记挪到链尾，再给一次机会（CLOCK近似LRU）。
+ *
+ * 内存中的inode同时按ino挂在哈希表上，低层接口按节点号O(1)找到inode。内核
+ * 持有引用（nlookup非0）或有打开句柄（nopen非0）的inode不换出，它的祖先
+ * 目录因此也都留在内存中。
+ */
+static struct newfs_icache newfs_icache;
+// 并发的查找会同时调整LRU链，链和计数在它下面修改
+static pthread_mutex_t newfs_icache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 初始化inode缓存
+ *
+ * @param max_objs inode和dentry总数的上限，0表示不限制
+ */
+void newfs_icache_init(int max_objs)
+{
+    memset(&newfs_icache, 0, sizeof(struct newfs_icache));
+    newfs_icache.max_objs = max_objs;
+}
+/**
+ * @brief 挂到LRU链尾
+ *
+ * @param inode
+ */
+static void newfs_icache_link(struct newfs_inode *inode)
+{
+    inode->ilru_next = NULL;
+    inode->ilru_prev = newfs_icache.tail;
+    if (newfs_icache.tail != NULL)
+    {
+        newfs_icache.tail->ilru_next = inode;
+    }
+    else
+    {
+        newfs_icache.head = inode;
+    }
+    newfs_icache.tail = inode;
+}
+/**
+ * @brief 从LRU链上摘下
+ *
+ * @param inode
+ */
+static void newfs_icache_unlink(struct newfs_inode *inode)
+{
+    if (inode->ilru_prev != NULL)
+    {
+        inode->ilru_prev->ilru_next = inode->ilru_next;
+    }
+    else
+    {
+        newfs_icache.head = inode->ilru_next;
+    }
+    if (inode->ilru_next != NULL)
+    {
+        inode->ilru_next->ilru_prev = inode->ilru_prev;
+    }
+    else
+    {
+        newfs_icache.tail = inode->ilru_prev;
+    }
+    inode->ilru_prev = inode->ilru_next = NULL;
+}
+/**
+ * @brief 新读入或新建的inode加入缓存
+ *
+ * @param inode
+ */
+void newfs_icache_add(struct newfs_inode *inode)
+{
+    struct newfs_inode **bucket = &newfs_icache.ihash[inode->ino & (NEWFS_IHASH_SIZE - 1)];
+
+    pthread_mutex_lock(&newfs_icache_lock);
+    newfs_icache_link(inode);
+    inode->ihnext = *bucket;
+    *bucket = inode;
+    inode->generation = ++newfs_icache.generation;
+    newfs_icache.inodes++;
+    newfs_icache.stats.added++;
+    pthread_mutex_unlock(&newfs_icache_lock);
+}
+/**
+ * @brief inode被删除或释放前移出缓存
+ *
+ * @param inode
+ */
+void newfs_icache_remove(struct newfs_inode *inode)
+{
+    struct newfs_inode **pp = &newfs_icache.ihash[inode->ino & (NEWFS_IHASH_SIZE - 1)];
+
+    pthread_mutex_lock(&newfs_icache_lock);
+    while (*pp != NULL && *pp != inode)
+    {
+        pp = &(*pp)->ihnext;
+    }
+    if (*pp == inode)
+    {
+        *pp = inode->ihnext;
+    }
+    inode->ihnext = NULL;
+    newfs_icache_unlink(inode);
+    newfs_icache.inodes--;
+    pthread_mutex_unlock(&newfs_icache_lock);
+}
+/**
+ * @brief 按ino找内存中的inode
+ *
+ * @param ino
+ * @return struct newfs_inode* 不在内存中返回NULL
+ */
+struct newfs_inode *newfs_icache_find(int ino)
+{
+    struct newfs_inode *inode;
+
+    pthread_mutex_lock(&newfs_icache_lock);
+    for (inode = newfs_icache.ihash[ino & (NEWFS_IHASH_SIZE - 1)]; inode != NULL; inode = inode->ihnext)
+    {
+        if ((int)inode->ino == ino)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&newfs_icache_lock);
+    return inode;
+}
+/**
+ * @brief 访问inode时标记为最近使用，不加锁
+ *
+ * @param inode
+ */
+void newfs_icache_touch(struct newfs_inode *inode)
+{
+    // 已经标记过就不再写，常用目录的inode不会在核间来回传
+    if (!__atomic_load_n(&inode->referenced, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&inode->referenced, 1, __ATOMIC_RELAXED);
+    }
+}
+/**
+ * @brief inode能否换出：不是根目录，没有待写回的修改，内核没有持有引用，
+ * 没有打开的句柄，目录下面没有已读入的inode，也没有进行到一半的readdir
+ *
+ * @param inode
+ * @return int
+ */
+static int newfs_icache_evictable(struct newfs_inode *inode)
+{
+    struct newfs_dentry *dentry;
+
+    if (inode == newfs_super.root_dentry->inode || inode->dirty_pprev != NULL ||
+        __atomic_load_n(&inode->nlookup, __ATOMIC_RELAXED) != 0 ||
+        __atomic_load_n(&inode->nopen, __ATOMIC_RELAXED) != 0)
+    {
+        return 0;
+    }
+    if (NEWFS_IS_DIR(inode))
+    {
+        // 重新读入后cookie会重新分配，readdir进行中的目录不能换出
+        if (inode->rd_next != NULL)
+        {
+            return 0;
+        }
+        for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother)
+        {
+            if (dentry->inode != NULL)
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+/**
+ * @brief 换出一个inode，父目录中的dentry保留，属性留在dentry上供getattr使用
+ *
+ * @param inode
+ */
+static void newfs_icache_evict(struct newfs_inode *inode)
+{
+    struct newfs_dentry *dentry = inode->dentry;
+    struct newfs_dentry *sub_dentry, *next;
+
+    // 只改了访问时间的inode不在脏链表上，换出前把记录写下，写不下去就丢掉这次的访问时间
+    if ((inode->flags & NEWFS_INODE_ATIME) && newfs_sync_inode(inode) != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] atime of inode %d lost\n", __func__, inode->ino);
+    }
+    newfs_icache_remove(inode);
+    newfs_inode_attr(inode, &dentry->attr);
+    dentry->attr_expire = newfs_now_ms() + NEWFS_ATTR_TTL_MS;
+    // 先从目录树上摘下，之后才能交给延迟释放，否则新来的读者还能走到它们。
+    // 不加锁的getattr看到NULL时，上面的属性已经可见
+    __atomic_store_n(&dentry->inode, NULL, __ATOMIC_RELEASE);
+    if (NEWFS_IS_DIR(inode))
+    {
+        // 路径缓存中指向子dentry的槽先作废，子dentry下面不会再有已读入的inode
+        newfs_pcache_invalidate_children(dentry);
+        for (sub_dentry = inode->dentrys; sub_dentry != NULL; sub_dentry = next)
+        {
+            next = sub_dentry->brother;
+            newfs_dentry_free(sub_dentry);
+            newfs_icache.stats.evicted_dentries++;
+        }
+        newfs_dir_index_destroy(inode);
+        free(inode->dblks);
+    }
+    else
+    {
+        newfs_file_release(inode);
+    }
+    newfs_extent_destroy(inode);
+    newfs_inode_free(inode);
+    newfs_icache.stats.evicted_inodes++;
+}
+/**
+ * @brief inode和dentry总数是否超过上限
+ *
+ * @return int
+ */
+int newfs_icache_over_limit()
+{
+    return newfs_icache.max_objs > 0 && newfs_slab_in_use() > newfs_icache.max_objs;
+}
+/**
+ * @brief inode和dentry总数超过上限时，从LRU链头开始换出，直到回到上限以内。
+ * 调用者持有tree_lock写锁，没有其他操作在进行
+ */
+void newfs_icache_shrink()
+{
+    struct newfs_inode *inode, *next;
+    int evicted = 1;
+    int pass, n;
+
+    // 换出叶子后它的父目录可能变得可以换出，一遍不够时再扫一遍。第一遍只清掉
+    // 了referenced标记时也再扫一遍
+    for (pass = 0; (evicted || pass == 1) && newfs_icache_over_limit(); pass++)
+    {
+        evicted = 0;
+        // 挪到链尾的inode本遍不再访问
+        n = newfs_icache.inodes;
+        for (inode = newfs_icache.head; inode != NULL && n > 0 && newfs_icache_over_limit(); inode = next, n--)
+        {
+            next = inode->ilru_next;
+            if (__atomic_load_n(&inode->referenced, __ATOMIC_RELAXED))
+            {
+                __atomic_store_n(&inode->referenced, 0, __ATOMIC_RELAXED);
+                pthread_mutex_lock(&newfs_icache_lock);
+                if (newfs_icache.tail != inode)
+                {
+                    newfs_icache_unlink(inode);
+                    newfs_icache_link(inode);
+                }
+                pthread_mutex_unlock(&newfs_icache_lock);
+            }
+            else if (newfs_icache_evictable(inode))
+            {
+                newfs_icache_evict(inode);
+                evicted = 1;
+            }
+        }
+    }
+}
+/**
+ * @brief 写下内存中只改了访问时间的inode记录，卸载时调用
+ */
+void newfs_icache_sync_atime()
+{
+    struct newfs_inode *inode;
+
+    for (inode = newfs_icache.head; inode != NULL; inode = inode->ilru_next)
+    {
+        if ((inode->flags & NEWFS_INODE_ATIME) && newfs_sync_inode(inode) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] atime of inode %d lost\n", __func__, inode->ino);
+        }
+    }
+}
+/**
+ * @brief 释放删除后还留着的orphan inode。卸载时内核不会再发forget，不释放
+ * 的话它们的ino和数据块就一直占着
+ */
+void newfs_icache_drop_orphans()
+{
+    struct newfs_inode *inode = newfs_icache.head;
+    struct newfs_inode *next;
+    struct newfs_dentry *dentry;
+
+    while (inode != NULL)
+    {
+        next = inode->ilru_next;
+        if (inode->orphan)
+        {
+            dentry = inode->dentry;
+            newfs_drop_inode(inode);
+            newfs_dentry_free(dentry);
+        }
+        inode = next;
+    }
+}
+/**
+ * @brief 卸载时释放每个内存中inode自己分配的数组。inode和dentry本身随slab
+ * 整批释放，这里不逐个释放。调用者保证没有其他操作在进行
+ */
+void newfs_icache_destroy()
+{
+    struct newfs_inode *inode;
+
+    for (inode = newfs_icache.head; inode != NULL; inode = inode->ilru_next)
+    {
+        if (NEWFS_IS_DIR(inode))
+        {
+            // 哈希表交给延迟释放，由newfs_slab_destroy中的回收一并释放
+            newfs_dir_index_destroy(inode);
+            free(inode->dblks);
+            inode->dblks = NULL;
+        }
+        else
+        {
+            newfs_file_release(inode);
+        }
+        newfs_extent_destroy(inode);
+    }
+    memset(&newfs_icache, 0, sizeof(struct newfs_icache));
+}
+/**
+ * @brief 打印inode缓存的统计
+ */
+void newfs_icache_dump_stats()
+{
+    NEWFS_DBG("[icache] inodes %d, objs %ld (max %d), added %ld, evicted %ld inodes, %ld dentries\n",
+              newfs_icache.inodes, newfs_slab_in_use(), newfs_icache.max_objs,
+              newfs_icache.stats.added, newfs_icache.stats.evicted_inodes,
+              newfs_icache.stats.evicted_dentries);
+}
@@ -0,0 +1,197 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * inode表缓存：按inode块整块读入，一块里的NEWFS_INODE_PER_BLK条inode记录
+ * 一起留在内存中，读同一块里的其他inode不再访问磁盘。写inode记录时同步更新
+ * 已读入的块，缓存里的内容始终与newfs_driver_read读到的一致。
+ */
+static struct newfs_itable newfs_itable;
+// 读入inode块和读写其中的记录都在它下面进行，同一块不会被重复读入
+static pthread_mutex_t newfs_itable_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 初始化inode表缓存，只建索引，不读盘
+ *
+ * @param ino_blks inode区的块数
+ * @return int
+ */
+int newfs_itable_init(int ino_blks)
+{
+    memset(&newfs_itable, 0, sizeof(struct newfs_itable));
+    newfs_itable.blks = (uint8_t **)calloc(ino_blks, sizeof(uint8_t *));
+    if (newfs_itable.blks == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    newfs_itable.nblks = ino_blks;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 释放inode表缓存
+ */
+void newfs_itable_destroy()
+{
+    for (int i = 0; i < newfs_itable.nblks; i++)
+    {
+        free(newfs_itable.blks[i]);
+    }
+    free(newfs_itable.blks);
+    memset(&newfs_itable, 0, sizeof(struct newfs_itable));
+}
+/**
+ * @brief 把第[lo, hi]个inode块中还没读入的部分读入，整段只发一次请求。
+ * 调用者持有newfs_itable_lock
+ *
+ * @param lo
+ * @param hi
+ * @return int
+ */
+static int newfs_itable_load(int lo, int hi)
+{
+    uint8_t *buf;
+    int i;
+
+    while (lo <= hi && newfs_itable.blks[lo] != NULL)
+    {
+        lo++;
+    }
+    while (hi >= lo && newfs_itable.blks[hi] != NULL)
+    {
+        hi--;
+    }
+    if (lo > hi)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    buf = (uint8_t *)malloc(NEWFS_BLKS_SZ(hi - lo + 1));
+    if (buf == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (newfs_driver_read(newfs_super.ino_offset + NEWFS_BLKS_SZ(lo), buf, NEWFS_BLKS_SZ(hi - lo + 1)) != NEWFS_ERROR_NONE)
+    {
+        free(buf);
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_itable.stats.reads++;
+    for (i = lo; i <= hi; i++)
+    {
+        if (newfs_itable.blks[i] != NULL)
+        {
+            continue;
+        }
+        newfs_itable.blks[i] = (uint8_t *)malloc(NEWFS_BLKS_SZ(1));
+        if (newfs_itable.blks[i] == NULL)
+        {
+            free(buf);
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        memcpy(newfs_itable.blks[i], buf + NEWFS_BLKS_SZ(i - lo), NEWFS_BLKS_SZ(1));
+        newfs_itable.stats.blks_loaded++;
+    }
+    free(buf);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 把第[lo, hi]个inode块中还没读入的部分读入
+ *
+ * @param lo
+ * @param hi
+ * @return int
+ */
+int newfs_itable_prefetch(int lo, int hi)
+{
+    int ret;
+
+    pthread_mutex_lock(&newfs_itable_lock);
+    ret = newfs_itable_load(lo, hi);
+    pthread_mutex_unlock(&newfs_itable_lock);
+    return ret;
+}
+/**
+ * @brief 取一条inode记录，所在的块不在缓存中时整块读入
+ *
+ * @param ino
+ * @param inode_d
+ * @return int
+ */
+int newfs_itable_get(int ino, struct newfs_inode_d *inode_d)
+{
+    int blk = ino / NEWFS_INODE_PER_BLK;
+
+    if (ino < 0 || blk >= newfs_itable.nblks)
+    {
+        return -NEWFS_ERROR_INVAL;
+    }
+    pthread_mutex_lock(&newfs_itable_lock);
+    if (newfs_itable.blks[blk] == NULL)
+    {
+        newfs_itable.stats.misses++;
+        if (newfs_itable_load(blk, blk) != NEWFS_ERROR_NONE)
+        {
+            pthread_mutex_unlock(&newfs_itable_lock);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    else
+    {
+        newfs_itable.stats.hits++;
+    }
+    memcpy(inode_d, newfs_itable.blks[blk] + NEWFS_INODE_SZ * (ino % NEWFS_INODE_PER_BLK), sizeof(struct newfs_inode_d));
+    pthread_mutex_unlock(&newfs_itable_lock);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief inode记录写盘后同步更新缓存，所在的块没读入时不用管
+ *
+ * @param ino
+ * @param inode_d
+ */
+void newfs_itable_put(int ino, struct newfs_inode_d *inode_d)
+{
+    int blk = ino / NEWFS_INODE_PER_BLK;
+
+    if (ino < 0 || blk >= newfs_itable.nblks)
+    {
+        return;
+    }
+    pthread_mutex_lock(&newfs_itable_lock);
+    if (newfs_itable.blks[blk] != NULL)
+    {
+        memcpy(newfs_itable.blks[blk] + NEWFS_INODE_SZ * (ino % NEWFS_INODE_PER_BLK), inode_d, sizeof(struct newfs_inode_d));
+    }
+    pthread_mutex_unlock(&newfs_itable_lock);
+}
+/**
+ * @brief 挂载时顺序扫一遍inode表，读到最后一个已分配的inode所在的块为止
+ *
+ * @return int
+ */
+int newfs_itable_warmup()
+{
+    int last = -1;
+
+    for (int ino = newfs_super.ino_max - 1; ino >= 0; ino--)
+    {
+        if (newfs_bitmap_test(&newfs_super.ino_bm, ino))
+        {
+            last = ino / NEWFS_INODE_PER_BLK;
+            break;
+        }
+    }
+    return last >= 0 ? newfs_itable_prefetch(0, last) : NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 打印inode表缓存的统计
+ */
+void newfs_itable_dump_stats()
+{
+    long total = newfs_itable.stats.hits + newfs_itable.stats.misses;
+
+    NEWFS_DBG("[itable] hits %ld, misses %ld, hit rate %.2f%%, reads %ld, blks loaded %ld\n",
+              newfs_itable.stats.hits, newfs_itable.stats.misses,
+              total == 0 ? 0.0 : 100.0 * newfs_itable.stats.hits / total,
+              newfs_itable.stats.reads, newfs_itable.stats.blks_loaded);
+}
@@ -0,0 +1,767 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * 元数据日志（只记元数据，文件数据在提交前直接写回，相当于ordered模式）。
+ * 启用日志后newfs_driver_write不再写回原位，而是把整块映像留在日志缓冲里，
+ * 读时用日志缓冲覆盖磁盘上的旧内容。一轮回写结束时把当前事务的所有块一次
+ * 顺序写入日志区：
+ *
+ * | 描述块(可能多块) | 块映像 ... | 提交块 |
+ *
+ * 已提交的块并不马上写回原位，直到日志区写满或卸载时才做检查点：按块号顺序
+ * 写回原位，再把日志头的序号推进到下一个事务，之前的事务随之作废。挂载时从
+ * 日志头记录的序号开始重放所有完整提交的事务。
+ *
+ * 已提交但未写回原位的块被释放后可能用作文件数据，为了不让重放用旧的元数据
+ * 覆盖它，释放时在下一个事务里记一条撤销，重放时跳过被同一个或之后的事务
+ * 撤销的块映像。
+ */
+static struct newfs_journal newfs_journal;
+/*
+ * 日志缓冲、撤销表和日志区的读写都在newfs_journal_mutex下进行。它是递归锁：
+ * 检查点要经newfs_driver_read_direct读写原位，读元数据的路径也要在读原位和
+ * 覆盖日志内容之间一直持有它，否则读到旧内容之后检查点恰好释放了日志缓冲，
+ * 覆盖时就找不到较新的内容了。
+ */
+static pthread_mutex_t newfs_journal_mutex;
+static pthread_once_t newfs_journal_once = PTHREAD_ONCE_INIT;
+
+#define NEWFS_JBUF_HASH(blkno) ((uint32_t)(blkno) & (NEWFS_JOURNAL_HASH - 1))
+#define NEWFS_JOURNAL_OFS(pos) (newfs_journal.offset + NEWFS_BLKS_SZ(pos))
+
+/**
+ * @brief 在csum的基础上继续计算FNV-1a校验和
+ *
+ * @param csum
+ * @param data
+ * @param len
+ * @return uint32_t
+ */
+static uint32_t newfs_journal_csum(uint32_t csum, const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++)
+    {
+        csum = (csum ^ data[i]) * 16777619u;
+    }
+    return csum;
+}
+
+static struct newfs_jbuf *newfs_jbuf_find(int blkno)
+{
+    struct newfs_jbuf *jbuf = newfs_journal.htable[NEWFS_JBUF_HASH(blkno)];
+    while (jbuf != NULL && jbuf->blkno != blkno)
+    {
+        jbuf = jbuf->hnext;
+    }
+    return jbuf;
+}
+/**
+ * @brief 为blkno新建日志缓冲，内容由调用者填写
+ *
+ * @param blkno
+ * @return struct newfs_jbuf*
+ */
+static struct newfs_jbuf *newfs_jbuf_alloc(int blkno)
+{
+    struct newfs_jbuf *jbuf = (struct newfs_jbuf *)calloc(1, sizeof(struct newfs_jbuf));
+    int bucket = NEWFS_JBUF_HASH(blkno);
+
+    if (jbuf == NULL)
+    {
+        return NULL;
+    }
+    jbuf->data = (uint8_t *)malloc(NEWFS_BLKS_SZ(1));
+    if (jbuf->data == NULL)
+    {
+        free(jbuf);
+        return NULL;
+    }
+    jbuf->blkno = blkno;
+    jbuf->hnext = newfs_journal.htable[bucket];
+    newfs_journal.htable[bucket] = jbuf;
+    jbuf->next = newfs_journal.bufs;
+    if (jbuf->next != NULL)
+    {
+        jbuf->next->pprev = &jbuf->next;
+    }
+    newfs_journal.bufs = jbuf;
+    jbuf->pprev = &newfs_journal.bufs;
+    return jbuf;
+}
+/**
+ * @brief 释放日志缓冲
+ *
+ * @param jbuf
+ */
+static void newfs_jbuf_free(struct newfs_jbuf *jbuf)
+{
+    struct newfs_jbuf **pp = &newfs_journal.htable[NEWFS_JBUF_HASH(jbuf->blkno)];
+
+    while (*pp != jbuf)
+    {
+        pp = &(*pp)->hnext;
+    }
+    *pp = jbuf->hnext;
+    *jbuf->pprev = jbuf->next;
+    if (jbuf->next != NULL)
+    {
+        jbuf->next->pprev = jbuf->pprev;
+    }
+    if (jbuf->flags & NEWFS_JBUF_RUNNING)
+    {
+        newfs_journal.running--;
+    }
+    free(jbuf->frozen);
+    free(jbuf->data);
+    free(jbuf);
+}
+/**
+ * @brief 块被重新写入当前事务，之前记下的撤销作废
+ *
+ * @param blkno
+ */
+static void newfs_journal_unrevoke(int blkno)
+{
+    for (int i = 0; i < newfs_journal.nrevoke; i++)
+    {
+        if (newfs_journal.revoked[i] == blkno)
+        {
+            newfs_journal.revoked[i] = newfs_journal.revoked[--newfs_journal.nrevoke];
+            return;
+        }
+    }
+}
+/**
+ * @brief 写日志头，记录第一个有效事务的序号
+ *
+ * @return int
+ */
+static int newfs_journal_write_sb()
+{
+    struct newfs_journal_sb_d *sb;
+    struct ddriver_iovec iov;
+    int ret;
+
+    sb = (struct newfs_journal_sb_d *)calloc(1, NEWFS_BLKS_SZ(1));
+    sb->magic = NEWFS_JOURNAL_MAGIC;
+    sb->seq = newfs_journal.seq;
+    iov.offset = NEWFS_JOURNAL_OFS(0);
+    iov.buf = (char *)sb;
+    iov.size = NEWFS_BLKS_SZ(1);
+    ret = newfs_dev_writev(&iov, 1);
+    free(sb);
+    return ret < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+}
+static int newfs_jbuf_cmp(const void *a, const void *b)
+{
+    return (*(struct newfs_jbuf **)a)->blkno - (*(struct newfs_jbuf **)b)->blkno;
+}
+/**
+ * @brief 把日志缓冲按块号顺序写回原位，然后清空日志区
+ *
+ * @param all 为1时连同未提交的修改一起写回并释放所有缓冲（事务放不进日志区
+ * 时使用）；为0时只写回已提交的内容，当前事务的缓冲保留
+ * @return int
+ */
+static int newfs_journal_write_home(int all)
+{
+    struct newfs_jbuf **home;
+    struct newfs_jbuf *jbuf, *next;
+    struct ddriver_iovec *iov;
+    int cnt = 0, i, ret = NEWFS_ERROR_NONE;
+
+    for (jbuf = newfs_journal.bufs; jbuf != NULL; jbuf = jbuf->next)
+    {
+        if (all || (jbuf->flags & NEWFS_JBUF_LOGGED))
+        {
+            cnt++;
+        }
+    }
+    home = (struct newfs_jbuf **)malloc(sizeof(struct newfs_jbuf *) * (cnt + 1));
+    iov = (struct ddriver_iovec *)malloc(sizeof(struct ddriver_iovec) * (cnt + 1));
+    cnt = 0;
+    for (jbuf = newfs_journal.bufs; jbuf != NULL; jbuf = jbuf->next)
+    {
+        if (all || (jbuf->flags & NEWFS_JBUF_LOGGED))
+        {
+            home[cnt++] = jbuf;
+        }
+    }
+    qsort(home, cnt, sizeof(struct newfs_jbuf *), newfs_jbuf_cmp);
+
+    // 原位的块可能也在块缓存里，经过缓存写才不会读到旧内容；没有缓存时合并为一次请求
+    for (i = 0; i < cnt; i++)
+    {
+        iov[i].offset = NEWFS_BLKS_SZ(home[i]->blkno);
+        iov[i].buf = (char *)(!all && home[i]->frozen != NULL ? home[i]->frozen : home[i]->data);
+        iov[i].size = NEWFS_BLKS_SZ(1);
+        if (newfs_cache_enabled() &&
+            newfs_cache_write(iov[i].offset, (uint8_t *)iov[i].buf, iov[i].size) != NEWFS_ERROR_NONE)
+        {
+            ret = -NEWFS_ERROR_IO;
+        }
+    }
+    if (newfs_cache_enabled())
+    {
+        if (newfs_cache_flush() != NEWFS_ERROR_NONE)
+        {
+            ret = -NEWFS_ERROR_IO;
+        }
+    }
+    else if (cnt > 0 && newfs_dev_writev(iov, cnt) < 0)
+    {
+        ret = -NEWFS_ERROR_IO;
+    }
+    free(iov);
+    free(home);
+    if (ret != NEWFS_ERROR_NONE)
+    {
+        return ret;
+    }
+
+    for (jbuf = newfs_journal.bufs; jbuf != NULL; jbuf = next)
+    {
+        next = jbuf->next;
+        if (all || !(jbuf->flags & NEWFS_JBUF_RUNNING))
+        {
+            newfs_jbuf_free(jbuf);
+            continue;
+        }
+        jbuf->flags &= ~NEWFS_JBUF_LOGGED;
+        free(jbuf->frozen);
+        jbuf->frozen = NULL;
+    }
+    if (all)
+    {
+        newfs_journal.nrevoke = 0;
+    }
+    newfs_journal.stats.checkpoints++;
+    newfs_journal.stats.blks_checkpointed += cnt;
+
+    // 原位都已写好，之前的事务不再需要重放
+    newfs_journal.head = 1;
+    return newfs_journal_write_sb();
+}
+/**
+ * @brief 撤销的块是否被第i个及之后的事务撤销
+ *
+ * @param txns 各事务描述块
+ * @param ntxn
+ * @param i
+ * @param blkno
+ * @return int
+ */
+static int newfs_journal_revoked_since(struct newfs_journal_desc_d **txns, int ntxn, int i, int blkno)
+{
+    for (; i < ntxn; i++)
+    {
+        for (int j = 0; j < txns[i]->nrevoke; j++)
+        {
+            if (txns[i]->tags[txns[i]->nblks + j] == blkno)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+/**
+ * @brief 重放日志：从日志头记录的序号开始，依次找出完整提交的事务，把其中
+ * 没有被撤销的块映像写回原位
+ *
+ * @return int
+ */
+static int newfs_journal_replay()
+{
+    struct newfs_journal_sb_d *sb;
+    struct newfs_journal_desc_d *desc;
+    struct newfs_journal_desc_d **txns;
+    struct newfs_journal_commit_d *commit;
+    struct ddriver_iovec iov;
+    uint8_t *log;
+    int blks = newfs_journal.blks;
+    int disk_blks = NEWFS_DISK_SZ() / NEWFS_BLKS_SZ(1);
+    int pos = 1, ntxn = 0;
+    int i, j, blkno, ret = NEWFS_ERROR_NONE;
+    uint32_t seq;
+
+    // 日志区不大，整个读进来只需要一次顺序读
+    log = (uint8_t *)malloc(NEWFS_BLKS_SZ(blks));
+    txns = (struct newfs_journal_desc_d **)malloc(sizeof(struct newfs_journal_desc_d *) * blks);
+    iov.offset = NEWFS_JOURNAL_OFS(0);
+    iov.buf = (char *)log;
+    iov.size = NEWFS_BLKS_SZ(blks);
+    if (newfs_dev_readv(&iov, 1) < 0)
+    {
+        free(txns);
+        free(log);
+        return -NEWFS_ERROR_IO;
+    }
+    sb = (struct newfs_journal_sb_d *)log;
+    seq = sb->seq;
+    if (sb->magic != NEWFS_JOURNAL_MAGIC)
+    {
+        // 日志头无效说明检查点写日志头时中断，此时原位已经写好，不重放；
+        // 新的序号要大于日志区里残留的所有事务，它们以后也不能被重放
+        seq = 1;
+        for (pos = 1; pos < blks; pos++)
+        {
+            desc = (struct newfs_journal_desc_d *)(log + NEWFS_BLKS_SZ(pos));
+            if (desc->magic == NEWFS_JOURNAL_MAGIC && desc->type == NEWFS_JOURNAL_DESC && desc->seq >= seq)
+            {
+                seq = desc->seq + 1;
+            }
+        }
+        pos = 1;
+    }
+
+    while (sb->magic == NEWFS_JOURNAL_MAGIC && pos < blks)
+    {
+        desc = (struct newfs_journal_desc_d *)(log + NEWFS_BLKS_SZ(pos));
+        if (desc->magic != NEWFS_JOURNAL_MAGIC || desc->type != NEWFS_JOURNAL_DESC || desc->seq != seq ||
+            desc->ndesc <= 0 || desc->nblks < 0 || desc->nrevoke < 0 ||
+            pos + desc->ndesc + desc->nblks + 1 > blks ||
+            sizeof(struct newfs_journal_desc_d) + sizeof(int) * (desc->nblks + desc->nrevoke) > NEWFS_BLKS_SZ(desc->ndesc))
+        {
+            break;
+        }
+        commit = (struct newfs_journal_commit_d *)(log + NEWFS_BLKS_SZ(pos + desc->ndesc + desc->nblks));
+        if (commit->magic != NEWFS_JOURNAL_MAGIC || commit->type != NEWFS_JOURNAL_COMMIT || commit->seq != seq ||
+            commit->checksum != newfs_journal_csum(2166136261u, (uint8_t *)desc, NEWFS_BLKS_SZ(desc->ndesc + desc->nblks)))
+        {
+            break; // 提交块没有写完整，这个事务和之后的都不算数
+        }
+        txns[ntxn++] = desc;
+        pos += desc->ndesc + desc->nblks + 1;
+        seq++;
+    }
+
+    for (i = 0; i < ntxn && ret == NEWFS_ERROR_NONE; i++)
+    {
+        desc = txns[i];
+        for (j = 0; j < desc->nblks; j++)
+        {
+            blkno = desc->tags[j];
+            if (blkno <= 0 || blkno >= disk_blks || newfs_journal_revoked_since(txns, ntxn, i, blkno))
+            {
+                continue;
+            }
+            if (newfs_driver_write_direct(NEWFS_BLKS_SZ(blkno), (uint8_t *)desc + NEWFS_BLKS_SZ(desc->ndesc + j),
+                                          NEWFS_BLKS_SZ(1)) != NEWFS_ERROR_NONE)
+            {
+                ret = -NEWFS_ERROR_IO;
+                break;
+            }
+            newfs_journal.stats.replayed_blks++;
+        }
+        newfs_journal.stats.replayed_txns++;
+    }
+    free(txns);
+    free(log);
+    if (ret != NEWFS_ERROR_NONE || newfs_cache_flush() != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    if (ntxn > 0)
+    {
+        NEWFS_DBG("[%s] replayed %d transactions\n", __func__, ntxn);
+    }
+    newfs_journal.seq = seq;
+    newfs_journal.head = 1;
+    return newfs_journal_write_sb();
+}
+static void newfs_journal_mutex_init()
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&newfs_journal_mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+/**
+ * @brief 持有日志锁，期间日志缓冲不会被提交或检查点改变
+ */
+void newfs_journal_lock()
+{
+    // 挂载时读超级块就会用到，早于newfs_journal_init
+    pthread_once(&newfs_journal_once, newfs_journal_mutex_init);
+    pthread_mutex_lock(&newfs_journal_mutex);
+}
+/**
+ * @brief 释放newfs_journal_lock持有的日志锁
+ */
+void newfs_journal_unlock()
+{
+    pthread_mutex_unlock(&newfs_journal_mutex);
+}
+/**
+ * @brief 初始化日志，格式化时写空的日志头，否则先重放日志
+ *
+ * @param offset 日志区在磁盘上的偏移
+ * @param blks 日志区块数，0表示不使用日志
+ * @param format
+ * @return int
+ */
+int newfs_journal_init(int offset, int blks, int format)
+{
+    memset(&newfs_journal, 0, sizeof(struct newfs_journal));
+    if (blks <= 1)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    newfs_journal.offset = offset;
+    newfs_journal.blks = blks;
+    newfs_journal.head = 1;
+    newfs_journal.seq = 1;
+
+    if (format)
+    {
+        if (newfs_journal_write_sb() != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    else if (newfs_journal_replay() != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_journal.htable = (struct newfs_jbuf **)calloc(NEWFS_JOURNAL_HASH, sizeof(struct newfs_jbuf *));
+    if (newfs_journal.htable == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 释放日志的内存，调用前应先newfs_journal_checkpoint
+ */
+void newfs_journal_destroy()
+{
+    if (newfs_journal.htable != NULL)
+    {
+        while (newfs_journal.bufs != NULL)
+        {
+            newfs_jbuf_free(newfs_journal.bufs);
+        }
+    }
+    free(newfs_journal.htable);
+    free(newfs_journal.revoked);
+    memset(&newfs_journal, 0, sizeof(struct newfs_journal));
+}
+/**
+ * @brief 是否启用了日志
+ *
+ * @return int
+ */
+int newfs_journal_enabled()
+{
+    return newfs_journal.htable != NULL;
+}
+/**
+ * @brief 把[offset, offset + size)逐块写入日志缓冲，调用者持有日志锁
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+static int newfs_journal_write_blks(int offset, uint8_t *in_content, int size)
+{
+    struct newfs_jbuf *jbuf;
+    int blkno, bias, len;
+
+    while (size > 0)
+    {
+        blkno = offset / NEWFS_BLKS_SZ(1);
+        bias = offset - NEWFS_BLKS_SZ(blkno);
+        len = NEWFS_BLKS_SZ(1) - bias < size ? NEWFS_BLKS_SZ(1) - bias : size;
+        jbuf = newfs_jbuf_find(blkno);
+        if (jbuf == NULL)
+        {
+            jbuf = newfs_jbuf_alloc(blkno);
+            if (jbuf == NULL)
+            {
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            // 只写一部分时先读出原来的内容
+            if (len < NEWFS_BLKS_SZ(1) &&
+                newfs_driver_read_direct(NEWFS_BLKS_SZ(blkno), jbuf->data, NEWFS_BLKS_SZ(1)) != NEWFS_ERROR_NONE)
+            {
+                newfs_jbuf_free(jbuf);
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        if ((jbuf->flags & NEWFS_JBUF_LOGGED) && !(jbuf->flags & NEWFS_JBUF_RUNNING))
+        {
+            // 已提交的内容还没写回原位，检查点要用它，不能被未提交的修改覆盖
+            jbuf->frozen = (uint8_t *)malloc(NEWFS_BLKS_SZ(1));
+            if (jbuf->frozen == NULL)
+            {
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            memcpy(jbuf->frozen, jbuf->data, NEWFS_BLKS_SZ(1));
+        }
+        if (!(jbuf->flags & NEWFS_JBUF_RUNNING))
+        {
+            jbuf->flags |= NEWFS_JBUF_RUNNING;
+            newfs_journal.running++;
+            newfs_journal_unrevoke(blkno);
+        }
+        memcpy(jbuf->data + bias, in_content, len);
+        in_content += len;
+        offset += len;
+        size -= len;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 把元数据写入当前事务，不写回原位
+ *
+ * @param offset 磁盘偏移，不要求对齐
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_journal_write(int offset, uint8_t *in_content, int size)
+{
+    int ret;
+
+    newfs_journal_lock();
+    ret = newfs_journal_write_blks(offset, in_content, size);
+    newfs_journal_unlock();
+    return ret;
+}
+/**
+ * @brief 用日志缓冲中较新的内容覆盖从磁盘读出的[offset, offset + size)
+ *
+ * @param offset 磁盘偏移，不要求对齐
+ * @param out_content
+ * @param size
+ */
+void newfs_journal_overlay(int offset, uint8_t *out_content, int size)
+{
+    struct newfs_jbuf *jbuf;
+    int blkno, bias, len;
+
+    if (!newfs_journal_enabled())
+    {
+        return;
+    }
+    newfs_journal_lock();
+    while (newfs_journal.bufs != NULL && size > 0)
+    {
+        blkno = offset / NEWFS_BLKS_SZ(1);
+        bias = offset - NEWFS_BLKS_SZ(blkno);
+        len = NEWFS_BLKS_SZ(1) - bias < size ? NEWFS_BLKS_SZ(1) - bias : size;
+        jbuf = newfs_jbuf_find(blkno);
+        if (jbuf != NULL)
+        {
+            memcpy(out_content, jbuf->data + bias, len);
+        }
+        out_content += len;
+        offset += len;
+        size -= len;
+    }
+    newfs_journal_unlock();
+}
+/**
+ * @brief 块被释放，丢弃它的日志缓冲。已提交的块还要在当前事务中记一条撤销，
+ * 防止重放时旧的元数据覆盖该块之后的新内容
+ *
+ * @param blkno 磁盘上的逻辑块号
+ */
+void newfs_journal_revoke(int blkno)
+{
+    struct newfs_jbuf *jbuf;
+    int *revoked;
+    int cap;
+
+    if (!newfs_journal_enabled())
+    {
+        return;
+    }
+    newfs_journal_lock();
+    if ((jbuf = newfs_jbuf_find(blkno)) == NULL)
+    {
+        newfs_journal_unlock();
+        return; // 不在日志里的块（比如文件数据）不需要撤销
+    }
+    if (jbuf->flags & NEWFS_JBUF_LOGGED)
+    {
+        if (newfs_journal.nrevoke == newfs_journal.revoke_cap)
+        {
+            cap = newfs_journal.revoke_cap > 0 ? newfs_journal.revoke_cap * 2 : 16;
+            revoked = (int *)realloc(newfs_journal.revoked, sizeof(int) * cap);
+            if (revoked == NULL)
+            {
+                newfs_journal_unlock();
+                return; // 留着缓冲，检查点会把旧内容写回，但不会丢失元数据
+            }
+            newfs_journal.revoked = revoked;
+            newfs_journal.revoke_cap = cap;
+        }
+        newfs_journal.revoked[newfs_journal.nrevoke++] = blkno;
+        newfs_journal.stats.revokes++;
+    }
+    newfs_jbuf_free(jbuf);
+    newfs_journal_unlock();
+}
+/**
+ * @brief 提交当前事务：描述块、所有块映像和提交块在日志区首尾相接，只发一次
+ * 设备请求。日志区剩余空间不够时先做检查点。调用者持有日志锁
+ *
+ * @return int
+ */
+static int newfs_journal_commit_txn()
+{
+    struct newfs_journal_desc_d *desc;
+    struct newfs_journal_commit_d *commit;
+    struct ddriver_iovec *iov;
+    struct newfs_jbuf *jbuf;
+    int nblks = newfs_journal.running;
+    int ndesc, need, i, ret;
+    uint32_t csum;
+
+    if (!newfs_journal_enabled() || (nblks == 0 && newfs_journal.nrevoke == 0))
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    ndesc = NEWFS_ROUND_UP((int)(sizeof(struct newfs_journal_desc_d) + sizeof(int) * (nblks + newfs_journal.nrevoke)),
+                           NEWFS_BLKS_SZ(1)) / NEWFS_BLKS_SZ(1);
+    need = ndesc + nblks + 1;
+    if (need > newfs_journal.blks - 1)
+    {
+        // 整个日志区都放不下，只能直接写回原位，这一轮失去原子性
+        NEWFS_DBG("[%s] transaction of %d blocks overflows the journal\n", __func__, nblks);
+        newfs_journal.stats.overflows++;
+        return newfs_journal_write_home(1);
+    }
+    if (newfs_journal.head + need > newfs_journal.blks && newfs_journal_write_home(0) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+
+    desc = (struct newfs_journal_desc_d *)calloc(ndesc, NEWFS_BLKS_SZ(1));
+    commit = (struct newfs_journal_commit_d *)calloc(1, NEWFS_BLKS_SZ(1));
+    iov = (struct ddriver_iovec *)malloc(sizeof(struct ddriver_iovec) * (nblks + 2));
+    desc->magic = NEWFS_JOURNAL_MAGIC;
+    desc->type = NEWFS_JOURNAL_DESC;
+    desc->seq = newfs_journal.seq;
+    desc->ndesc = ndesc;
+    desc->nblks = nblks;
+    desc->nrevoke = newfs_journal.nrevoke;
+    iov[0].offset = NEWFS_JOURNAL_OFS(newfs_journal.head);
+    iov[0].buf = (char *)desc;
+    iov[0].size = NEWFS_BLKS_SZ(ndesc);
+    i = 0;
+    for (jbuf = newfs_journal.bufs; jbuf != NULL; jbuf = jbuf->next)
+    {
+        if (!(jbuf->flags & NEWFS_JBUF_RUNNING))
+        {
+            continue;
+        }
+        desc->tags[i] = jbuf->blkno;
+        iov[i + 1].offset = NEWFS_JOURNAL_OFS(newfs_journal.head + ndesc + i);
+        iov[i + 1].buf = (char *)jbuf->data;
+        iov[i + 1].size = NEWFS_BLKS_SZ(1);
+        i++;
+    }
+    memcpy(desc->tags + nblks, newfs_journal.revoked, sizeof(int) * newfs_journal.nrevoke);
+
+    csum = newfs_journal_csum(2166136261u, (uint8_t *)desc, NEWFS_BLKS_SZ(ndesc));
+    for (i = 0; i < nblks; i++)
+    {
+        csum = newfs_journal_csum(csum, (uint8_t *)iov[i + 1].buf, NEWFS_BLKS_SZ(1));
+    }
+    commit->magic = NEWFS_JOURNAL_MAGIC;
+    commit->type = NEWFS_JOURNAL_COMMIT;
+    commit->seq = newfs_journal.seq;
+    commit->checksum = csum;
+    iov[nblks + 1].offset = NEWFS_JOURNAL_OFS(newfs_journal.head + ndesc + nblks);
+    iov[nblks + 1].buf = (char *)commit;
+    iov[nblks + 1].size = NEWFS_BLKS_SZ(1);
+
+    // 各段在日志区首尾相接，磁头只需要移动一次
+    ret = newfs_dev_writev(iov, nblks + 2);
+    free(iov);
+    free(commit);
+    free(desc);
+    if (ret < 0)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+
+    for (jbuf = newfs_journal.bufs; jbuf != NULL; jbuf = jbuf->next)
+    {
+        if (jbuf->flags & NEWFS_JBUF_RUNNING)
+        {
+            jbuf->flags = NEWFS_JBUF_LOGGED;
+            free(jbuf->frozen);
+            jbuf->frozen = NULL;
+        }
+    }
+    newfs_journal.running = 0;
+    newfs_journal.nrevoke = 0;
+    newfs_journal.head += need;
+    newfs_journal.seq++;
+    newfs_journal.stats.commits++;
+    newfs_journal.stats.blks_logged += nblks;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 提交当前事务
+ *
+ * @return int
+ */
+int newfs_journal_commit()
+{
+    int ret;
+
+    newfs_journal_lock();
+    ret = newfs_journal_commit_txn();
+    newfs_journal_unlock();
+    return ret;
+}
+/**
+ * @brief 提交当前事务，再把所有已提交的块写回原位、清空日志区
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint()
+{
+    int ret = NEWFS_ERROR_NONE;
+
+    if (!newfs_journal_enabled())
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    newfs_journal_lock();
+    if (newfs_journal_commit_txn() != NEWFS_ERROR_NONE)
+    {
+        ret = -NEWFS_ERROR_IO;
+    }
+    else if (newfs_journal.bufs != NULL || newfs_journal.head != 1)
+    {
+        ret = newfs_journal_write_home(0);
+    }
+    newfs_journal_unlock();
+    return ret;
+}
+/**
+ * @brief 打印日志统计
+ */
+void newfs_journal_dump_stats()
+{
+    struct newfs_journal_stats *stats = &newfs_journal.stats;
+
+    if (newfs_journal.blks <= 1)
+    {
+        return;
+    }
+    NEWFS_DBG("[journal] blks %d, commits %ld, blks logged %ld, checkpoints %ld (%ld blks), revokes %ld, overflows %ld, replayed %ld txns (%ld blks)\n",
+              newfs_journal.blks, stats->commits, stats->blks_logged, stats->checkpoints, stats->blks_checkpointed,
+              stats->revokes, stats->overflows, stats->replayed_txns, stats->replayed_blks);
+}
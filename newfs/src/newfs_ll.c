@@ -0,0 +1,570 @@
+#include "newfs.h"
+
+/*
+ * FUSE低层接口。内核按节点号而不是路径调用，节点号就是ino加一（FUSE的根
+ * 是1），按ino在inode缓存的哈希表里直接找到inode，不用每次从根逐级解析
+ * 路径，也不经过路径缓存。
+ *
+ * lookup、mknod、mkdir回复目录项时inode的nlookup加一，forget时减去内核给出
+ * 的数目。nlookup非0的inode不会被换出，内核手里的节点号总能在内存中找到。
+ * 被删除的inode还有打开的句柄或内核的引用时标记为orphan，ino不释放，
+ * 按节点号仍能找到，到最后一个句柄关闭、内核forget掉全部引用时才释放，
+ * 所以内核手里的节点号不会指到后来新建的文件上。
+ *
+ * 具体的创建、删除、读写与路径接口共用newfs.c中的newfs_do_*，加锁方式也
+ * 相同：每个请求按种类用newfs_op_begin/newfs_op_end包住。
+ */
+extern struct custom_options options;   // 全局选项
+extern struct newfs_super newfs_super; // 内存超级块
+static struct fuse_session *newfs_ll_se;
+
+/**
+ * @brief readdir填充回复的缓冲
+ */
+struct newfs_ll_dirbuf {
+    fuse_req_t req;
+    char *buf;
+    size_t size;
+    size_t used;
+};
+
+/**
+ * @brief 按节点号找内存中的inode
+ *
+ * @param nodeid
+ * @return struct newfs_inode* 不在内存中（已被删除）返回NULL
+ */
+static struct newfs_inode *newfs_ll_inode(fuse_ino_t nodeid)
+{
+    struct newfs_inode *inode = newfs_icache_find(NEWFS_LL_INO(nodeid));
+
+    if (inode != NULL)
+    {
+        newfs_icache_touch(inode);
+    }
+    return inode;
+}
+/**
+ * @brief 在目录parent下按名字找dentry，读入它的inode
+ *
+ * @param parent 节点号
+ * @param name
+ * @param dentry 输出
+ * @return int 0成功，否则失败
+ */
+static int newfs_ll_child(fuse_ino_t parent, const char *name, struct newfs_dentry **dentry)
+{
+    struct newfs_inode *dir = newfs_ll_inode(parent);
+
+    if (dir == NULL)
+    {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    if (!NEWFS_IS_DIR(dir))
+    {
+        return -NEWFS_ERROR_NOTDIR;
+    }
+    *dentry = newfs_dir_index_find(dir, name, strlen(name));
+    if (*dentry == NULL)
+    {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    if (newfs_load_inode(*dentry) == NULL)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_icache_touch((*dentry)->inode);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 打开时存下的句柄，读写不用再按节点号找inode
+ *
+ * @param ino
+ * @param fi
+ * @param inode 输出
+ * @return struct newfs_fh* 没有句柄时为NULL
+ */
+static struct newfs_fh *newfs_ll_fh(fuse_ino_t ino, struct fuse_file_info *fi, struct newfs_inode **inode)
+{
+    struct newfs_fh *fh = fi != NULL ? (struct newfs_fh *)(uintptr_t)fi->fh : NULL;
+
+    *inode = fh != NULL ? fh->inode : newfs_ll_inode(ino);
+    return fh;
+}
+/**
+ * @brief 按inode填充属性
+ *
+ * @param inode
+ * @param st
+ */
+static void newfs_ll_stat(struct newfs_inode *inode, struct stat *st)
+{
+    struct newfs_attr attr;
+
+    newfs_inode_attr(inode, &attr);
+    newfs_dentry_stat(inode->dentry, &attr, st);
+    if (inode->orphan)
+    {
+        st->st_nlink = 0; // 已从目录中删除
+    }
+}
+/**
+ * @brief 填充要回复的目录项，内核因此多持有一次inode的引用
+ *
+ * @param dentry inode已读入
+ * @param e 输出
+ */
+static void newfs_ll_entry(struct newfs_dentry *dentry, struct fuse_entry_param *e)
+{
+    struct newfs_inode *inode = dentry->inode;
+
+    memset(e, 0, sizeof(struct fuse_entry_param));
+    e->ino = NEWFS_LL_NODEID(inode->ino);
+    e->generation = inode->generation;
+    e->attr_timeout = options.attr_timeout;
+    e->entry_timeout = options.entry_timeout;
+    newfs_ll_stat(inode, &e->attr);
+    __atomic_add_fetch(&inode->nlookup, 1, __ATOMIC_RELAXED);
+}
+/**
+ * @brief 挂载文件系统
+ *
+ * @param userdata
+ * @param conn
+ */
+static void newfs_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    if (newfs_mount(options) != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] mount error\n", __func__);
+        fuse_session_exit(newfs_ll_se);
+    }
+}
+/**
+ * @brief 卸载文件系统
+ *
+ * @param userdata
+ */
+static void newfs_ll_destroy(void *userdata)
+{
+    if (newfs_umount() != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] unmount error\n", __func__);
+    }
+}
+static void newfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    struct newfs_dentry *dentry;
+    struct fuse_entry_param e;
+    int ret;
+
+    newfs_op_begin(NEWFS_OP_READ);
+    ret = newfs_ll_child(parent, name, &dentry);
+    if (ret == NEWFS_ERROR_NONE)
+    {
+        newfs_ll_entry(dentry, &e);
+    }
+    newfs_op_end(NEWFS_OP_READ);
+    if (ret != NEWFS_ERROR_NONE)
+    {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    fuse_reply_entry(req, &e);
+}
+static void newfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    struct newfs_inode *inode;
+    struct newfs_dentry *dentry;
+    int orphan = 0;
+
+    newfs_op_begin(NEWFS_OP_READ);
+    inode = newfs_icache_find(NEWFS_LL_INO(ino));
+    if (inode != NULL && inode->dentry != newfs_super.root_dentry)
+    {
+        // orphan只在独占tree_lock时置上，置上之后forget都走下面独占的路径
+        orphan = inode->orphan;
+        if (!orphan)
+        {
+            __atomic_sub_fetch(&inode->nlookup, (long)nlookup, __ATOMIC_RELAXED);
+        }
+    }
+    newfs_op_end(NEWFS_OP_READ);
+    // 这次的引用还没减掉，inode不会在两次加锁之间被释放
+    if (orphan)
+    {
+        newfs_op_begin(NEWFS_OP_NAMESPACE);
+        if (__atomic_sub_fetch(&inode->nlookup, (long)nlookup, __ATOMIC_RELAXED) == 0 &&
+            __atomic_load_n(&inode->nopen, __ATOMIC_RELAXED) == 0)
+        {
+            dentry = inode->dentry;
+            newfs_drop_inode(inode);
+            newfs_dentry_free(dentry);
+        }
+        newfs_op_end(NEWFS_OP_NAMESPACE);
+    }
+    fuse_reply_none(req);
+}
+static void newfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct newfs_inode *inode;
+    struct stat st;
+
+    newfs_op_begin(NEWFS_OP_READ);
+    inode = newfs_ll_inode(ino);
+    if (inode != NULL)
+    {
+        newfs_ll_stat(inode, &st);
+    }
+    newfs_op_end(NEWFS_OP_READ);
+    if (inode == NULL)
+    {
+        fuse_reply_err(req, NEWFS_ERROR_NOTFOUND);
+        return;
+    }
+    fuse_reply_attr(req, &st, options.attr_timeout);
+}
+static void newfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                             int to_set, struct fuse_file_info *fi)
+{
+    struct newfs_inode *inode;
+    struct timespec tv[2];
+    struct stat st;
+    int ret = NEWFS_ERROR_NONE;
+
+    newfs_op_begin(NEWFS_OP_MODIFY);
+    newfs_ll_fh(ino, fi, &inode);
+    if (inode == NULL)
+    {
+        ret = -NEWFS_ERROR_NOTFOUND;
+    }
+    else if (to_set & FUSE_SET_ATTR_SIZE)
+    {
+        ret = newfs_do_truncate(inode, attr->st_size);
+    }
+    if (ret == NEWFS_ERROR_NONE && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)))
+    {
+        tv[0].tv_sec = attr->st_atime;
+        tv[0].tv_nsec = !(to_set & FUSE_SET_ATTR_ATIME) ? UTIME_OMIT :
+                        (to_set & FUSE_SET_ATTR_ATIME_NOW) ? UTIME_NOW : 0;
+        tv[1].tv_sec = attr->st_mtime;
+        tv[1].tv_nsec = !(to_set & FUSE_SET_ATTR_MTIME) ? UTIME_OMIT :
+                        (to_set & FUSE_SET_ATTR_MTIME_NOW) ? UTIME_NOW : 0;
+        ret = newfs_do_utimens(inode, tv);
+    }
+    if (ret == NEWFS_ERROR_NONE)
+    {
+        newfs_ll_stat(inode, &st);
+    }
+    newfs_op_end(NEWFS_OP_MODIFY);
+    if (ret != NEWFS_ERROR_NONE)
+    {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    fuse_reply_attr(req, &st, options.attr_timeout);
+}
+/**
+ * @brief mknod和mkdir共用
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param ftype
+ */
+static void newfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, NEW_FILE_TYPE ftype)
+{
+    struct newfs_inode *dir;
+    struct newfs_dentry *dentry;
+    struct fuse_entry_param e;
+    int ret;
+
+    newfs_op_begin(NEWFS_OP_NAMESPACE);
+    dir = newfs_ll_inode(parent);
+    ret = dir == NULL ? -NEWFS_ERROR_NOTFOUND : newfs_do_create(dir->dentry, name, ftype, &dentry);
+    if (ret == NEWFS_ERROR_NONE)
+    {
+        newfs_ll_entry(dentry, &e);
+    }
+    newfs_op_end(NEWFS_OP_NAMESPACE);
+    if (ret != NEWFS_ERROR_NONE)
+    {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    fuse_reply_entry(req, &e);
+}
+static void newfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+                           mode_t mode, dev_t rdev)
+{
+    newfs_ll_create(req, parent, name, S_ISDIR(mode) ? NEWFS_DIR : NEWFS_REG_FILE);
+}
+static void newfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+    newfs_ll_create(req, parent, name, NEWFS_DIR);
+}
+/**
+ * @brief unlink和rmdir共用
+ *
+ * @param req
+ * @param parent
+ * @param name
+ * @param is_dir 是否rmdir
+ */
+static void newfs_ll_remove(fuse_req_t req, fuse_ino_t parent, const char *name, int is_dir)
+{
+    struct newfs_dentry *dentry;
+    int ret;
+
+    newfs_op_begin(NEWFS_OP_NAMESPACE);
+    ret = newfs_ll_child(parent, name, &dentry);
+    if (ret == NEWFS_ERROR_NONE)
+    {
+        if (is_dir && !NEWFS_IS_DIR(dentry->inode))
+        {
+            ret = -NEWFS_ERROR_NOTDIR;
+        }
+        else if (!is_dir && NEWFS_IS_DIR(dentry->inode))
+        {
+            ret = -NEWFS_ERROR_ISDIR;
+        }
+        else if (is_dir && dentry->inode->dir_cnt > 0)
+        {
+            ret = -NEWFS_ERROR_NOTEMPTY;
+        }
+        else
+        {
+            ret = newfs_do_remove(dentry);
+        }
+    }
+    newfs_op_end(NEWFS_OP_NAMESPACE);
+    fuse_reply_err(req, -ret);
+}
+static void newfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    newfs_ll_remove(req, parent, name, 0);
+}
+static void newfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    newfs_ll_remove(req, parent, name, 1);
+}
+static void newfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                            fuse_ino_t newparent, const char *newname)
+{
+    struct newfs_dentry *dentry;
+    struct newfs_inode *to_dir;
+    int ret;
+
+    newfs_op_begin(NEWFS_OP_NAMESPACE);
+    ret = newfs_ll_child(parent, name, &dentry);
+    if (ret == NEWFS_ERROR_NONE)
+    {
+        to_dir = newfs_ll_inode(newparent);
+        ret = to_dir == NULL ? -NEWFS_ERROR_NOTFOUND : newfs_do_rename(dentry, to_dir->dentry, newname);
+    }
+    newfs_op_end(NEWFS_OP_NAMESPACE);
+    fuse_reply_err(req, -ret);
+}
+/**
+ * @brief open和opendir共用，新建句柄保存在fi->fh中
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct newfs_inode *inode;
+    struct newfs_fh *fh = NULL;
+
+    newfs_op_begin(NEWFS_OP_READ);
+    inode = newfs_ll_inode(ino);
+    if (inode != NULL)
+    {
+        fh = newfs_fh_open(inode);
+    }
+    newfs_op_end(NEWFS_OP_READ);
+    if (fh == NULL)
+    {
+        fuse_reply_err(req, inode == NULL ? NEWFS_ERROR_NOTFOUND : NEWFS_ERROR_NOSPACE);
+        return;
+    }
+    fi->fh = (uint64_t)(uintptr_t)fh;
+    fi->keep_cache = options.kernel_cache;
+    // 请求已被打断时内核不会再发release
+    if (fuse_reply_open(req, fi) == -ENOENT)
+    {
+        newfs_fh_release(fh);
+    }
+}
+/**
+ * @brief release和releasedir共用
+ *
+ * @param req
+ * @param ino
+ * @param fi
+ */
+static void newfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    if (fi->fh != 0)
+    {
+        newfs_fh_release((struct newfs_fh *)(uintptr_t)fi->fh);
+    }
+    fuse_reply_err(req, 0);
+}
+static void newfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                          struct fuse_file_info *fi)
+{
+    struct newfs_inode *inode;
+    struct newfs_fh *fh;
+    char *buf = (char *)malloc(size);
+    int ret;
+
+    if (buf == NULL)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    newfs_op_begin(NEWFS_OP_READ);
+    fh = newfs_ll_fh(ino, fi, &inode);
+    ret = inode == NULL ? -NEWFS_ERROR_NOTFOUND : newfs_do_read(inode, fh, buf, size, off);
+    newfs_op_end(NEWFS_OP_READ);
+    if (ret < 0)
+    {
+        fuse_reply_err(req, -ret);
+    }
+    else
+    {
+        fuse_reply_buf(req, buf, ret);
+    }
+    free(buf);
+}
+static void newfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                           off_t off, struct fuse_file_info *fi)
+{
+    struct newfs_inode *inode;
+    struct newfs_fh *fh;
+    int ret;
+
+    newfs_op_begin(NEWFS_OP_MODIFY);
+    fh = newfs_ll_fh(ino, fi, &inode);
+    ret = inode == NULL ? -NEWFS_ERROR_NOTFOUND : newfs_do_write(inode, fh, buf, size, off);
+    newfs_op_end(NEWFS_OP_MODIFY);
+    if (ret < 0)
+    {
+        fuse_reply_err(req, -ret);
+    }
+    else
+    {
+        fuse_reply_write(req, ret);
+    }
+}
+/**
+ * @brief newfs_do_readdir的filler，目录项依次编码进回复缓冲
+ *
+ * @return int 1表示缓冲已满
+ */
+static int newfs_ll_fill(void *buf, const char *name, const struct stat *st, off_t off)
+{
+    struct newfs_ll_dirbuf *db = (struct newfs_ll_dirbuf *)buf;
+    size_t len = fuse_add_direntry(db->req, db->buf + db->used, db->size - db->used, name, st, off);
+
+    if (len > db->size - db->used)
+    {
+        return 1;
+    }
+    db->used += len;
+    return 0;
+}
+static void newfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                             struct fuse_file_info *fi)
+{
+    struct newfs_ll_dirbuf db;
+    struct newfs_inode *inode;
+    int ret;
+
+    db.req = req;
+    db.buf = (char *)malloc(size);
+    db.size = size;
+    db.used = 0;
+    if (db.buf == NULL)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    newfs_op_begin(NEWFS_OP_READ);
+    newfs_ll_fh(ino, fi, &inode);
+    ret = inode == NULL ? -NEWFS_ERROR_NOTFOUND : newfs_do_readdir(inode, &db, newfs_ll_fill, off);
+    newfs_op_end(NEWFS_OP_READ);
+    if (ret != NEWFS_ERROR_NONE)
+    {
+        fuse_reply_err(req, -ret);
+    }
+    else
+    {
+        fuse_reply_buf(req, db.buf, db.used);
+    }
+    free(db.buf);
+}
+
+static struct fuse_lowlevel_ops newfs_ll_ops = {
+    .init = newfs_ll_init,
+    .destroy = newfs_ll_destroy,
+    .lookup = newfs_ll_lookup,
+    .forget = newfs_ll_forget,
+    .getattr = newfs_ll_getattr,
+    .setattr = newfs_ll_setattr,
+    .mknod = newfs_ll_mknod,
+    .mkdir = newfs_ll_mkdir,
+    .unlink = newfs_ll_unlink,
+    .rmdir = newfs_ll_rmdir,
+    .rename = newfs_ll_rename,
+    .open = newfs_ll_open,
+    .read = newfs_ll_read,
+    .write = newfs_ll_write,
+    .release = newfs_ll_release,
+    .opendir = newfs_ll_open,
+    .readdir = newfs_ll_readdir,
+    .releasedir = newfs_ll_release,
+};
+
+/**
+ * @brief 以低层接口挂载并处理请求，直到卸载
+ *
+ * @param args 已经去掉newfs自己的选项
+ * @return int 0成功，否则失败
+ */
+int newfs_ll_main(struct fuse_args *args)
+{
+    struct fuse_chan *ch;
+    char *mountpoint = NULL;
+    int multithreaded, foreground;
+    int ret = -1;
+
+    if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1)
+    {
+        return 1;
+    }
+    ch = fuse_mount(mountpoint, args);
+    if (ch != NULL)
+    {
+        newfs_ll_se = fuse_lowlevel_new(args, &newfs_ll_ops, sizeof(newfs_ll_ops), NULL);
+        if (newfs_ll_se != NULL)
+        {
+            if (fuse_set_signal_handlers(newfs_ll_se) != -1)
+            {
+                fuse_session_add_chan(newfs_ll_se, ch);
+                if (fuse_daemonize(foreground) != -1)
+                {
+                    ret = multithreaded ? fuse_session_loop_mt(newfs_ll_se) : fuse_session_loop(newfs_ll_se);
+                }
+                fuse_remove_signal_handlers(newfs_ll_se);
+                fuse_session_remove_chan(ch);
+            }
+            fuse_session_destroy(newfs_ll_se);
+        }
+        fuse_unmount(mountpoint, ch);
+    }
+    free(mountpoint);
+    return ret == 0 ? 0 : 1;
+}
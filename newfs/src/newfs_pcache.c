@@ -0,0 +1,203 @@
+#include "newfs.h"
+
+/*
+ * 完整路径到dentry的缓存，直接映射：每条路径按哈希落到唯一的槽里，冲突时
+ * 新的覆盖旧的，大小固定。只缓存查找成功的路径，dentry被删除或改名前必须
+ * 作废引用它的槽，否则会拿到已释放的dentry。路径存放在槽内的定长数组里，
+ * 查找和插入都不分配内存。
+ *
+ * 查找不加锁：修改槽前后各把槽的seq加一，查找比较前后的seq，不一致时当作
+ * 未命中。槽作废在dentry延迟释放之前，查找拿到的dentry在epoch中可以访问。
+ */
+static struct newfs_pcache_slot newfs_pcache[NEWFS_PCACHE_SLOTS];
+static struct newfs_pcache_stats newfs_pcache_stats;
+// 插入和作废之间互斥
+static pthread_mutex_t newfs_pcache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define NEWFS_PCACHE_SLOT(hash) (&newfs_pcache[(hash) & (NEWFS_PCACHE_SLOTS - 1)])
+
+/**
+ * @brief 开始修改槽，seq变为奇数
+ *
+ * @param slot
+ */
+static inline void newfs_pcache_write_begin(struct newfs_pcache_slot *slot)
+{
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+/**
+ * @brief 修改结束，seq回到偶数
+ *
+ * @param slot
+ */
+static inline void newfs_pcache_write_end(struct newfs_pcache_slot *slot)
+{
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+/**
+ * @brief 清空一个槽
+ *
+ * @param slot
+ */
+static inline void newfs_pcache_clear(struct newfs_pcache_slot *slot)
+{
+    newfs_pcache_write_begin(slot);
+    slot->len = 0;
+    slot->dentry = NULL;
+    newfs_pcache_write_end(slot);
+}
+/**
+ * @brief 初始化路径缓存
+ */
+void newfs_pcache_init()
+{
+    memset(newfs_pcache, 0, sizeof(newfs_pcache));
+    memset(&newfs_pcache_stats, 0, sizeof(newfs_pcache_stats));
+}
+/**
+ * @brief 释放路径缓存
+ */
+void newfs_pcache_destroy()
+{
+    for (int i = 0; i < NEWFS_PCACHE_SLOTS; i++)
+    {
+        newfs_pcache_clear(&newfs_pcache[i]);
+    }
+}
+/**
+ * @brief 槽中是否正好是path
+ *
+ * @param slot
+ * @param path
+ * @param len
+ * @param hash
+ * @return int
+ */
+static inline int newfs_pcache_match(struct newfs_pcache_slot *slot, const char *path, int len, uint32_t hash)
+{
+    return slot->len == len && slot->hash == hash && memcmp(slot->path, path, len) == 0;
+}
+/**
+ * @brief 按完整路径查找，不加锁
+ *
+ * @param path
+ * @param len 路径长度
+ * @return struct newfs_dentry* 未命中返回NULL
+ */
+struct newfs_dentry *newfs_pcache_find(const char *path, int len)
+{
+    uint32_t hash = newfs_name_hash(path, len);
+    struct newfs_pcache_slot *slot = NEWFS_PCACHE_SLOT(hash);
+    struct newfs_dentry *dentry = NULL;
+    unsigned int seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+    if ((seq & 1) == 0 && newfs_pcache_match(slot, path, len, hash))
+    {
+        dentry = __atomic_load_n(&slot->dentry, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+        {
+            dentry = NULL;
+        }
+    }
+    __atomic_fetch_add(dentry != NULL ? &newfs_pcache_stats.hits : &newfs_pcache_stats.misses, 1, __ATOMIC_RELAXED);
+    return dentry;
+}
+/**
+ * @brief 记录一条查找成功的路径，覆盖同一槽里原有的路径
+ *
+ * @param path
+ * @param len 路径长度，放不进槽时不缓存
+ * @param dentry
+ */
+void newfs_pcache_insert(const char *path, int len, struct newfs_dentry *dentry)
+{
+    uint32_t hash;
+    struct newfs_pcache_slot *slot;
+
+    if (len <= 0 || len >= NEWFS_PCACHE_PATH_LEN)
+    {
+        return;
+    }
+    hash = newfs_name_hash(path, len);
+    slot = NEWFS_PCACHE_SLOT(hash);
+    pthread_mutex_lock(&newfs_pcache_lock);
+    newfs_pcache_write_begin(slot);
+    memcpy(slot->path, path, len);
+    slot->path[len] = '\0';
+    slot->len = len;
+    slot->hash = hash;
+    slot->dentry = dentry;
+    newfs_pcache_write_end(slot);
+    pthread_mutex_unlock(&newfs_pcache_lock);
+}
+/**
+ * @brief 作废path，subtree时连同path下所有路径一起作废。创建时只需作废
+ * path本身，删除、重命名目录时需要作废整棵子树
+ *
+ * @param path
+ * @param subtree
+ */
+void newfs_pcache_invalidate(const char *path, int subtree)
+{
+    int len = strlen(path);
+    uint32_t hash = newfs_name_hash(path, len);
+    struct newfs_pcache_slot *slot = NEWFS_PCACHE_SLOT(hash);
+
+    pthread_mutex_lock(&newfs_pcache_lock);
+    if (!subtree)
+    {
+        if (newfs_pcache_match(slot, path, len, hash))
+        {
+            newfs_pcache_clear(slot);
+            newfs_pcache_stats.invalidations++;
+        }
+        pthread_mutex_unlock(&newfs_pcache_lock);
+        return;
+    }
+    for (int i = 0; i < NEWFS_PCACHE_SLOTS; i++)
+    {
+        slot = &newfs_pcache[i];
+        if (slot->len >= len && memcmp(slot->path, path, len) == 0 &&
+            (slot->path[len] == '\0' || slot->path[len] == '/'))
+        {
+            newfs_pcache_clear(slot);
+            newfs_pcache_stats.invalidations++;
+        }
+    }
+    pthread_mutex_unlock(&newfs_pcache_lock);
+}
+/**
+ * @brief 作废所有指向parent下一级dentry的槽，目录被换出、子dentry释放前调用
+ *
+ * @param parent
+ */
+void newfs_pcache_invalidate_children(struct newfs_dentry *parent)
+{
+    struct newfs_pcache_slot *slot;
+
+    pthread_mutex_lock(&newfs_pcache_lock);
+    for (int i = 0; i < NEWFS_PCACHE_SLOTS; i++)
+    {
+        slot = &newfs_pcache[i];
+        if (slot->len != 0 && slot->dentry->parent == parent)
+        {
+            newfs_pcache_clear(slot);
+            newfs_pcache_stats.invalidations++;
+        }
+    }
+    pthread_mutex_unlock(&newfs_pcache_lock);
+}
+/**
+ * @brief 打印路径缓存的命中统计
+ */
+void newfs_pcache_dump_stats()
+{
+    long total = newfs_pcache_stats.hits + newfs_pcache_stats.misses;
+
+    NEWFS_DBG("[pcache] hits %ld, misses %ld, hit rate %.2f%%, invalidations %ld\n",
+              newfs_pcache_stats.hits, newfs_pcache_stats.misses,
+              total == 0 ? 0.0 : 100.0 * newfs_pcache_stats.hits / total,
+              newfs_pcache_stats.invalidations);
+}
@@ -0,0 +1,271 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * dentry和inode的slab分配器：对象按类型放在各自的内存块里，每块一次向系统
+ * 要NEWFS_SLAB_CHUNK_OBJS个对象，空闲对象串成单链表，分配和释放都是O(1)，
+ * 不再逐个malloc。所有内存块挂在分配器上，卸载时整批归还，不需要遍历目录树
+ * 逐个释放。
+ *
+ * getattr不加锁地访问dentry和inode，释放时立即从占用数中扣除，对象本身等
+ * 读者退出后才回到空闲链表，之前它的内容保持不变。
+ */
+static struct newfs_slab newfs_dentry_slab;
+static struct newfs_slab newfs_inode_slab;
+// 不同目录下的查找会同时读入inode，两个slab共用一把锁
+static pthread_mutex_t newfs_slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief 初始化一个slab，不预先分配内存块
+ *
+ * @param slab
+ * @param name 打印统计时用
+ * @param obj_size
+ */
+static void newfs_slab_init_one(struct newfs_slab *slab, const char *name, int obj_size)
+{
+    memset(slab, 0, sizeof(struct newfs_slab));
+    slab->name = name;
+    // 空闲时对象的头部存放下一个空闲对象的指针，按指针大小对齐
+    slab->obj_size = NEWFS_ROUND_UP(obj_size, (int)sizeof(void *));
+}
+/**
+ * @brief 再要一个内存块，其中的对象全部挂到空闲链表上
+ *
+ * @param slab
+ * @return int
+ */
+static int newfs_slab_grow(struct newfs_slab *slab)
+{
+    struct newfs_slab_chunk *chunk;
+    uint8_t *obj;
+    int i;
+
+    chunk = (struct newfs_slab_chunk *)malloc(sizeof(struct newfs_slab_chunk) + (size_t)slab->obj_size * NEWFS_SLAB_CHUNK_OBJS);
+    if (chunk == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+    // 倒着挂，分配顺序与地址顺序一致
+    for (i = NEWFS_SLAB_CHUNK_OBJS - 1; i >= 0; i--)
+    {
+        obj = chunk->objs + (size_t)slab->obj_size * i;
+        *(void **)obj = slab->free;
+        slab->free = obj;
+    }
+    slab->stats.chunks++;
+    slab->stats.objs += NEWFS_SLAB_CHUNK_OBJS;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 分配一个对象，内容清零
+ *
+ * @param slab
+ * @return void* 内存不足返回NULL
+ */
+static void *newfs_slab_alloc(struct newfs_slab *slab)
+{
+    void *obj;
+
+    pthread_mutex_lock(&newfs_slab_lock);
+    if (slab->free == NULL && newfs_slab_grow(slab) != NEWFS_ERROR_NONE)
+    {
+        pthread_mutex_unlock(&newfs_slab_lock);
+        return NULL;
+    }
+    obj = slab->free;
+    slab->free = *(void **)obj;
+    slab->stats.allocs++;
+    slab->stats.in_use++;
+    if (slab->stats.in_use > slab->stats.peak)
+    {
+        slab->stats.peak = slab->stats.in_use;
+    }
+    pthread_mutex_unlock(&newfs_slab_lock);
+    memset(obj, 0, slab->obj_size);
+    return obj;
+}
+/**
+ * @brief 对象不再使用，从占用数中扣除，等读者退出后由fn放回空闲链表
+ *
+ * @param slab
+ * @param obj
+ * @param fn
+ */
+static void newfs_slab_free(struct newfs_slab *slab, void *obj, void (*fn)(void *))
+{
+    if (obj == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&newfs_slab_lock);
+    slab->stats.frees++;
+    slab->stats.in_use--;
+    pthread_mutex_unlock(&newfs_slab_lock);
+    newfs_epoch_defer(fn, obj);
+}
+/**
+ * @brief 归还一个对象到空闲链表，内存块本身留到卸载时一起释放
+ *
+ * @param slab
+ * @param obj
+ */
+static void newfs_slab_recycle(struct newfs_slab *slab, void *obj)
+{
+    pthread_mutex_lock(&newfs_slab_lock);
+    *(void **)obj = slab->free;
+    slab->free = obj;
+    pthread_mutex_unlock(&newfs_slab_lock);
+}
+/**
+ * @brief 没有读者再访问这个dentry了，放回空闲链表
+ *
+ * @param obj
+ */
+static void newfs_dentry_recycle(void *obj)
+{
+    newfs_slab_recycle(&newfs_dentry_slab, obj);
+}
+/**
+ * @brief 没有读者再访问这个inode了，放回空闲链表
+ *
+ * @param obj
+ */
+static void newfs_inode_recycle(void *obj)
+{
+    pthread_rwlock_destroy(&((struct newfs_inode *)obj)->lock);
+    newfs_slab_recycle(&newfs_inode_slab, obj);
+}
+/**
+ * @brief 释放slab的所有内存块，其中的对象全部失效
+ *
+ * @param slab
+ */
+static void newfs_slab_destroy_one(struct newfs_slab *slab)
+{
+    struct newfs_slab_chunk *chunk, *next;
+
+    for (chunk = slab->chunks; chunk != NULL; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+    slab->chunks = NULL;
+    slab->free = NULL;
+}
+/**
+ * @brief 挂载时初始化dentry和inode的slab
+ */
+void newfs_slab_init()
+{
+    newfs_slab_init_one(&newfs_dentry_slab, "dentry", sizeof(struct newfs_dentry));
+    newfs_slab_init_one(&newfs_inode_slab, "inode", sizeof(struct newfs_inode));
+}
+/**
+ * @brief 卸载时整批释放，之后所有dentry和inode都不能再访问
+ */
+void newfs_slab_destroy()
+{
+    // 待释放的对象先放回空闲链表，之后随内存块一起释放
+    newfs_epoch_reclaim(1);
+    newfs_slab_destroy_one(&newfs_dentry_slab);
+    newfs_slab_destroy_one(&newfs_inode_slab);
+}
+/**
+ * @brief 分配一个清零的dentry
+ *
+ * @return struct newfs_dentry*
+ */
+struct newfs_dentry *newfs_dentry_alloc()
+{
+    return (struct newfs_dentry *)newfs_slab_alloc(&newfs_dentry_slab);
+}
+/**
+ * @brief 释放dentry
+ *
+ * @param dentry
+ */
+void newfs_dentry_free(struct newfs_dentry *dentry)
+{
+    newfs_slab_free(&newfs_dentry_slab, dentry, newfs_dentry_recycle);
+}
+/**
+ * @brief 分配一个清零的inode
+ *
+ * @return struct newfs_inode*
+ */
+struct newfs_inode *newfs_inode_alloc()
+{
+    struct newfs_inode *inode = (struct newfs_inode *)newfs_slab_alloc(&newfs_inode_slab);
+
+    if (inode != NULL)
+    {
+        pthread_rwlock_init(&inode->lock, NULL);
+    }
+    return inode;
+}
+/**
+ * @brief 释放inode结构本身，extent、目录索引等由调用者先释放
+ *
+ * @param inode
+ */
+void newfs_inode_free(struct newfs_inode *inode)
+{
+    newfs_slab_free(&newfs_inode_slab, inode, newfs_inode_recycle);
+}
+/**
+ * @brief 新建一个dentry
+ *
+ * @param fname
+ * @param ftype
+ * @return struct newfs_dentry*
+ */
+struct newfs_dentry *new_dentry(char *fname, NEW_FILE_TYPE ftype)
+{
+    struct newfs_dentry *dentry = newfs_dentry_alloc();
+
+    if (dentry == NULL)
+    {
+        return NULL;
+    }
+    NEWFS_ASSIGN_FNAME(dentry, fname);
+    dentry->ftype = ftype;
+    dentry->ino = -1;
+    dentry->name_len = strnlen(dentry->name, MAX_NAME_LEN);
+    dentry->hash = newfs_name_hash(dentry->name, dentry->name_len);
+    return dentry;
+}
+/**
+ * @brief 正在使用的dentry和inode总数
+ *
+ * @return long
+ */
+long newfs_slab_in_use()
+{
+    return newfs_dentry_slab.stats.in_use + newfs_inode_slab.stats.in_use;
+}
+/**
+ * @brief 打印一个slab的占用情况
+ *
+ * @param slab
+ */
+static void newfs_slab_dump_one(struct newfs_slab *slab)
+{
+    NEWFS_DBG("[slab] %s: in use %ld / %ld (%.2f%%), peak %ld, chunks %ld (%ld KB), allocs %ld, frees %ld\n",
+              slab->name, slab->stats.in_use, slab->stats.objs,
+              slab->stats.objs == 0 ? 0.0 : 100.0 * slab->stats.in_use / slab->stats.objs,
+              slab->stats.peak, slab->stats.chunks,
+              slab->stats.chunks * (long)slab->obj_size * NEWFS_SLAB_CHUNK_OBJS / 1024,
+              slab->stats.allocs, slab->stats.frees);
+}
+/**
+ * @brief 打印dentry和inode slab的统计
+ */
+void newfs_slab_dump_stats()
+{
+    newfs_slab_dump_one(&newfs_dentry_slab);
+    newfs_slab_dump_one(&newfs_inode_slab);
+}
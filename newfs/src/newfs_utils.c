@@ -1,6 +1,9 @@
 #include "newfs.h"
 
 extern struct newfs_super newfs_super; // 内存超级块
+// 不经过块缓存时，不对齐的写要先读出首尾的IO单元再整段写回，相邻的两条inode
+// 记录可能落在同一个IO单元里，读改写的过程不能交错
+static pthread_mutex_t newfs_rmw_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @brief 获取文件名
@@ -15,84 +18,193 @@ char *newfs_get_fname(const char *path)
     return q;
 }
 /**
- * @brief 计算路径的层级
- * exm: /av/c/d/f
- * -> lvl = 4
- * @param path
+ * @brief 向设备发一次向量读。ddriver记录磁头位置，不能并发访问，所有设备
+ * 请求在dev_lock上排队
+ *
+ * @param iov
+ * @param iovcnt
+ * @return int 同ddriver_readv
+ */
+int newfs_dev_readv(struct ddriver_iovec *iov, int iovcnt)
+{
+    int ret;
+
+    pthread_mutex_lock(&newfs_super.dev_lock);
+    ret = ddriver_readv(NEWFS_DRIVER(), iov, iovcnt);
+    pthread_mutex_unlock(&newfs_super.dev_lock);
+    return ret;
+}
+/**
+ * @brief 向设备发一次向量写，与newfs_dev_readv共用dev_lock
+ *
+ * @param iov
+ * @param iovcnt
+ * @return int 同ddriver_writev
+ */
+int newfs_dev_writev(struct ddriver_iovec *iov, int iovcnt)
+{
+    int ret;
+
+    pthread_mutex_lock(&newfs_super.dev_lock);
+    ret = ddriver_writev(NEWFS_DRIVER(), iov, iovcnt);
+    pthread_mutex_unlock(&newfs_super.dev_lock);
+    return ret;
+}
+/**
+ * @brief 驱动读，已写入日志但还没写回原位的块以日志中的内容为准
+ *
+ * @param offset
+ * @param out_content
+ * @param size
  * @return int
  */
-int newfs_calc_lvl(const char *path)
+int newfs_driver_read(int offset, uint8_t *out_content, int size)
 {
-    char *str = path;
-    int lvl = 0;
-    if (strcmp(path, "/") == 0)
+    int ret = NEWFS_ERROR_NONE;
+
+    // 读原位到叠加日志之间不能做检查点
+    newfs_journal_lock();
+    if (newfs_driver_read_direct(offset, out_content, size) != NEWFS_ERROR_NONE)
     {
-        return lvl;
+        ret = -NEWFS_ERROR_IO;
     }
-    while (*str != NULL)
+    else
     {
-        if (*str == '/')
-        {
-            lvl++;
-        }
-        str++;
+        newfs_journal_overlay(offset, out_content, size);
     }
-    return lvl;
+    newfs_journal_unlock();
+    return ret;
 }
 /**
- * @brief 驱动读
+ * @brief 驱动写，启用日志时元数据先进入当前事务，提交和检查点后才写回原位
+ *
+ * @param offset
+ * @param in_content
+ * @param size
+ * @return int
+ */
+int newfs_driver_write(int offset, uint8_t *in_content, int size)
+{
+    if (newfs_journal_enabled())
+    {
+        return newfs_journal_write(offset, in_content, size);
+    }
+    return newfs_driver_write_direct(offset, in_content, size);
+}
+/**
+ * @brief 不经过日志，直接从原位读
  *
  * @param offset
  * @param out_content
  * @param size
  * @return int
  */
-int newfs_driver_read(int offset, uint8_t *out_content, int size)
+int newfs_driver_read_direct(int offset, uint8_t *out_content, int size)
 {
+    if (newfs_cache_enabled())
+    {
+        return newfs_cache_read(offset, out_content, size);
+    }
+
     int offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
     int bias = offset - offset_aligned;
     int size_aligned = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        ddriver_read(NEWFS_DRIVER(), cur, NEWFS_IO_SZ());
-        cur += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();
-    }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
+    uint8_t *temp_content;
+    struct ddriver_iovec iov;
+
+    // 对齐的请求直接读进调用者的缓冲区，否则借用本线程的中转缓冲区
+    if (bias == 0 && size_aligned == size)
+    {
+        temp_content = out_content;
+        newfs_bounce_direct();
+    }
+    else if ((temp_content = newfs_bounce_get(size_aligned)) == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    // 整段只发一次设备请求
+    iov.offset = offset_aligned;
+    iov.buf = (char *)temp_content;
+    iov.size = size_aligned;
+    if (newfs_dev_readv(&iov, 1) < 0)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+    if (temp_content != out_content)
+    {
+        memcpy(out_content, temp_content + bias, size);
+    }
     return NEWFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 不经过日志，直接写回原位
  *
  * @param offset
  * @param in_content
  * @param size
  * @return int
  */
-int newfs_driver_write(int offset, uint8_t *in_content, int size)
+int newfs_driver_write_direct(int offset, uint8_t *in_content, int size)
 {
+    if (newfs_cache_enabled())
+    {
+        return newfs_cache_write(offset, in_content, size);
+    }
+
     int offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
     int bias = offset - offset_aligned;
     int size_aligned = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
-    uint8_t *temp_content = (uint8_t *)malloc(size_aligned);
-    uint8_t *cur = temp_content;
-    newfs_driver_read(offset_aligned, temp_content, size_aligned);
+    uint8_t *temp_content;
+    struct ddriver_iovec iov;
+    struct ddriver_iovec fill[2];
+    int fillcnt = 0;
+
+    // 对齐的请求直接从调用者的缓冲区写出
+    if (bias == 0 && size_aligned == size)
+    {
+        newfs_bounce_direct();
+        iov.offset = offset;
+        iov.buf = (char *)in_content;
+        iov.size = size;
+        return newfs_dev_writev(&iov, 1) < 0 ? -NEWFS_ERROR_IO : NEWFS_ERROR_NONE;
+    }
+    if ((temp_content = newfs_bounce_get(size_aligned)) == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    pthread_mutex_lock(&newfs_rmw_lock);
+    // 整块覆盖的部分直接写，只读回部分覆盖的首尾两块（合并为一次请求）
+    if (bias != 0)
+    {
+        fill[fillcnt].offset = offset_aligned;
+        fill[fillcnt].buf = (char *)temp_content;
+        fill[fillcnt].size = NEWFS_IO_SZ();
+        fillcnt++;
+    }
+    if ((offset + size) % NEWFS_IO_SZ() != 0 && (bias == 0 || size_aligned > NEWFS_IO_SZ()))
+    {
+        fill[fillcnt].offset = offset_aligned + size_aligned - NEWFS_IO_SZ();
+        fill[fillcnt].buf = (char *)(temp_content + size_aligned - NEWFS_IO_SZ());
+        fill[fillcnt].size = NEWFS_IO_SZ();
+        fillcnt++;
+    }
+    if (fillcnt > 0 && newfs_dev_readv(fill, fillcnt) < 0)
+    {
+        pthread_mutex_unlock(&newfs_rmw_lock);
+        return -NEWFS_ERROR_IO;
+    }
     memcpy(temp_content + bias, in_content, size);
 
-    ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
+    iov.offset = offset_aligned;
+    iov.buf = (char *)temp_content;
+    iov.size = size_aligned;
+    if (newfs_dev_writev(&iov, 1) < 0)
     {
-        ddriver_write(NEWFS_DRIVER(), (char *)cur, NEWFS_IO_SZ());
-        cur += NEWFS_IO_SZ();
-        size_aligned -= NEWFS_IO_SZ();
+        pthread_mutex_unlock(&newfs_rmw_lock);
+        return -NEWFS_ERROR_IO;
     }
+    pthread_mutex_unlock(&newfs_rmw_lock);
 
-    free(temp_content);
     return NEWFS_ERROR_NONE;
 }
 
@@ -105,37 +217,21 @@ int newfs_driver_write(int offset, uint8_t *in_content, int size)
 struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
 {
     struct newfs_inode *inode;
-    int byte_cursor = 0;
-    int bit_cursor = 0;
-    int ino_cursor = 0;
-    int is_find_free_entry = 0;
-
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.ino_map_blks); byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-        {
-            if ((newfs_super.ino_map[byte_cursor] & (0x1 << bit_cursor)) == 0)
-            {
-                /* 当前ino_cursor位置空闲 */
-                newfs_super.ino_map[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = 1; 
-                break;
-            }
-            ino_cursor++;
-        }
-        if (is_find_free_entry)
-        {
-            break;
-        }
-    }
+    int ino_cursor = newfs_bitmap_alloc(&newfs_super.ino_bm);
 
-    if (!is_find_free_entry || ino_cursor == newfs_super.ino_max)
-        return -NEWFS_ERROR_NOSPACE;
+    if (ino_cursor < 0)
+        return NULL;
 
     // 填充信息
-    inode = (struct newfs_inode *)malloc(sizeof(struct newfs_inode));
+    inode = newfs_inode_alloc();
+    if (inode == NULL)
+    {
+        newfs_free_inode(ino_cursor);
+        return NULL;
+    }
     inode->ino = ino_cursor;
     inode->size = 0;
+    inode->atime = inode->mtime = inode->ctime = (uint32_t)time(NULL);
     /* dentry指向inode */
     dentry->inode = inode;
     dentry->ino = inode->ino;
@@ -144,169 +240,634 @@ struct newfs_inode *newfs_alloc_inode(struct newfs_dentry *dentry)
 
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
+    inode->dhash = NULL;
+    inode->dhash_size = 0;
     inode->ftype = dentry->ftype; // 一个inode对应一个文件，需要确定文件类型
-
-    if (NEWFS_IS_REG(inode))
-    {
-        inode->data = (uint8_t *)malloc(NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE));
-        // 等待真正存储存储数据时再分配块指针
-    }
+    inode->fblks = NULL;          // 等待真正存储数据时再分配数据块和缓冲区
+    inode->fblk_cap = inode->fblk_cnt = 0;
+    inode->flru_prev = inode->flru_next = NULL;
+    inode->dblks = NULL;
+    inode->dblk_cap = 0;
+    inode->dir_cookie = 0;
+    inode->rd_next = NULL;
+    inode->flags = 0;
+    inode->dirty_lo = inode->dirty_hi = 0;
+    inode->dirty_pprev = NULL;
+    inode->dirty_bytes = 0;
+    newfs_extent_init(inode);
+    newfs_mark_inode_dirty(inode); // 新inode的记录还不在磁盘上
+    newfs_icache_add(inode);
 
     return inode;
 }
 /**
  * @brief 为data分配一个数据块并返回数据块编号
  * @return int
- * 仿照alloc_inode
  */
 int newfs_alloc_data()
 {
-    int byte_cursor = 0;// 字节游标，用于遍历数据位图的字节
-    int bit_cursor = 0;// 位游标，用于遍历数据位图的位
-    int blk_cursor = 0;
-    int is_find_free_blk = 0;// 数据块游标，记录找到的空闲数据块的编号
+    int blk_cursor = newfs_bitmap_alloc(&newfs_super.data_bm);
+
+    if (blk_cursor < 0)
+        return -NEWFS_ERROR_NOSPACE;
+    return blk_cursor;
+}
+/**
+ * @brief 分配一个数据块，优先选goal，让同一文件的块尽量连续
+ *
+ * @param goal 期望的数据块编号
+ * @return int
+ */
+int newfs_alloc_data_near(int goal)
+{
+    int blk_cursor = newfs_bitmap_alloc_near(&newfs_super.data_bm, goal);
+
+    if (blk_cursor < 0)
+        return -NEWFS_ERROR_NOSPACE;
+    return blk_cursor;
+}
+/**
+ * @brief 释放inode位图中的一位
+ *
+ * @param ino
+ */
+void newfs_free_inode(int ino)
+{
+    newfs_bitmap_free(&newfs_super.ino_bm, ino);
+}
+/**
+ * @brief 释放数据块位图中的一位
+ *
+ * @param blk 数据块编号
+ */
+void newfs_free_data(int blk)
+{
+    newfs_bitmap_free(&newfs_super.data_bm, blk);
+    newfs_cache_invalidate(NEWFS_DATA_OFS(blk), NEWFS_BLKS_SZ(1));
+    newfs_journal_revoke(NEWFS_DATA_OFS(blk) / NEWFS_BLKS_SZ(1));
+}
+/**
+ * @brief 改变普通文件的大小，按需追加或释放数据块，扩大的部分补0
+ *
+ * @param inode
+ * @param size 新的文件大小，调用者保证不超过NEWFS_MAX_FILE_SZ()
+ * @return int
+ */
+int newfs_resize_file(struct newfs_inode *inode, int size)
+{
+    int nblks = NEWFS_ROUND_UP(size, NEWFS_BLKS_SZ(1)) / NEWFS_BLKS_SZ(1);
+    int old_blks = inode->blks;
+
+    if (nblks > inode->blks && newfs_extent_grow(inode, nblks) != NEWFS_ERROR_NONE)
+    {
+        // 空间不够时整个扩展失败，已经追加的块还回去，不能把设备占满
+        newfs_extent_truncate(inode, old_blks);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    else if (nblks < inode->blks)
+    {
+        newfs_extent_truncate(inode, nblks);
+        newfs_file_truncate(inode, nblks);
+    }
+    if (size > inode->size)
+    {
+        if (newfs_file_zero(inode, inode->size, size) != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_mark_blks_dirty(inode, inode->size / NEWFS_BLKS_SZ(1), nblks);
+    }
+    inode->size = size;
+    newfs_mark_inode_dirty(inode);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将inode挂到脏链表上
+ *
+ * @param inode
+ */
+static void newfs_link_dirty(struct newfs_inode *inode)
+{
+    long dirty_bytes = NEWFS_BLKS_SZ((long)(inode->dirty_hi - inode->dirty_lo)) +
+                       (inode->flags & NEWFS_INODE_DIRTY ? NEWFS_INODE_SZ : 0);
+
+    // 不同文件的写会同时标脏，链表和全局计数在dirty_lock下修改
+    pthread_mutex_lock(&newfs_super.dirty_lock);
+    // 计入全局脏字节数，回写线程据此决定何时回写、是否让写者等待
+    newfs_super.dirty_bytes += dirty_bytes - inode->dirty_bytes;
+    inode->dirty_bytes = dirty_bytes;
+    if (inode->dirty_pprev == NULL)
+    {
+        inode->dirtied_at = newfs_now_ms();
+        inode->dirty_next = newfs_super.dirty_inodes;
+        if (inode->dirty_next != NULL)
+        {
+            inode->dirty_next->dirty_pprev = &inode->dirty_next;
+        }
+        newfs_super.dirty_inodes = inode;
+        inode->dirty_pprev = &newfs_super.dirty_inodes;
+    }
+    pthread_mutex_unlock(&newfs_super.dirty_lock);
+}
+/**
+ * @brief 将inode从脏链表上摘下
+ *
+ * @param inode
+ */
+static void newfs_unlink_dirty(struct newfs_inode *inode)
+{
+    pthread_mutex_lock(&newfs_super.dirty_lock);
+    if (inode->dirty_pprev != NULL)
+    {
+        newfs_super.dirty_bytes -= inode->dirty_bytes;
+        inode->dirty_bytes = 0;
+        *inode->dirty_pprev = inode->dirty_next;
+        if (inode->dirty_next != NULL)
+        {
+            inode->dirty_next->dirty_pprev = inode->dirty_pprev;
+        }
+        inode->dirty_pprev = NULL;
+        inode->dirty_next = NULL;
+    }
+    pthread_mutex_unlock(&newfs_super.dirty_lock);
+}
+/**
+ * @brief 标记inode记录需要写回
+ *
+ * @param inode
+ */
+void newfs_mark_inode_dirty(struct newfs_inode *inode)
+{
+    inode->flags |= NEWFS_INODE_DIRTY;
+    newfs_link_dirty(inode);
+}
+/**
+ * @brief 把inode的时间戳改为当前时间并标脏。只改访问时间时不挂脏链表，
+ * 读文件不会让inode换不出去。调用者独占持有inode的锁，或独占持有tree_lock
+ *
+ * @param inode
+ * @param flags NEWFS_TIME_ATIME、NEWFS_TIME_MTIME、NEWFS_TIME_CTIME的组合
+ */
+void newfs_update_time(struct newfs_inode *inode, int flags)
+{
+    uint32_t now = (uint32_t)time(NULL);
+
+    if (flags & NEWFS_TIME_ATIME)
+    {
+        inode->atime = now;
+    }
+    if (flags & NEWFS_TIME_MTIME)
+    {
+        inode->mtime = now;
+    }
+    if (flags & NEWFS_TIME_CTIME)
+    {
+        inode->ctime = now;
+    }
+    if (flags == NEWFS_TIME_ATIME)
+    {
+        inode->flags |= NEWFS_INODE_ATIME;
+        return;
+    }
+    newfs_mark_inode_dirty(inode);
+}
+/**
+ * @brief 读文件后是否需要更新访问时间。同relatime：只在访问时间早于最后
+ * 一次修改，或者落后超过NEWFS_ATIME_MAX_AGE时更新，热文件的读不会每次都
+ * 把inode弄脏
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_atime_stale(struct newfs_inode *inode)
+{
+    uint32_t atime = __atomic_load_n(&inode->atime, __ATOMIC_RELAXED);
+    uint32_t now = (uint32_t)time(NULL);
+
+    // 时间戳以秒计，这一秒内已经更新过就不再更新
+    return atime != now &&
+           (atime <= __atomic_load_n(&inode->mtime, __ATOMIC_RELAXED) ||
+            atime <= __atomic_load_n(&inode->ctime, __ATOMIC_RELAXED) ||
+            now - atime >= NEWFS_ATIME_MAX_AGE);
+}
+/**
+ * @brief 标记逻辑块[lo, hi)需要写回，对目录是目录项块，对文件是数据块
+ *
+ * @param inode
+ * @param lo
+ * @param hi
+ */
+void newfs_mark_blks_dirty(struct newfs_inode *inode, int lo, int hi)
+{
+    if (lo >= hi)
+    {
+        return;
+    }
+    if (inode->dirty_lo >= inode->dirty_hi)
+    {
+        inode->dirty_lo = lo;
+        inode->dirty_hi = hi;
+    }
+    else
+    {
+        inode->dirty_lo = lo < inode->dirty_lo ? lo : inode->dirty_lo;
+        inode->dirty_hi = hi > inode->dirty_hi ? hi : inode->dirty_hi;
+    }
+    newfs_link_dirty(inode);
+}
+/**
+ * @brief 将目录的第lblk个目录项块写回
+ *
+ * @param inode
+ * @param lblk
+ * @param blk_buf 一个块大小的临时缓冲
+ * @return int
+ */
+static int newfs_sync_dir_blk(struct newfs_inode *inode, int lblk, uint8_t *blk_buf)
+{
+    struct newfs_dentry_d *dentry_d = (struct newfs_dentry_d *)blk_buf;
+    struct newfs_dentry *dentry;
+    int off = 0;
+
+    // 记录从块首紧密排列，删除留下的空洞在这里被压实
+    memset(blk_buf, 0, NEWFS_BLKS_SZ(1));
+    for (dentry = inode->dblks[lblk].head; dentry != NULL; dentry = dentry->bnext)
+    {
+        dentry_d = (struct newfs_dentry_d *)(blk_buf + off);
+        dentry_d->ino = dentry->ino;
+        dentry_d->rec_len = NEWFS_DENTRY_REC_LEN(dentry->name_len);
+        dentry_d->name_len = dentry->name_len;
+        dentry_d->ftype = dentry->ftype;
+        memcpy(dentry_d->name, dentry->name, dentry->name_len);
+        off += dentry_d->rec_len;
+    }
+    // 最后一条记录延伸到块尾，空块写一条空记录
+    dentry_d->rec_len += NEWFS_BLKS_SZ(1) - off;
+    return newfs_driver_write(NEWFS_DATA_OFS(newfs_bmap(inode, lblk)), blk_buf, NEWFS_BLKS_SZ(1));
+}
+/**
+ * @brief newfs_sync_inode的实现，调用者持有inode的锁
+ *
+ * @param inode
+ * @return int
+ */
+static int newfs_write_inode(struct newfs_inode *inode)
+{
+    struct newfs_inode_d inode_d;
+    uint8_t *blk_buf;
+    int lo = inode->dirty_lo;
+    int hi = inode->dirty_hi < inode->blks ? inode->dirty_hi : inode->blks; // 截断后多出的块已释放
+
+    if (inode->flags & (NEWFS_INODE_DIRTY | NEWFS_INODE_ATIME))
+    {
+        memset(&inode_d, 0, sizeof(struct newfs_inode_d));
+        inode_d.ino = inode->ino;
+        inode_d.size = inode->size;
+        inode_d.ftype = inode->ftype;
+        inode_d.dir_cnt = inode->dir_cnt;
+        inode_d.atime = inode->atime;
+        inode_d.mtime = inode->mtime;
+        inode_d.ctime = inode->ctime;
+
+        if (newfs_extent_sync(inode, &inode_d) != NEWFS_ERROR_NONE) // 将extent写回
+        {
+            NEWFS_DBG("[%s] extent sync error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+        if (newfs_driver_write(NEWFS_INO_OFS(inode->ino), (uint8_t *)&inode_d, sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_itable_put(inode->ino, &inode_d);
+    }
+
+    if (lo < hi && NEWFS_IS_DIR(inode)) // 文件夹写回
+    {
+        // 目录项按槽号摆放，不跨块
+        blk_buf = (uint8_t *)malloc(NEWFS_BLKS_SZ(1));
+        for (; lo < hi; lo++)
+        {
+            if (newfs_sync_dir_blk(inode, lo, blk_buf) != NEWFS_ERROR_NONE)
+            {
+                NEWFS_DBG("[%s] io error\n", __func__);
+                free(blk_buf);
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        free(blk_buf);
+    }
+    else if (lo < hi && NEWFS_IS_REG(inode))
+    {
+        // 脏范围内在内存中的块只发一次设备请求
+        if (newfs_file_sync(inode, lo, hi) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] io error\n", __func__);
+            return -NEWFS_ERROR_IO;
+        }
+    }
+
+    inode->flags &= ~(NEWFS_INODE_DIRTY | NEWFS_INODE_ATIME);
+    inode->dirty_lo = inode->dirty_hi = 0;
+    newfs_unlink_dirty(inode);
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将inode被修改的部分写回磁盘：inode记录只在标脏时写，目录项块和
+ * 文件数据只写被修改过的块，写完从脏链表摘下。调用者独占持有commit_lock，
+ * 没有修改在进行
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_sync_inode(struct newfs_inode *inode)
+{
+    int ret;
+
+    // 读文件和readdir可能正在使用inode，共享持有它的锁就够了
+    pthread_rwlock_rdlock(&inode->lock);
+    ret = newfs_write_inode(inode);
+    pthread_rwlock_unlock(&inode->lock);
+    return ret;
+}
+/**
+ * @brief 写回脏链表上的所有inode以及两张位图中被修改的部分，作为一个事务提交
+ *
+ * @return int
+ */
+int newfs_flush()
+{
+    int ret = NEWFS_ERROR_NONE;
+
+    while (newfs_super.dirty_inodes != NULL)
+    {
+        if (newfs_sync_inode(newfs_super.dirty_inodes) != NEWFS_ERROR_NONE)
+        {
+            // 写失败的inode留在链表上会死循环，摘下并报错
+            newfs_unlink_dirty(newfs_super.dirty_inodes);
+            ret = -NEWFS_ERROR_IO;
+        }
+    }
+    if (newfs_bitmap_sync(&newfs_super.ino_bm, newfs_super.ino_map_offset) != NEWFS_ERROR_NONE ||
+        newfs_bitmap_sync(&newfs_super.data_bm, newfs_super.data_map_offset) != NEWFS_ERROR_NONE ||
+        newfs_journal_commit() != NEWFS_ERROR_NONE)
+    {
+        ret = -NEWFS_ERROR_IO;
+    }
+    return ret;
+}
+
+/**
+ * @brief 保证目录的块数组至少能放cnt个块，新增的块为空
+ *
+ * @param inode
+ * @param cnt
+ * @return int
+ */
+static int newfs_dblk_reserve(struct newfs_inode *inode, int cnt)
+{
+    struct newfs_dir_blk *dblks;
+    int cap = inode->dblk_cap > 0 ? inode->dblk_cap : NEWFS_DHASH_INIT;
+
+    if (cnt <= inode->dblk_cap)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    while (cap < cnt)
+    {
+        cap <<= 1;
+    }
+    dblks = (struct newfs_dir_blk *)realloc(inode->dblks, sizeof(struct newfs_dir_blk) * cap);
+    if (dblks == NULL)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    memset(dblks + inode->dblk_cap, 0, sizeof(struct newfs_dir_blk) * (cap - inode->dblk_cap));
+    inode->dblks = dblks;
+    inode->dblk_cap = cap;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 为一个inode分配dentry，采用头插法
+ *
+ * @param inode
+ * @param dentry
+ * @return int
+ */
+int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
+{
+    int rec_len = NEWFS_DENTRY_REC_LEN(dentry->name_len);
+    int blk;
+
+    // 目录项不跨块存放，放进第一个剩余空间够的块，都放不下时在末尾追加一个块
+    for (blk = 0; blk < inode->blks && inode->dblks[blk].used + rec_len > NEWFS_BLKS_SZ(1); blk++)
+        ;
+    if (blk == inode->blks &&
+        (newfs_extent_grow(inode, blk + 1) != NEWFS_ERROR_NONE ||
+         newfs_dblk_reserve(inode, blk + 1) != NEWFS_ERROR_NONE))
+    {
+        NEWFS_DBG("[%s] no space for dentry\n", __func__);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    inode->dir_cnt++;
+    if (newfs_dir_index_insert(inode, dentry) != NEWFS_ERROR_NONE)
+    {
+        inode->dir_cnt--;
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    // 如果inode中没有任何目录项，直接将新目录项赋给inode的dentrys指针
+    if (inode->dentrys == NULL)
+    {
+        inode->dentrys = dentry;
+    }
+    else
+    {
+        // 如果已经存在目录项，则采用头插法，将新目录项插入到链表的开头
+        dentry->brother = inode->dentrys;
+        inode->dentrys = dentry;
+    }
+    // 只有新目录项所在的块需要写回
+    dentry->blk = blk;
+    dentry->bnext = inode->dblks[blk].head;
+    inode->dblks[blk].head = dentry;
+    inode->dblks[blk].used += rec_len;
+    newfs_mark_blks_dirty(inode, blk, blk + 1);
+    inode->size = NEWFS_BLKS_SZ(inode->blks);
+    newfs_update_time(inode, NEWFS_TIME_MTIME | NEWFS_TIME_CTIME);
+    return inode->dir_cnt;
+}
+
+/**
+ * @brief 将dentry从目录inode中摘下，目录尾部多出的块随之释放
+ *
+ * @param inode 目录inode
+ * @param dentry
+ * @return int 剩余目录项数
+ */
+int newfs_drop_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
+{
+    struct newfs_dentry **pp = &inode->dentrys;
+    struct newfs_dir_blk *dblk = &inode->dblks[dentry->blk];
+    struct newfs_dentry *cursor;
+    int last;
 
-    // 遍历数据位图的字节
-    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.data_map_blks); byte_cursor++)
+    while (*pp != NULL && *pp != dentry)
     {
-         // 遍历数据位图的位
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++)
-        {
-            // 检查当前位是否为0，表示该数据块为空闲
-            if ((newfs_super.data_map[byte_cursor] & (0x1 << bit_cursor)) == 0)
-            {
-                newfs_super.data_map[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_blk = 1;
-                break;
-            }
-            blk_cursor++;
-        }
-        if (is_find_free_blk)
+        pp = &(*pp)->brother;
+    }
+    if (*pp == NULL)
+    {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    *pp = dentry->brother;
+    dentry->brother = NULL;
+    newfs_dir_index_remove(inode, dentry);
+
+    // 从所在块中摘下，写回时块内剩下的记录被压实，只有这一块需要写回
+    for (pp = &dblk->head; *pp != dentry; pp = &(*pp)->bnext)
+        ;
+    *pp = dentry->bnext;
+    dentry->bnext = NULL;
+    dblk->used -= NEWFS_DENTRY_REC_LEN(dentry->name_len);
+    newfs_mark_blks_dirty(inode, dentry->blk, dentry->blk + 1);
+
+    // 块被删空时把最后一块的目录项整块搬进来，目录中间不留空块
+    last = inode->blks - 1;
+    if (dblk->head == NULL && dentry->blk != last)
+    {
+        *dblk = inode->dblks[last];
+        for (cursor = dblk->head; cursor != NULL; cursor = cursor->bnext)
         {
-            break;
+            cursor->blk = dentry->blk;
         }
+        inode->dblks[last].head = NULL;
+        inode->dblks[last].used = 0;
     }
-    if (!is_find_free_blk || blk_cursor == newfs_super.ino_max)
-        return -NEWFS_ERROR_NOSPACE;
-    return blk_cursor;
+    if (inode->dblks[last].head == NULL)
+    {
+        newfs_extent_truncate(inode, last);
+    }
+    newfs_update_time(inode, NEWFS_TIME_MTIME | NEWFS_TIME_CTIME);
+
+    inode->dir_cnt--;
+    inode->size = NEWFS_BLKS_SZ(inode->blks);
+    return inode->dir_cnt;
 }
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 释放inode及其占用的数据块，目录则递归释放下面所有的文件
  *
  * @param inode
  * @return int
  */
-int newfs_sync_inode(struct newfs_inode *inode)
+int newfs_drop_inode(struct newfs_inode *inode)
 {
-    struct newfs_inode_d inode_d;
     struct newfs_dentry *dentry_cursor;
-    struct newfs_dentry_d dentry_d;
-    int ino = inode->ino;
-    inode_d.ino = ino;
-    inode_d.size = inode->size;
-    inode_d.ftype = inode->ftype;
-    inode_d.dir_cnt = inode->dir_cnt;
-    int offset;
-
-    memcpy(inode_d.block_pointer, inode->block_pointer, sizeof(inode_d.block_pointer)); // 将块指针写回
+    struct newfs_dentry *dentry_to_free;
 
-    if (newfs_driver_write(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE)
+    if (inode == newfs_super.root_dentry->inode)
     {
-        NEWFS_DBG("[%s] io error\n", __func__);
-        return -NEWFS_ERROR_IO;
+        return -NEWFS_ERROR_INVAL;
     }
 
-    /* Cycle 1: 写 INODE */
-    /* Cycle 2: 写 数据 */
-    if (NEWFS_IS_DIR(inode)) // 文件夹写回
+    if (NEWFS_IS_DIR(inode))
     {
         dentry_cursor = inode->dentrys;
-        offset = NEWFS_DATA_OFS(inode->block_pointer[0]); // 计算文件夹内容在磁盘内的偏移量，用第一个块指针寻找，和SFS不一样
-        while (dentry_cursor != NULL)
+        while (dentry_cursor)
         {
-            memcpy(dentry_d.name, dentry_cursor->name, MAX_NAME_LEN);
-            dentry_d.ftype = dentry_cursor->ftype;
-            dentry_d.ino = dentry_cursor->ino;
-            if (newfs_driver_write(offset, (uint8_t *)&dentry_d, sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE)
-            {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return -NEWFS_ERROR_IO;
-            }
-
-            if (dentry_cursor->inode != NULL)
+            // 没读进内存的子inode也要读入，才能知道它占用了哪些块
+            if (newfs_load_inode(dentry_cursor) != NULL)
             {
-                newfs_sync_inode(dentry_cursor->inode);
+                newfs_drop_inode(dentry_cursor->inode);
             }
-
+            dentry_to_free = dentry_cursor;
             dentry_cursor = dentry_cursor->brother;
-            offset += sizeof(struct newfs_dentry_d);
+            newfs_dentry_free(dentry_to_free);
         }
+        newfs_dir_index_destroy(inode);
+        free(inode->dblks);
+    }
+
+    newfs_unlink_dirty(inode);
+    newfs_extent_truncate(inode, 0);
+    for (int i = 0; i < inode->ext_blk_cnt; i++)
+    {
+        newfs_free_data(inode->ext_blks[i]);
     }
-    else if (NEWFS_IS_REG(inode))
+    newfs_extent_destroy(inode);
+    newfs_free_inode(inode->ino);
+    newfs_file_release(inode);
+    newfs_icache_remove(inode);
+    newfs_inode_free(inode);
+    return NEWFS_ERROR_NONE;
+}
+static int newfs_dentry_ino_cmp(const void *a, const void *b)
+{
+    return (int)(*(struct newfs_dentry **)a)->ino - (int)(*(struct newfs_dentry **)b)->ino;
+}
+/**
+ * @brief 批量读入一组目录项的inode记录，只取属性存在目录项上，不构建inode。
+ * 按ino排序后，落在相邻inode块上的记录合并为一次读
+ *
+ * @param dentrys 会被按ino重新排序
+ * @param cnt
+ * @return int
+ */
+int newfs_read_attrs(struct newfs_dentry **dentrys, int cnt)
+{
+    struct newfs_inode_d inode_d;
+    int i, j, lo, hi;
+    long expire = newfs_now_ms() + NEWFS_ATTR_TTL_MS;
+
+    qsort(dentrys, cnt, sizeof(struct newfs_dentry *), newfs_dentry_ino_cmp);
+    for (i = 0; i < cnt; i = j)
     {
-        for (int i = 0; i < 6; i++)
+        lo = dentrys[i]->ino / NEWFS_INODE_PER_BLK;
+        hi = lo;
+        for (j = i + 1; j < cnt && dentrys[j]->ino / NEWFS_INODE_PER_BLK <= hi + 1; j++)
+        {
+            hi = dentrys[j]->ino / NEWFS_INODE_PER_BLK;
+        }
+        if (newfs_itable_prefetch(lo, hi) != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
+        for (; i < j; i++)
         {
-            if (inode_d.block_pointer[i] < 0)
-                continue;
-            offset = inode_d.block_pointer[i] * newfs_super.blks_size;
-            if (newfs_driver_write(offset, inode->data, NEWFS_BLKS_SZ(6)) != NEWFS_ERROR_NONE) // 调用封装好的函数直接将文件占用的逻辑块全部写回
+            if (newfs_itable_get(dentrys[i]->ino, &inode_d) != NEWFS_ERROR_NONE)
             {
-                NEWFS_DBG("[%s] io error\n", __func__);
                 return -NEWFS_ERROR_IO;
             }
+            dentrys[i]->attr.size = inode_d.size;
+            dentrys[i]->attr.atime = inode_d.atime;
+            dentrys[i]->attr.mtime = inode_d.mtime;
+            dentrys[i]->attr.ctime = inode_d.ctime;
+            dentrys[i]->attr_expire = expire;
         }
     }
-
     return NEWFS_ERROR_NONE;
 }
-
 /**
- * @brief 为一个inode分配dentry，采用头插法
+ * @brief newfs_read_inode中途失败时，释放已经建立的目录项、目录索引和extent
  *
- * @param inode
- * @param dentry
- * @return int
+ * @param inode 还没有加入inode缓存
  */
-int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
+static void newfs_read_inode_undo(struct newfs_inode *inode)
 {
-    // 如果inode中没有任何目录项，直接将新目录项赋给inode的dentrys指针
-    if (inode->dentrys == NULL)
-    {
-        inode->dentrys = dentry;
-    }
-    else
-    {
-        // 如果已经存在目录项，则采用头插法，将新目录项插入到链表的开头
-        dentry->brother = inode->dentrys;
-        inode->dentrys = dentry;
-    }
-    inode->dir_cnt++;
-    if (inode->dir_cnt == 1)// 如果是第一个目录项，分配块来存储dentry
+    struct newfs_dentry *sub_dentry, *next;
+
+    for (sub_dentry = inode->dentrys; sub_dentry != NULL; sub_dentry = next)
     {
-        inode->block_pointer[0] = newfs_alloc_data(); // 分配块指针存储dentry
+        next = sub_dentry->brother;
+        newfs_dentry_free(sub_dentry);
     }
-    else
+    if (NEWFS_IS_DIR(inode))
     {
-        int old_blk_used;
-        old_blk_used = inode->size / NEWFS_BLKS_SZ(1); // 完整使用的块数
-        int incomplete_old_blk_used = old_blk_used * NEWFS_BLKS_SZ(1) < inode->size ? old_blk_used + 1 : old_blk_used;
-        // 增加inode的size，表示目录项的总大小
-        inode->size += sizeof(struct newfs_dentry_d);
-        // 如果超过文件系统支持的最大大小，则报错
-        if (inode->size > NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE))
-        {
-            printf("overflows\n");
-            return inode->dir_cnt;
-        }
-        // 如果所有块都完整使用，则分配新块
-        if (old_blk_used < (inode->size / NEWFS_BLKS_SZ(1)) && incomplete_old_blk_used == old_blk_used) // 如果所有块都完整使用，则分配新块
-        {
-            inode->block_pointer[old_blk_used] = newfs_alloc_data();
-        }
+        newfs_dir_index_destroy(inode);
     }
-    return inode->dir_cnt;
+    free(inode->dblks);
+    newfs_extent_destroy(inode);
+    newfs_inode_free(inode);
 }
-
 /**
  * @brief
  *
@@ -316,80 +877,146 @@ int newfs_alloc_dentry(struct newfs_inode *inode, struct newfs_dentry *dentry)
  */
 struct newfs_inode *newfs_read_inode(struct newfs_dentry *dentry, int ino)
 {
-    struct newfs_inode *inode = (struct newfs_inode *)malloc(sizeof(struct newfs_inode));
+    struct newfs_inode *inode = newfs_inode_alloc();
     struct newfs_inode_d inode_d;
     struct newfs_dentry *sub_dentry;
-    struct newfs_dentry_d dentry_d;
-    int dir_cnt = 0, i;
-    if (newfs_driver_read(NEWFS_INO_OFS(ino), (uint8_t *)&inode_d, sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE)
+    struct newfs_dentry_d *dentry_d;
+    uint8_t *blk_buf;
+    char name[MAX_NAME_LEN + 1];
+    int blk, off;
+
+    if (inode == NULL)
+    {
+        return NULL;
+    }
+    if (newfs_itable_get(ino, &inode_d) != NEWFS_ERROR_NONE)
     {
         NEWFS_DBG("[%s] io error\n", __func__);
+        newfs_inode_free(inode);
         return NULL;
     }
     inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
     inode->ftype = inode_d.ftype;
-    memcpy(inode->block_pointer, inode_d.block_pointer, sizeof(inode->block_pointer));
+    inode->atime = inode_d.atime;
+    inode->mtime = inode_d.mtime;
+    inode->ctime = inode_d.ctime;
+    inode->fblks = NULL;
+    inode->fblk_cap = inode->fblk_cnt = 0;
+    inode->flru_prev = inode->flru_next = NULL;
+    if (newfs_extent_load(inode, &inode_d) != NEWFS_ERROR_NONE)
+    {
+        NEWFS_DBG("[%s] extent load error\n", __func__);
+        newfs_extent_destroy(inode);
+        newfs_inode_free(inode);
+        return NULL;
+    }
 
     inode->dentry = dentry;
     inode->dentrys = NULL;
+    inode->dhash = NULL;
+    inode->dhash_size = 0;
+    inode->dblks = NULL;
+    inode->dblk_cap = 0;
+    inode->dir_cookie = 0;
+    inode->rd_next = NULL;
+    inode->flags = 0;
+    inode->dirty_lo = inode->dirty_hi = 0;
+    inode->dirty_pprev = NULL;
+    inode->dirty_bytes = 0;
     if (NEWFS_IS_DIR(inode))
     {
-        dir_cnt = inode_d.dir_cnt;
-        for (i = 0; i < dir_cnt; i++)
+        // 目录的所有块整段读入，再在内存中逐块解析
+        blk_buf = (uint8_t *)malloc(NEWFS_BLKS_SZ(inode->blks > 0 ? inode->blks : 1));
+        if (blk_buf == NULL || newfs_dblk_reserve(inode, inode->blks) != NEWFS_ERROR_NONE)
         {
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode_d.block_pointer[0]) + i * sizeof(struct newfs_dentry_d), (uint8_t *)&dentry_d,
-                                  sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE)
-            {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;
-            }
-            sub_dentry = new_dentry(dentry_d.name, dentry_d.ftype);
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->ino = dentry_d.ino;
-            newfs_alloc_dentry(inode, sub_dentry);
+            free(blk_buf);
+            newfs_read_inode_undo(inode);
+            return NULL;
         }
-    }
-    else if (NEWFS_IS_REG(inode))
-    {
-        inode->data = (uint8_t *)malloc(NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE));
-        for (i = 0; i < 6; i++)
+        if (newfs_extent_read_meta(inode, 0, inode->blks, blk_buf) != NEWFS_ERROR_NONE)
         {
-            if (inode->block_pointer[i] < 0)
-                continue;
-            if (newfs_driver_read(inode->block_pointer[i], (uint8_t *)(inode->data + NEWFS_BLKS_SZ(i)), NEWFS_BLKS_SZ(1)) != NEWFS_ERROR_NONE)
+            NEWFS_DBG("[%s] io error\n", __func__);
+            free(blk_buf);
+            newfs_read_inode_undo(inode);
+            return NULL;
+        }
+        for (blk = 0; blk < inode->blks; blk++)
+        {
+            // 沿rec_len走完一块，rec_len不合法说明块已损坏，跳过剩下的部分
+            for (off = 0; off + (int)sizeof(struct newfs_dentry_d) <= NEWFS_BLKS_SZ(1); off += dentry_d->rec_len)
             {
-                NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;
+                dentry_d = (struct newfs_dentry_d *)(blk_buf + NEWFS_BLKS_SZ(blk) + off);
+                if (dentry_d->rec_len < NEWFS_DENTRY_REC_LEN(dentry_d->name_len) ||
+                    off + dentry_d->rec_len > NEWFS_BLKS_SZ(1) || dentry_d->name_len > MAX_NAME_LEN)
+                {
+                    NEWFS_DBG("[%s] bad dentry in dir %d blk %d\n", __func__, ino, blk);
+                    break;
+                }
+                if (dentry_d->name_len == 0)
+                {
+                    continue;
+                }
+                memcpy(name, dentry_d->name, dentry_d->name_len);
+                name[dentry_d->name_len] = '\0';
+                sub_dentry = new_dentry(name, dentry_d->ftype);
+                if (sub_dentry == NULL)
+                {
+                    free(blk_buf);
+                    newfs_read_inode_undo(inode);
+                    return NULL;
+                }
+                sub_dentry->parent = inode->dentry;
+                sub_dentry->ino = dentry_d->ino;
+                sub_dentry->blk = blk;
+                sub_dentry->bnext = inode->dblks[blk].head;
+                inode->dblks[blk].head = sub_dentry;
+                inode->dblks[blk].used += NEWFS_DENTRY_REC_LEN(dentry_d->name_len);
+                // 目录块已经在磁盘上，只挂链表，不能走newfs_alloc_dentry重新分配块
+                sub_dentry->brother = inode->dentrys;
+                inode->dentrys = sub_dentry;
+                inode->dir_cnt++;
+                if (newfs_dir_index_insert(inode, sub_dentry) != NEWFS_ERROR_NONE)
+                {
+                    free(blk_buf);
+                    newfs_read_inode_undo(inode);
+                    return NULL;
+                }
             }
         }
+        free(blk_buf);
     }
+    // 文件数据等第一次读写时再按块读入
+    newfs_icache_add(inode);
     return inode;
 }
+
 /**
- * @brief
+ * @brief 取dentry指向的inode，还没读入内存时读入。多个查找可以同时走到同一
+ * 个dentry，读入在load_lock下再检查一次，一个inode只读入一份
  *
- * @param inode
- * @param dir [0...]
- * @return struct newfs_dentry*
+ * @param dentry
+ * @return struct newfs_inode* 读盘失败返回NULL
  */
-struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir)
+struct newfs_inode *newfs_load_inode(struct newfs_dentry *dentry)
 {
-    struct newfs_dentry *dentry_cursor = inode->dentrys;
-    int cnt = 0;
-    while (dentry_cursor)
+    struct newfs_inode *inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+
+    if (inode != NULL)
     {
-        if (dir == cnt)
-        {
-            return dentry_cursor;
-        }
-        cnt++;
-        dentry_cursor = dentry_cursor->brother;
+        return inode;
+    }
+    pthread_mutex_lock(&newfs_super.load_lock);
+    inode = dentry->inode;
+    if (inode == NULL)
+    {
+        inode = newfs_read_inode(dentry, dentry->ino);
+        __atomic_store_n(&dentry->inode, inode, __ATOMIC_RELEASE);
     }
-    return NULL;
+    pthread_mutex_unlock(&newfs_super.load_lock);
+    return inode;
 }
-
 /**
  * @brief
  * path: /qwe/ad  total_lvl = 2,
@@ -403,90 +1030,268 @@ struct newfs_dentry *newfs_get_dentry(struct newfs_inode *inode, int dir)
  *      2) find qwe's dentry
  * 返回输入的最底下的那个文件夹
  * @param path
- * @return struct newfs_inode*
+ * @return struct newfs_inode* 读inode失败时返回NULL，is_find为0
  */
 struct newfs_dentry *newfs_lookup(const char *path, int *is_find, int *is_root)
+{
+    struct newfs_dentry *dentry = newfs_lookup_lazy(path, is_find, is_root);
+    struct newfs_inode *inode;
+
+    if (dentry == NULL)
+    {
+        return NULL;
+    }
+    inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
+    if (inode == NULL)
+    {
+        if (newfs_load_inode(dentry) == NULL)
+        {
+            *is_find = 0;
+            return NULL;
+        }
+    }
+    else
+    {
+        newfs_icache_touch(inode);
+    }
+    return dentry;
+}
+/**
+ * @brief 从p开始跳过'/'，取出下一级名字
+ *
+ * @param p
+ * @param len 输出名字长度，路径已经走完时为0
+ * @return const char* 名字的起始位置
+ */
+static inline const char *newfs_path_next(const char *p, int *len)
+{
+    const char *end;
+
+    while (*p == '/')
+    {
+        p++;
+    }
+    for (end = p; *end != '\0' && *end != '/'; end++)
+        ;
+    *len = end - p;
+    return p;
+}
+/**
+ * @brief 同newfs_lookup，但找到的最后一级如果还没读入内存，不读它的inode，
+ * 只需要属性时由调用者决定是否读。
+ *
+ * 直接在只读的path上逐级取名字，按长度比较，一遍走完，不复制路径也不分配
+ * 内存。调用者至少共享持有tree_lock，多个线程可以同时调用，没读入的目录
+ * 由newfs_load_inode读入。
+ *
+ * @param path
+ * @param is_find
+ * @param is_root
+ * @return struct newfs_dentry* 读途经的目录失败时返回NULL，is_find为0
+ */
+struct newfs_dentry *newfs_lookup_lazy(const char *path, int *is_find, int *is_root)
 {
     struct newfs_dentry *dentry_cursor = newfs_super.root_dentry;
     struct newfs_dentry *dentry_ret = NULL;
     struct newfs_inode *inode;
-    int total_lvl = newfs_calc_lvl(path);
-    int lvl = 0;
-    int is_hit;
-    char *fname = NULL;
-    char *path_cpy = (char *)malloc(sizeof(path));
+    const char *fname;
+    int path_len = strlen(path);
+    int len;
+    *is_find = 0;
     *is_root = 0;
-    strcpy(path_cpy, path);
 
-    if (total_lvl == 0) // 根目录
+    fname = newfs_path_next(path, &len);
+    if (len == 0) // 根目录
     {
         *is_find = 1;
         *is_root = 1;
-        dentry_ret = newfs_super.root_dentry;
+        return newfs_super.root_dentry;
+    }
+    if ((dentry_ret = newfs_pcache_find(path, path_len)) != NULL) // 整条路径命中，不用逐级解析
+    {
+        *is_find = 1;
+        return dentry_ret;
     }
-    fname = strtok(path_cpy, "/");
-    while (fname)
+    while (len > 0)
     {
-        lvl++;
-        if (dentry_cursor->inode == NULL) // 内存是磁盘的cache
+        inode = newfs_load_inode(dentry_cursor); // 内存是磁盘的cache
+        if (inode == NULL)
         {
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            NEWFS_DBG("[%s] io error\n", __func__);
+            *is_find = 0;
+            return NULL;
         }
+        newfs_icache_touch(inode);
 
-        inode = dentry_cursor->inode;
-
-        if (NEWFS_IS_REG(inode) && lvl < total_lvl)
+        // 后面还有名字，这一级必须是目录
+        if (NEWFS_IS_REG(inode))
         {
             NEWFS_DBG("[%s] not a dir\n", __func__);
             dentry_ret = inode->dentry;
             break;
         }
-        if (NEWFS_IS_DIR(inode))
+        // 按名字哈希查找，不再遍历兄弟链表
+        dentry_cursor = newfs_dir_index_find(inode, fname, len);
+        if (dentry_cursor == NULL)
+        {
+            NEWFS_DBG("[%s] not found %.*s\n", __func__, len, fname);
+            dentry_ret = inode->dentry;
+            break;
+        }
+        fname = newfs_path_next(fname + len, &len);
+        if (len == 0)
         {
-            dentry_cursor = inode->dentrys;
-            is_hit = 0;
+            *is_find = 1;
+            dentry_ret = dentry_cursor;
+        }
+    }
 
-            while (dentry_cursor)
-            {
-                if (memcmp(dentry_cursor->name, fname, strlen(fname)) == 0)
-                {
-                    is_hit = 1;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
+    if (*is_find)
+    {
+        newfs_pcache_insert(path, path_len, dentry_ret);
+    }
+    return dentry_ret;
+}
+/**
+ * @brief 取inode的属性，不要求持有inode的锁，文件正在写时取到的是写之前或之后的
+ *
+ * @param inode
+ * @param attr
+ */
+void newfs_inode_attr(struct newfs_inode *inode, struct newfs_attr *attr)
+{
+    attr->size = __atomic_load_n(&inode->size, __ATOMIC_RELAXED);
+    attr->atime = __atomic_load_n(&inode->atime, __ATOMIC_RELAXED);
+    attr->mtime = __atomic_load_n(&inode->mtime, __ATOMIC_RELAXED);
+    attr->ctime = __atomic_load_n(&inode->ctime, __ATOMIC_RELAXED);
+}
+/**
+ * @brief 取dentry的属性，不加锁。inode不在内存且readdir读出的属性已过期时
+ * 需要读盘，不能在这里做
+ *
+ * @param dentry
+ * @param attr 输出属性
+ * @return int 需要读盘时返回-NEWFS_ERROR_AGAIN
+ */
+static int newfs_dentry_attr_nolock(struct newfs_dentry *dentry, struct newfs_attr *attr)
+{
+    struct newfs_inode *inode = __atomic_load_n(&dentry->inode, __ATOMIC_ACQUIRE);
 
-            if (!is_hit)
-            {
-                *is_find = 0;
-                NEWFS_DBG("[%s] not found %s\n", __func__, fname);
-                dentry_ret = inode->dentry;
-                break;
-            }
+    if (inode != NULL)
+    {
+        newfs_inode_attr(inode, attr);
+        newfs_icache_touch(inode);
+        return NEWFS_ERROR_NONE;
+    }
+    if (__atomic_load_n(&dentry->attr_expire, __ATOMIC_RELAXED) > newfs_now_ms())
+    {
+        attr->size = __atomic_load_n(&dentry->attr.size, __ATOMIC_RELAXED);
+        attr->atime = __atomic_load_n(&dentry->attr.atime, __ATOMIC_RELAXED);
+        attr->mtime = __atomic_load_n(&dentry->attr.mtime, __ATOMIC_RELAXED);
+        attr->ctime = __atomic_load_n(&dentry->attr.ctime, __ATOMIC_RELAXED);
+        return NEWFS_ERROR_NONE;
+    }
+    return -NEWFS_ERROR_AGAIN;
+}
+/**
+ * @brief 不加锁地查找path并取出属性，供getattr使用。调用者在epoch中，返回
+ * 的dentry在newfs_epoch_exit之前可以访问。
+ *
+ * 逐级查找时先取下一级目录的dseq，再确认当前目录的dseq没变，保证每一级都
+ * 是在上一级确认时还挂在目录树上的；最后一级的属性在所在目录的dseq确认前
+ * 读出。目录改名会把整棵子树移到别处，最后再检查rename_seq。中途遇到inode
+ * 不在内存、哈希表正在修改等情况时放弃，由调用者加锁重来。
+ *
+ * 查到的路径不放进路径缓存：插入与并发的删除之间没有锁，可能留下指向已
+ * 删除dentry的槽。
+ *
+ * @param path
+ * @param dentry 输出，不存在时为NULL
+ * @param attr 输出属性
+ * @param is_root
+ * @return int 需要加锁重来时返回-NEWFS_ERROR_AGAIN
+ */
+int newfs_lookup_nolock(const char *path, struct newfs_dentry **dentry, struct newfs_attr *attr, int *is_root)
+{
+    unsigned int rseq = __atomic_load_n(&newfs_super.rename_seq, __ATOMIC_ACQUIRE);
+    struct newfs_dentry *dentry_cursor = newfs_super.root_dentry;
+    struct newfs_inode *inode, *next_inode;
+    unsigned int seq, next_seq;
+    const char *fname;
+    int len;
+
+    *dentry = NULL;
+    *is_root = 0;
+    if (rseq & 1)
+    {
+        return -NEWFS_ERROR_AGAIN;
+    }
+    fname = newfs_path_next(path, &len);
+    if (len == 0) // 根目录
+    {
+        *is_root = 1;
+        *dentry = dentry_cursor;
+        return newfs_dentry_attr_nolock(dentry_cursor, attr);
+    }
+    // 槽在dentry删除、改名前作废，命中时dentry一定还在原路径上
+    if ((dentry_cursor = newfs_pcache_find(path, strlen(path))) != NULL)
+    {
+        *dentry = dentry_cursor;
+        return newfs_dentry_attr_nolock(dentry_cursor, attr);
+    }
 
-            if (is_hit && lvl == total_lvl)
+    inode = __atomic_load_n(&newfs_super.root_dentry->inode, __ATOMIC_ACQUIRE);
+    seq = newfs_dir_read_begin(inode);
+    if (seq & 1)
+    {
+        return -NEWFS_ERROR_AGAIN;
+    }
+    while (NEWFS_IS_DIR(inode))
+    {
+        newfs_icache_touch(inode);
+        dentry_cursor = newfs_dir_index_find_nolock(inode, fname, len, seq);
+        if (dentry_cursor == NULL)
+        {
+            break;
+        }
+        fname = newfs_path_next(fname + len, &len);
+        if (len == 0)
+        {
+            if (newfs_dentry_attr_nolock(dentry_cursor, attr) != NEWFS_ERROR_NONE)
             {
-                *is_find = 1;
-                dentry_ret = dentry_cursor;
-                break;
+                return -NEWFS_ERROR_AGAIN;
             }
+            *dentry = dentry_cursor;
+            break;
+        }
+        next_inode = __atomic_load_n(&dentry_cursor->inode, __ATOMIC_ACQUIRE);
+        if (next_inode == NULL)
+        {
+            return -NEWFS_ERROR_AGAIN;
+        }
+        next_seq = newfs_dir_read_begin(next_inode);
+        if ((next_seq & 1) || newfs_dir_read_retry(inode, seq))
+        {
+            return -NEWFS_ERROR_AGAIN;
         }
-        fname = strtok(NULL, "/");
+        inode = next_inode;
+        seq = next_seq;
     }
-
-    if (dentry_ret->inode == NULL)
+    // 没找到、中间一级不是目录或者找到了，都要确认最后所在的目录没被改过
+    if (newfs_dir_read_retry(inode, seq) ||
+        __atomic_load_n(&newfs_super.rename_seq, __ATOMIC_RELAXED) != rseq)
     {
-        dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+        *dentry = NULL;
+        return -NEWFS_ERROR_AGAIN;
     }
-
-    return dentry_ret;
+    return NEWFS_ERROR_NONE;
 }
 
 /**
  * @brief 挂载newfs, Layout 如下
  *
  * Layout
- * | Super | Inode Map | Data Map | Inode | Data |
+ * | Super | Inode Map | Data Map | Journal | Inode | Data |
  *
  * 2 * IO_SZ = BLK_SZ
  *
@@ -505,11 +1310,19 @@ int newfs_mount(struct custom_options options)
     int inode_num;      // inode数目
     int map_inode_blks; // ino_map的磁盘块个数
     int map_data_blks;  // data_map占的磁盘块个数
+    int journal_blks;   // 日志区的磁盘块个数
 
     int super_blks;  // 超级块数目
     int is_init = 0; // 是否初始化
 
     newfs_super.is_mounted = 0;
+    pthread_rwlock_init(&newfs_super.tree_lock, NULL);
+    pthread_rwlock_init(&newfs_super.commit_lock, NULL);
+    pthread_mutex_init(&newfs_super.load_lock, NULL);
+    pthread_mutex_init(&newfs_super.dirty_lock, NULL);
+    pthread_mutex_init(&newfs_super.dev_lock, NULL);
+    newfs_super.dirty_inodes = NULL;
+    newfs_super.dirty_bytes = 0;
 
     driver_fd = ddriver_open(options.device);
 
@@ -523,6 +1336,15 @@ int newfs_mount(struct custom_options options)
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
     newfs_super.blks_size = newfs_super.sz_io * 2;
 
+    if (newfs_cache_init(options.cache_blks) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    newfs_pcache_init();
+    newfs_slab_init();
+    newfs_file_init(options.file_cache_blks);
+    newfs_icache_init(options.inode_cache);
+
     // 根目录无父目录，需要新建dentry
     root_dentry = new_dentry("/", NEWFS_DIR);
 
@@ -535,19 +1357,28 @@ int newfs_mount(struct custom_options options)
     { // 第一次挂载 
         // 估算各部分大小 
         super_blks = 1;     // 超级块占1个逻辑块
-        inode_num = 585;    // 索引节点占585逻辑块，一个逻辑块放一个节点
+        inode_num = 585;    // 索引节点占585逻辑块，一个逻辑块放NEWFS_INODE_PER_BLK个节点
         map_inode_blks = 1; // 索引节点位图占1个逻辑块
         map_data_blks = 1;  // 数据块位图占1个逻辑块
-        newfs_super_d.ino_max = inode_num;
+        journal_blks = NEWFS_JOURNAL_BLKS;
+        // inode数受inode区和inode位图二者中较小的一方限制
+        newfs_super_d.ino_max = inode_num * NEWFS_INODE_PER_BLK;
+        if (newfs_super_d.ino_max > NEWFS_BLKS_SZ(map_inode_blks) * UINT8_BITS)
+        {
+            newfs_super_d.ino_max = NEWFS_BLKS_SZ(map_inode_blks) * UINT8_BITS;
+        }
         newfs_super_d.ino_map_offset = NEWFS_BLKS_SZ(super_blks); // 索引节点位图的位置在超级块之后
         newfs_super_d.ino_map_blks = map_inode_blks;
         newfs_super_d.data_map_offset = NEWFS_BLKS_SZ((super_blks + map_inode_blks)); // 数据块位图在索引节点位图之后
         newfs_super_d.data_map_blks = map_data_blks;
 
-        newfs_super_d.ino_offset = NEWFS_BLKS_SZ((super_blks + map_inode_blks + map_data_blks)); // 第一个inode在磁盘中的位置
+        newfs_super_d.journal_offset = NEWFS_BLKS_SZ((super_blks + map_inode_blks + map_data_blks)); // 日志区紧跟在位图之后
+        newfs_super_d.journal_blks = journal_blks;
+
+        newfs_super_d.ino_offset = NEWFS_BLKS_SZ((super_blks + map_inode_blks + map_data_blks + journal_blks)); // 第一个inode在磁盘中的位置
         newfs_super_d.ino_blks = inode_num;
 
-        newfs_super_d.data_offset = NEWFS_BLKS_SZ((super_blks + map_inode_blks + map_data_blks + newfs_super_d.ino_blks)); // 第一个数据块在磁盘中的位置
+        newfs_super_d.data_offset = NEWFS_BLKS_SZ((super_blks + map_inode_blks + map_data_blks + journal_blks + newfs_super_d.ino_blks)); // 第一个数据块在磁盘中的位置
         newfs_super_d.sz_usage = 0;
 
         is_init = 1;
@@ -570,6 +1401,14 @@ int newfs_mount(struct custom_options options)
     newfs_super.data_offset = newfs_super_d.data_offset;
     newfs_super.ino_offset = newfs_super_d.ino_offset;
     newfs_super.ino_blks = newfs_super_d.ino_blks;
+    newfs_super.journal_offset = newfs_super_d.journal_offset;
+    newfs_super.journal_blks = newfs_super_d.journal_blks;
+
+    // 位图和inode可能还在日志里，读它们之前先重放
+    if (newfs_journal_init(newfs_super.journal_offset, newfs_super.journal_blks, is_init) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
 
     if (newfs_driver_read(newfs_super_d.ino_map_offset, (uint8_t *)(newfs_super.ino_map), NEWFS_BLKS_SZ(newfs_super_d.ino_map_blks)) != NEWFS_ERROR_NONE)
     {
@@ -581,17 +1420,50 @@ int newfs_mount(struct custom_options options)
         return -NEWFS_ERROR_IO;
     }
 
+    // 数据块位图覆盖数据区的所有块
+    newfs_super.data_blks = NEWFS_DISK_SZ() / NEWFS_BLKS_SZ(1) - newfs_super.data_offset / NEWFS_BLKS_SZ(1);
+    if (newfs_super.data_blks > NEWFS_BLKS_SZ(newfs_super.data_map_blks) * UINT8_BITS)
+    {
+        newfs_super.data_blks = NEWFS_BLKS_SZ(newfs_super.data_map_blks) * UINT8_BITS;
+    }
+    if (newfs_bitmap_init(&newfs_super.ino_bm, newfs_super.ino_map, newfs_super.ino_max) != NEWFS_ERROR_NONE ||
+        newfs_bitmap_init(&newfs_super.data_bm, newfs_super.data_map, newfs_super.data_blks) != NEWFS_ERROR_NONE ||
+        newfs_itable_init(newfs_super.ino_blks) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    // 可选：一次顺序读入整个inode表，之后遍历目录树不再逐个读inode
+    if (!is_init && options.inode_warmup && newfs_itable_warmup() != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
+
     // 构建根目录的inode
     if (is_init)
     { // 分配根节点
         root_inode = newfs_alloc_inode(root_dentry);
         newfs_sync_inode(root_inode);
+        newfs_extent_destroy(root_inode);
+        newfs_icache_remove(root_inode);
+        newfs_inode_free(root_inode);
+        // 格式化的结果直接写回原位，之后挂载时才能从超级块找到日志区
+        if (newfs_flush() != NEWFS_ERROR_NONE ||
+            newfs_sync_super() != NEWFS_ERROR_NONE ||
+            newfs_journal_checkpoint() != NEWFS_ERROR_NONE)
+        {
+            return -NEWFS_ERROR_IO;
+        }
     }
     root_inode = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
     root_dentry->inode = root_inode;
     newfs_super.root_dentry = root_dentry;
     newfs_super.is_mounted = 1;
 
+    if (newfs_wb_start(options) != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
     return ret;
 }
 
@@ -609,44 +1481,77 @@ void newfs_sync_super_blk(struct newfs_super_d *newfs_super_d)
     newfs_super_d->ino_offset = newfs_super.ino_offset;
     newfs_super_d->data_offset = newfs_super.data_offset;
     newfs_super_d->ino_blks = newfs_super.ino_blks;
+    newfs_super_d->journal_offset = newfs_super.journal_offset;
+    newfs_super_d->journal_blks = newfs_super.journal_blks;
 }
 
 /**
- * @brief
+ * @brief 写回超级块
  *
  * @return int
  */
-int newfs_umount()
+int newfs_sync_super()
 {
     struct newfs_super_d newfs_super_d;
 
+    newfs_sync_super_blk(&newfs_super_d);
+    return newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, sizeof(struct newfs_super_d));
+}
+/**
+ * @brief
+ *
+ * @return int
+ */
+int newfs_umount()
+{
     if (!newfs_super.is_mounted)
     {
         return NEWFS_ERROR_NONE;
     }
+    // 回写线程退出后，剩下的脏数据由这里一次写完
+    newfs_wb_stop();
+    newfs_icache_drop_orphans();
+    // 只改了访问时间的inode不在脏链表上，先把它们的记录写下
+    newfs_icache_sync_atime();
 
-    newfs_sync_inode(newfs_super.root_dentry->inode); /* 递归刷写节点 */
-
-    newfs_sync_super_blk(&newfs_super_d);
+    // 只写回有修改的inode、目录项块、数据块和位图范围
+    if (newfs_flush() != NEWFS_ERROR_NONE)
+    {
+        return -NEWFS_ERROR_IO;
+    }
 
-    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE)
+    if (newfs_sync_super() != NEWFS_ERROR_NONE)
     {
         return -NEWFS_ERROR_IO;
     }
 
-    // 清空inode位图
-    if (newfs_driver_write(newfs_super_d.ino_map_offset, (uint8_t *)(newfs_super.ino_map), NEWFS_BLKS_SZ(newfs_super.ino_map_blks)) != NEWFS_ERROR_NONE)
+    // 卸载时把日志里的块全部写回原位，下次挂载不需要重放
+    if (newfs_journal_checkpoint() != NEWFS_ERROR_NONE)
     {
         return -NEWFS_ERROR_IO;
     }
+
+    // 位图的修改已在newfs_flush中按范围写回
+    newfs_bitmap_destroy(&newfs_super.ino_bm);
     free(newfs_super.ino_map);
+    newfs_bitmap_destroy(&newfs_super.data_bm);
+    free(newfs_super.data_map);
 
-    // 清空数据块位图
-    if (newfs_driver_write(newfs_super_d.data_map_offset, (uint8_t *)(newfs_super.data_map), NEWFS_BLKS_SZ(newfs_super.data_map_blks)) != NEWFS_ERROR_NONE)
+    // 脏块全部写回后才能关闭设备
+    if (newfs_cache_flush() != NEWFS_ERROR_NONE)
     {
         return -NEWFS_ERROR_IO;
     }
-    free(newfs_super.data_map);
+    newfs_dump_stats();
+    newfs_journal_destroy();
+    newfs_itable_destroy();
+    newfs_cache_destroy();
+    newfs_pcache_destroy();
+    newfs_file_destroy();
+    // inode各自的数组先释放，目录树中的dentry和inode随slab整批释放
+    newfs_icache_destroy();
+    newfs_slab_destroy();
+    newfs_super.root_dentry = NULL;
 
     ddriver_close(NEWFS_DRIVER());
 
@@ -0,0 +1,238 @@
+#include "newfs.h"
+
+extern struct newfs_super newfs_super; // 内存超级块
+
+/*
+ * 回写线程：每隔flush_interval醒来一次，把脏了超过dirty_expire的inode写回；
+ * 脏字节数超过dirty_bg时被写者提前唤醒，把所有脏inode写回。脏字节数超过
+ * dirty_limit时写者在newfs_wb_throttle中等待，直到一轮回写结束。
+ * 回写一轮时共享持有tree_lock、独占持有commit_lock：查找、读、取属性照常
+ * 进行，修改文件的操作等这一轮提交完。newfs_wb.lock只配合条件变量使用，
+ * 持有它时不再拿文件系统的锁。
+ */
+static struct newfs_writeback newfs_wb;
+static int newfs_wb_interval;  // ms
+static int newfs_wb_expire;    // ms
+static long newfs_wb_bg;       // 字节
+static long newfs_wb_limit;    // 字节
+
+/**
+ * @brief 单调时钟，单位ms
+ *
+ * @return long
+ */
+long newfs_now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+/**
+ * @brief 回写一轮，调用者共享持有tree_lock、独占持有commit_lock
+ *
+ * @param all 为1时写回所有脏inode，否则只写回超时的
+ * @return int
+ */
+static int newfs_wb_run(int all)
+{
+    struct newfs_inode *inode = newfs_super.dirty_inodes;
+    struct newfs_inode *next;
+    long now = newfs_now_ms();
+    long bytes;
+    int ret = NEWFS_ERROR_NONE;
+
+    if (inode == NULL)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+    if (!all && newfs_journal_enabled())
+    {
+        // 一轮回写是一个事务，只写超时的inode会把一次操作拆到两个事务里，
+        // 有inode超时就整轮写回
+        for (; inode != NULL && now - inode->dirtied_at < newfs_wb_expire; inode = inode->dirty_next)
+            ;
+        if (inode == NULL)
+        {
+            return NEWFS_ERROR_NONE;
+        }
+        all = 1;
+        inode = newfs_super.dirty_inodes;
+    }
+    for (; inode != NULL; inode = next)
+    {
+        next = inode->dirty_next;
+        if (!all && now - inode->dirtied_at < newfs_wb_expire)
+        {
+            continue;
+        }
+        bytes = inode->dirty_bytes;
+        if (newfs_sync_inode(inode) != NEWFS_ERROR_NONE)
+        {
+            ret = -NEWFS_ERROR_IO;
+            continue;
+        }
+        newfs_wb.stats.inodes_written++;
+        newfs_wb.stats.bytes_written += bytes;
+    }
+    // 位图、超级块和缓存中的脏块一起落盘，元数据作为一个事务提交
+    if (newfs_bitmap_sync(&newfs_super.ino_bm, newfs_super.ino_map_offset) != NEWFS_ERROR_NONE ||
+        newfs_bitmap_sync(&newfs_super.data_bm, newfs_super.data_map_offset) != NEWFS_ERROR_NONE ||
+        newfs_sync_super() != NEWFS_ERROR_NONE ||
+        newfs_journal_commit() != NEWFS_ERROR_NONE ||
+        newfs_cache_flush() != NEWFS_ERROR_NONE)
+    {
+        ret = -NEWFS_ERROR_IO;
+    }
+    newfs_wb.stats.cycles++;
+    return ret;
+}
+/**
+ * @brief 加锁回写一轮，调用者不能持有文件系统的锁
+ *
+ * @param all
+ * @return int
+ */
+static int newfs_wb_flush(int all)
+{
+    int ret;
+
+    pthread_rwlock_rdlock(&newfs_super.tree_lock);
+    pthread_rwlock_wrlock(&newfs_super.commit_lock);
+    ret = newfs_wb_run(all);
+    pthread_rwlock_unlock(&newfs_super.commit_lock);
+    pthread_rwlock_unlock(&newfs_super.tree_lock);
+    return ret;
+}
+
+static void *newfs_wb_thread(void *arg)
+{
+    struct timespec deadline;
+    int all;
+
+    (void)arg;
+    pthread_mutex_lock(&newfs_wb.lock);
+    while (!newfs_wb.stop)
+    {
+        if (newfs_super.dirty_bytes < newfs_wb_bg)
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += newfs_wb_interval / 1000;
+            deadline.tv_nsec += (newfs_wb_interval % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&newfs_wb.wake, &newfs_wb.lock, &deadline);
+        }
+        if (newfs_wb.stop)
+        {
+            break;
+        }
+        all = newfs_super.dirty_bytes >= newfs_wb_bg;
+        // 回写期间放开newfs_wb.lock，写者这时发的唤醒由下一轮开头的检查接住
+        pthread_mutex_unlock(&newfs_wb.lock);
+        if (newfs_wb_flush(all) != NEWFS_ERROR_NONE)
+        {
+            NEWFS_DBG("[%s] writeback error\n", __func__);
+        }
+        pthread_mutex_lock(&newfs_wb.lock);
+        pthread_cond_broadcast(&newfs_wb.drained);
+    }
+    pthread_mutex_unlock(&newfs_wb.lock);
+    return NULL;
+}
+/**
+ * @brief 按挂载参数启动回写线程
+ *
+ * @param options
+ * @return int
+ */
+int newfs_wb_start(struct custom_options options)
+{
+    memset(&newfs_wb, 0, sizeof(struct newfs_writeback));
+    pthread_mutex_init(&newfs_wb.lock, NULL);
+    newfs_wb_interval = options.flush_interval;
+    newfs_wb_expire = options.dirty_expire;
+    newfs_wb_bg = options.dirty_bg_kb * 1024L;
+    newfs_wb_limit = options.dirty_limit_kb * 1024L;
+    if (newfs_wb_limit > 0 && newfs_wb_bg > newfs_wb_limit)
+    {
+        newfs_wb_bg = newfs_wb_limit;
+    }
+    if (newfs_wb_interval <= 0)
+    {
+        return NEWFS_ERROR_NONE;
+    }
+
+    pthread_cond_init(&newfs_wb.wake, NULL);
+    pthread_cond_init(&newfs_wb.drained, NULL);
+    if (pthread_create(&newfs_wb.thread, NULL, newfs_wb_thread, NULL) != 0)
+    {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    newfs_wb.running = 1;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 停止回写线程，调用者不能持有文件系统的锁
+ */
+void newfs_wb_stop()
+{
+    if (!newfs_wb.running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&newfs_wb.lock);
+    newfs_wb.stop = 1;
+    pthread_cond_signal(&newfs_wb.wake);
+    pthread_cond_broadcast(&newfs_wb.drained);
+    pthread_mutex_unlock(&newfs_wb.lock);
+    pthread_join(newfs_wb.thread, NULL);
+    newfs_wb.running = 0;
+    pthread_cond_destroy(&newfs_wb.wake);
+    pthread_cond_destroy(&newfs_wb.drained);
+}
+/**
+ * @brief 写者在拿文件系统的锁之前调用。脏数据超过后台阈值时唤醒回写线程，
+ * 超过上限时等待回写。dirty_bytes不加锁读，差一点只影响等待的时机
+ */
+void newfs_wb_throttle()
+{
+    long start;
+
+    if (newfs_wb_limit > 0 && newfs_super.dirty_bytes >= newfs_wb_limit)
+    {
+        start = newfs_now_ms();
+        if (!newfs_wb.running)
+        {
+            // 没有回写线程时由写者自己写回
+            newfs_wb_flush(1);
+        }
+        pthread_mutex_lock(&newfs_wb.lock);
+        newfs_wb.stats.throttled++;
+        while (newfs_wb.running && !newfs_wb.stop && newfs_super.dirty_bytes >= newfs_wb_limit)
+        {
+            pthread_cond_signal(&newfs_wb.wake);
+            pthread_cond_wait(&newfs_wb.drained, &newfs_wb.lock);
+        }
+        newfs_wb.stats.throttled_ms += newfs_now_ms() - start;
+        pthread_mutex_unlock(&newfs_wb.lock);
+    }
+    else if (newfs_wb.running && newfs_super.dirty_bytes >= newfs_wb_bg)
+    {
+        pthread_mutex_lock(&newfs_wb.lock);
+        pthread_cond_signal(&newfs_wb.wake);
+        pthread_mutex_unlock(&newfs_wb.lock);
+    }
+}
+/**
+ * @brief 打印回写统计
+ */
+void newfs_wb_dump_stats()
+{
+    NEWFS_DBG("[writeback] cycles %ld, inodes %ld, bytes %ld, throttled %ld (%ld ms), dirty now %ld\n",
+              newfs_wb.stats.cycles, newfs_wb.stats.inodes_written, newfs_wb.stats.bytes_written,
+              newfs_wb.stats.throttled, newfs_wb.stats.throttled_ms, newfs_super.dirty_bytes);
+}
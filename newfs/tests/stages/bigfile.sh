@@ -0,0 +1,81 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - big file"
+
+# 约100KB，远超6个块，映射要用到多个extent
+GOLDEN_FILE=$(mktemp)
+seq 1 20000 > "$GOLDEN_FILE"
+
+function check_write_big () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    if ! cp "$_PARAM" "${MNTPOINT}"/bigfile; then
+        fail "$_TEST_CASE: 写入大文件${MNTPOINT}/bigfile失败"
+        return 1
+    fi
+    return 0
+}
+
+function check_read_big () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! cat "${MNTPOINT}"/bigfile > /dev/null; then
+        fail "$_TEST_CASE: 读文件${MNTPOINT}/bigfile失败"
+        return 1
+    fi
+
+    if ! cmp -s "$_PARAM" "${MNTPOINT}"/bigfile; then
+        fail "$_TEST_CASE: 读文件${MNTPOINT}/bigfile成功, 但内容与写入的不同"
+        return 1
+    fi
+    return 0
+}
+
+function check_overwrite_big () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 改写文件中间跨块的一段，文件大小不变
+    printf 'newfs-overwrite' | dd of="$_PARAM" bs=1 seek=50000 conv=notrunc status=none
+    if ! printf 'newfs-overwrite' | dd of="${MNTPOINT}"/bigfile bs=1 seek=50000 conv=notrunc status=none; then
+        fail "$_TEST_CASE: 改写文件${MNTPOINT}/bigfile失败"
+        return 1
+    fi
+    check_read_big "$_PARAM" "$_TEST_CASE"
+}
+
+function check_too_big () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 超出文件大小上限的写和截断都应失败，文件保持原样
+    if printf 'x' | dd of="${MNTPOINT}"/bigfile bs=1 seek=4294967296 conv=notrunc status=none 2> /dev/null ||
+       truncate -s 4G "${MNTPOINT}"/bigfile 2> /dev/null; then
+        fail "$_TEST_CASE: 在4GB处写入或截断到4GB应该失败, 但返回了成功"
+        return 1
+    fi
+    check_read_big "$_PARAM" "$_TEST_CASE"
+}
+
+
+try_mount_or_fail
+
+TEST_CASE="case 8.1 - write ${MNTPOINT}/bigfile"
+core_tester ls "$GOLDEN_FILE" check_write_big "$TEST_CASE"
+
+TEST_CASE="case 8.2 - read ${MNTPOINT}/bigfile"
+core_tester ls "$GOLDEN_FILE" check_read_big "$TEST_CASE"
+
+TEST_CASE="case 8.3 - overwrite ${MNTPOINT}/bigfile"
+core_tester ls "$GOLDEN_FILE" check_overwrite_big "$TEST_CASE"
+
+TEST_CASE="case 8.4 - write ${MNTPOINT}/bigfile past the size limit"
+core_tester ls "$GOLDEN_FILE" check_too_big "$TEST_CASE"
+
+remount_or_fail
+
+TEST_CASE="case 8.5 - read ${MNTPOINT}/bigfile after remount"
+core_tester ls "$GOLDEN_FILE" check_read_big "$TEST_CASE"
+
+rm -f "$GOLDEN_FILE"
@@ -0,0 +1,98 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - many entries"
+
+# 一个目录下的文件数，目录项要占多个块
+ENTRY_CNT=200
+
+# 第i个文件的名字，长度从几个字节到上百字节不等
+function entry_name () {
+    _LEN=$(( ($1 * 37) % 120 ))
+    printf "f%d_%s" "$1" "$(printf '%*s' "$_LEN" '' | tr ' ' 'x')"
+}
+
+function check_ls_many () {
+    _PARAM=$1
+    _TEST_CASE=$2
+    _STEP=${3:-1}
+    OUTPUT=$(ls "$_PARAM")
+
+    CNT=$(echo "$OUTPUT" | grep -c .)
+    EXPECT=$(( (ENTRY_CNT + _STEP - 1) / _STEP ))
+    if (( CNT != EXPECT )); then
+        fail "$_TEST_CASE: ls $_PARAM列出了$CNT项, 应该为$EXPECT项"
+        return 1
+    fi
+
+    for (( i = 0; i < ENTRY_CNT; i += _STEP )); do
+        if ! echo "$OUTPUT" | grep -qx "$(entry_name "$i")"; then
+            fail "$_TEST_CASE: $(entry_name "$i")没有在ls的输出结果中找到"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_create_many () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    for (( i = 0; i < ENTRY_CNT; i++ )); do
+        touch "$_PARAM/$(entry_name "$i")"
+    done
+    check_ls_many "$_PARAM" "$_TEST_CASE"
+}
+
+function check_stat_many () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    for (( i = ENTRY_CNT - 1; i >= 0; i-- )); do
+        if ! stat "$_PARAM/$(entry_name "$i")" > /dev/null; then
+            fail "$_TEST_CASE: 找不到文件$_PARAM/$(entry_name "$i")"
+            return 1
+        fi
+    done
+    if stat "$_PARAM/$(entry_name "$ENTRY_CNT")" > /dev/null 2>&1; then
+        fail "$_TEST_CASE: 不存在的文件$_PARAM/$(entry_name "$ENTRY_CNT")被找到"
+        return 1
+    fi
+    return 0
+}
+
+function check_remove_many () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    # 删掉奇数号的文件，目录项块中间留下空洞
+    for (( i = 1; i < ENTRY_CNT; i += 2 )); do
+        if ! rm "$_PARAM/$(entry_name "$i")"; then
+            fail "$_TEST_CASE: 删除文件$_PARAM/$(entry_name "$i")失败"
+            return 1
+        fi
+    done
+    check_ls_many "$_PARAM" "$_TEST_CASE" 2
+}
+
+function check_ls_half () {
+    check_ls_many "$1" "$2" 2
+}
+
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/many
+
+TEST_CASE="case 9.1 - create $ENTRY_CNT files in ${MNTPOINT}/many"
+core_tester ls "${MNTPOINT}"/many check_create_many "$TEST_CASE"
+
+TEST_CASE="case 9.2 - stat every file in ${MNTPOINT}/many"
+core_tester ls "${MNTPOINT}"/many check_stat_many "$TEST_CASE"
+
+TEST_CASE="case 9.3 - remove half of ${MNTPOINT}/many"
+core_tester ls "${MNTPOINT}"/many check_remove_many "$TEST_CASE"
+
+remount_or_fail
+
+TEST_CASE="case 9.4 - ls ${MNTPOINT}/many after remount"
+core_tester ls "${MNTPOINT}"/many check_ls_half "$TEST_CASE"
@@ -0,0 +1,59 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - metadata after remount"
+
+# 卸载前记下的目录树：每项的路径、类型、大小和修改时间
+META_BEFORE=""
+
+function dump_meta () {
+    (cd "$1" && find . | sort | xargs stat -c '%n %F %s %Y')
+}
+
+function check_modify_meta () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir -p "$_PARAM"/a/b/c "$_PARAM"/d
+    echo "hello" > "$_PARAM"/a/b/c/f1
+    echo "world" > "$_PARAM"/a/f2
+    seq 1 3000 > "$_PARAM"/d/f3
+    touch "$_PARAM"/a/b/gone "$_PARAM"/a/b/c/g1
+    # 改名、跨目录移动、删除、截断和修改时间都要在重新挂载后保持
+    if ! mv "$_PARAM"/a/f2 "$_PARAM"/d/f2 || ! mv "$_PARAM"/a/b/c/g1 "$_PARAM"/a/b/c/g2 ||
+       ! rm "$_PARAM"/a/b/gone || ! truncate -s 1000 "$_PARAM"/d/f3 ||
+       ! touch -m -d '2020-01-02 03:04:05' "$_PARAM"/a/b/c/f1; then
+        fail "$_TEST_CASE: 在${_PARAM}下修改目录树失败"
+        return 1
+    fi
+    META_BEFORE=$(dump_meta "$_PARAM")
+    return 0
+}
+
+function check_meta () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    META_AFTER=$(dump_meta "$_PARAM")
+    if [[ "${META_AFTER}" != "${META_BEFORE}" ]]; then
+        fail "$_TEST_CASE: 重新挂载后${_PARAM}下的目录树与卸载前不同, 卸载前为: $META_BEFORE"
+        return 1
+    fi
+    if [[ "$(cat "$_PARAM"/d/f2)" != "world" ]] || ! head -c 1000 <(seq 1 3000) | cmp -s - "$_PARAM"/d/f3; then
+        fail "$_TEST_CASE: 重新挂载后${_PARAM}下文件的内容不正确"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/persist
+
+TEST_CASE="case 10.1 - modify ${MNTPOINT}/persist"
+core_tester ls "${MNTPOINT}"/persist check_modify_meta "$TEST_CASE"
+
+remount_or_fail
+
+TEST_CASE="case 10.2 - check ${MNTPOINT}/persist after remount"
+core_tester ls "${MNTPOINT}"/persist check_meta "$TEST_CASE"
@@ -0,0 +1,74 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - rename"
+
+# mv会先自己检查类型，这里直接调用rename(2)，输出OK或错误码的名字
+function rename_errno () {
+    python3 -c '
+import errno, os, sys
+try:
+    os.rename(sys.argv[1], sys.argv[2])
+    print("OK")
+except OSError as e:
+    print(errno.errorcode[e.errno])' "$1" "$2"
+}
+
+function check_rename_errno () {
+    _FROM=$1
+    _TO=$2
+    _EXPECT=$3
+    _TEST_CASE=$4
+
+    OUTPUT=$(rename_errno "$_FROM" "$_TO")
+    if [[ "${OUTPUT}" != "${_EXPECT}" ]]; then
+        fail "$_TEST_CASE: rename $_FROM $_TO 的结果为$OUTPUT, 应该为$_EXPECT"
+        return 1
+    fi
+    return 0
+}
+
+function check_rename_type () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "$_PARAM"/d
+    mkdir_and_check "$_PARAM"/e
+    touch_and_check "$_PARAM"/f
+    touch_and_check "$_PARAM"/g
+    # 目录不能覆盖文件，文件不能覆盖目录
+    check_rename_errno "$_PARAM"/d "$_PARAM"/f ENOTDIR "$_TEST_CASE" || return 1
+    check_rename_errno "$_PARAM"/g "$_PARAM"/e EISDIR "$_TEST_CASE" || return 1
+    # 同类型的覆盖成功
+    echo "gg" > "$_PARAM"/g
+    check_rename_errno "$_PARAM"/g "$_PARAM"/f OK "$_TEST_CASE" || return 1
+    check_rename_errno "$_PARAM"/d "$_PARAM"/e OK "$_TEST_CASE" || return 1
+    return 0
+}
+
+function check_rename_result () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if [ ! -d "$_PARAM"/e ] || [ ! -f "$_PARAM"/f ] || [ -e "$_PARAM"/d ] || [ -e "$_PARAM"/g ]; then
+        fail "$_TEST_CASE: 重新挂载后${_PARAM}下应该只有目录e和文件f"
+        return 1
+    fi
+    if [[ "$(cat "$_PARAM"/f)" != "gg" ]]; then
+        fail "$_TEST_CASE: 重新挂载后文件$_PARAM/f的内容不正确, 应该为: gg"
+        return 1
+    fi
+    return 0
+}
+
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/rename
+
+TEST_CASE="case 11.1 - rename over a target of the other type in ${MNTPOINT}/rename"
+core_tester ls "${MNTPOINT}"/rename check_rename_type "$TEST_CASE"
+
+remount_or_fail
+
+TEST_CASE="case 11.2 - check ${MNTPOINT}/rename after remount"
+core_tester ls "${MNTPOINT}"/rename check_rename_result "$TEST_CASE"
@@ -8,6 +8,8 @@ int ddriver_open(char *path);
 int ddriver_seek(int fd, off_t offset, int whence);
 int ddriver_write(int fd, char *buf, size_t size);
 int ddriver_read(int fd, char *buf, size_t size);
+int ddriver_writev(int fd, struct ddriver_iovec *iov, int iovcnt);
+int ddriver_readv(int fd, struct ddriver_iovec *iov, int iovcnt);
 int ddriver_ioctl(int fd, unsigned long cmd, void *ret);
 int ddriver_close(int fd);
 
@@ -2,6 +2,7 @@
 #define _DDRIVER_CTL_H_
 
 #include <sys/ioctl.h>   
+#include <sys/types.h>
 /******************************************************************************
 * SECTION: IO ctl protocol definitions
 *******************************************************************************/
@@ -13,6 +14,13 @@ struct ddriver_state
     int seek_cnt;
 };
 
+struct ddriver_iovec                              /* 向量化IO的一段 */
+{
+    off_t  offset;                                /* 设备偏移，对齐到IO单位 */
+    char*  buf;
+    size_t size;                                  /* IO单位的整数倍 */
+};
+
 #define IOC_REQ_DEVICE_SIZE     _IOR(IOC_MAGIC, 0, int)
 #define IOC_REQ_DEVICE_STATE    _IOR(IOC_MAGIC, 1, struct ddriver_state)
 #define IOC_REQ_DEVICE_RESET    _IO(IOC_MAGIC, 2)
@@ -17,6 +17,7 @@ typedef enum sfs_file_type {
 *******************************************************************************/
 #define TRUE                    1
 #define FALSE                   0
+#define UINT64_BITS             64
 #define UINT32_BITS             32
 #define UINT8_BITS              8
 
@@ -100,6 +101,19 @@ struct sfs_dentry
     SFS_FILE_TYPE      ftype;
 };
 
+struct sfs_bounce
+{
+    uint8_t*           buf;                           /* 按IO单元对齐 */
+    int                size;
+};
+
+struct sfs_io_stats
+{
+    long               direct;                        /* 对齐请求直接读写调用者缓冲区的次数 */
+    long               bounced;                       /* 经过中转缓冲区的次数 */
+    long               allocs;                        /* 中转缓冲区分配或扩大的次数 */
+};
+
 struct sfs_super
 {
     int                driver_fd;
@@ -112,12 +126,15 @@ struct sfs_super
     uint8_t*           map_inode;
     int                map_inode_blks;
     int                map_inode_offset;
+    int                map_inode_hint;                /* 下次分配从这个64位字开始找 */
     
     int                data_offset;
 
     boolean            is_mounted;
 
     struct sfs_dentry* root_dentry;
+
+    struct sfs_io_stats io_stats;                     /* 驱动读写的统计 */
 };
 
 static inline struct sfs_dentry* new_dentry(char * fname, SFS_FILE_TYPE ftype) {
@@ -37,8 +37,57 @@ int sfs_calc_lvl(const char * path) {
     }
     return lvl;
 }
+static pthread_key_t  sfs_bounce_key;
+static pthread_once_t sfs_bounce_once = PTHREAD_ONCE_INIT;
+
+#define SFS_IO_STAT_INC(field)  __atomic_fetch_add(&sfs_super.io_stats.field, 1, __ATOMIC_RELAXED)
+
+static void sfs_bounce_release(void* arg) {
+    struct sfs_bounce* bounce = (struct sfs_bounce *)arg;
+    free(bounce->buf);
+    free(bounce);
+}
+static void sfs_bounce_key_init() {
+    pthread_key_create(&sfs_bounce_key, sfs_bounce_release);
+}
+/**
+ * @brief 取本线程至少size字节、按IO单元对齐的中转缓冲区，只在不够大时扩大，
+ * 线程退出时释放
+ * 
+ * @param size 
+ * @return uint8_t* 
+ */
+static uint8_t* sfs_bounce_get(int size) {
+    struct sfs_bounce* bounce;
+    void*              buf;
+    int                cap;
+
+    pthread_once(&sfs_bounce_once, sfs_bounce_key_init);
+    bounce = (struct sfs_bounce *)pthread_getspecific(sfs_bounce_key);
+    if (bounce == NULL) {
+        bounce = (struct sfs_bounce *)calloc(1, sizeof(struct sfs_bounce));
+        if (bounce == NULL || pthread_setspecific(sfs_bounce_key, bounce) != 0) {
+            free(bounce);
+            return NULL;
+        }
+    }
+    SFS_IO_STAT_INC(bounced);
+    if (bounce->size >= size) {
+        return bounce->buf;
+    }
+    for (cap = bounce->size > 0 ? bounce->size : SFS_IO_SZ(); cap < size; cap *= 2)
+        ;
+    if (posix_memalign(&buf, SFS_IO_SZ(), cap) != 0) {
+        return NULL;
+    }
+    free(bounce->buf);
+    bounce->buf  = (uint8_t *)buf;
+    bounce->size = cap;
+    SFS_IO_STAT_INC(allocs);
+    return bounce->buf;
+}
 /**
- * @brief 驱动读
+ * @brief 驱动读，对齐的请求直接读进调用者的缓冲区
  * 
  * @param offset 
  * @param out_content 
@@ -49,23 +98,30 @@ int sfs_driver_read(int offset, uint8_t *out_content, int size) {
     int      offset_aligned = SFS_ROUND_DOWN(offset, SFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_read(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    uint8_t* temp_content;
+    struct ddriver_iovec iov;
+
+    if (bias == 0 && size_aligned == size) {
+        temp_content = out_content;
+        SFS_IO_STAT_INC(direct);
+    }
+    else if ((temp_content = sfs_bounce_get(size_aligned)) == NULL) {
+        return -SFS_ERROR_NOSPACE;
+    }
+                                                      /* 整段只发一次设备请求 */
+    iov.offset = offset_aligned;
+    iov.buf    = (char *)temp_content;
+    iov.size   = size_aligned;
+    if (ddriver_readv(SFS_DRIVER(), &iov, 1) < 0) {
+        return -SFS_ERROR_IO;
+    }
+    if (temp_content != out_content) {
+        memcpy(out_content, temp_content + bias, size);
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
     return SFS_ERROR_NONE;
 }
 /**
- * @brief 驱动写
+ * @brief 驱动写，对齐的请求直接从调用者的缓冲区写出
  * 
  * @param offset 
  * @param in_content 
@@ -76,22 +132,30 @@ int sfs_driver_write(int offset, uint8_t *in_content, int size) {
     int      offset_aligned = SFS_ROUND_DOWN(offset, SFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = SFS_ROUND_UP((size + bias), SFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
-    sfs_driver_read(offset_aligned, temp_content, size_aligned);
-    memcpy(temp_content + bias, in_content, size);
+    uint8_t* temp_content;
+    struct ddriver_iovec iov;
+
+    if (bias == 0 && size_aligned == size) {
+        SFS_IO_STAT_INC(direct);
+        temp_content = in_content;
+    }
+    else {
+        if ((temp_content = sfs_bounce_get(size_aligned)) == NULL) {
+            return -SFS_ERROR_NOSPACE;
+        }
+                                                      /* 对齐的整段读入中转缓冲区，不再中转第二次 */
+        if (sfs_driver_read(offset_aligned, temp_content, size_aligned) != SFS_ERROR_NONE) {
+            return -SFS_ERROR_IO;
+        }
+        memcpy(temp_content + bias, in_content, size);
+    }
     
-    // lseek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    ddriver_seek(SFS_DRIVER(), offset_aligned, SEEK_SET);
-    while (size_aligned != 0)
-    {
-        // write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        ddriver_write(SFS_DRIVER(), cur, SFS_IO_SZ());
-        cur          += SFS_IO_SZ();
-        size_aligned -= SFS_IO_SZ();   
+    iov.offset = offset_aligned;
+    iov.buf    = (char *)temp_content;
+    iov.size   = size_aligned;
+    if (ddriver_writev(SFS_DRIVER(), &iov, 1) < 0) {
+        return -SFS_ERROR_IO;
     }
-
-    free(temp_content);
     return SFS_ERROR_NONE;
 }
 /**
@@ -153,29 +217,32 @@ int sfs_drop_dentry(struct sfs_inode * inode, struct sfs_dentry * dentry) {
  */
 struct sfs_inode* sfs_alloc_inode(struct sfs_dentry * dentry) {
     struct sfs_inode* inode;
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
+    uint64_t* words     = (uint64_t*)sfs_super.map_inode;  /* 小端下与逐字节的位序一致 */
+    int nbits           = sfs_super.max_ino > 0 ? sfs_super.max_ino 
+                          : SFS_BLKS_SZ(sfs_super.map_inode_blks) * UINT8_BITS;
+    int nwords          = (nbits + UINT64_BITS - 1) / UINT64_BITS;
+    int word_cursor     = 0;
+    int ino_cursor      = 0;
+    int i;
+    uint64_t free_bits;
     boolean is_find_free_entry = FALSE;
-
-    for (byte_cursor = 0; byte_cursor < SFS_BLKS_SZ(sfs_super.map_inode_blks); 
-         byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-            if((sfs_super.map_inode[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                                                      /* 当前ino_cursor位置空闲 */
-                sfs_super.map_inode[byte_cursor] |= (0x1 << bit_cursor);
-                is_find_free_entry = TRUE;           
-                break;
-            }
-            ino_cursor++;
+                                                      /* 从上次分配处next-fit，每次跳过一整个64位字 */
+    for (i = 0; i < nwords; i++) {
+        word_cursor = (sfs_super.map_inode_hint + i) % nwords;
+        free_bits   = ~words[word_cursor];
+        if (nbits - word_cursor * UINT64_BITS < UINT64_BITS) {
+            free_bits &= ((uint64_t)1 << (nbits - word_cursor * UINT64_BITS)) - 1;
         }
-        if (is_find_free_entry) {
+        if (free_bits != 0) {
+            ino_cursor = word_cursor * UINT64_BITS + __builtin_ctzll(free_bits);
+            words[word_cursor] |= (uint64_t)1 << (ino_cursor % UINT64_BITS);
+            sfs_super.map_inode_hint = word_cursor;
+            is_find_free_entry = TRUE;
             break;
         }
     }
 
-    if (!is_find_free_entry || ino_cursor == sfs_super.max_ino)
+    if (!is_find_free_entry)
         return -SFS_ERROR_NOSPACE;
 
     inode = (struct sfs_inode*)malloc(sizeof(struct sfs_inode));
@@ -285,11 +352,6 @@ int sfs_drop_inode(struct sfs_inode * inode) {
     struct sfs_dentry*  dentry_to_free;
     struct sfs_inode*   inode_cursor;
 
-    int byte_cursor = 0; 
-    int bit_cursor  = 0; 
-    int ino_cursor  = 0;
-    boolean is_find = FALSE;
-
     if (inode == sfs_super.root_dentry->inode) {
         return SFS_ERROR_INVAL;
     }
@@ -308,21 +370,8 @@ int sfs_drop_inode(struct sfs_inode * inode) {
         }
     }
     else if (SFS_IS_REG(inode) || SFS_IS_SYM_LINK(inode)) {
-        for (byte_cursor = 0; byte_cursor < SFS_BLKS_SZ(sfs_super.map_inode_blks); 
-            byte_cursor++)                            /* 调整inodemap */
-        {
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if (ino_cursor == inode->ino) {
-                     sfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
-                     is_find = TRUE;
-                     break;
-                }
-                ino_cursor++;
-            }
-            if (is_find == TRUE) {
-                break;
-            }
-        }
+                                                      /* 调整inodemap，直接定位到位 */
+        sfs_super.map_inode[inode->ino / UINT8_BITS] &= (uint8_t)(~(0x1 << (inode->ino % UINT8_BITS)));
         if (inode->data)
             free(inode->data);
         free(inode);
@@ -603,5 +652,8 @@ int sfs_umount() {
     free(sfs_super.map_inode);
     ddriver_close(SFS_DRIVER());
 
+    SFS_DBG("[io] direct %ld, bounced %ld, bounce buffer allocs %ld\n",
+            sfs_super.io_stats.direct, sfs_super.io_stats.bounced, sfs_super.io_stats.allocs);
+
     return SFS_ERROR_NONE;
 }